@@ -0,0 +1,348 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+#include "decode.h"
+#include "aot.h"
+
+#define AOT_LINES (INST_MEM_SIZE/4)
+
+// REGISTERS
+// x0 reads as 0 and its writes go nowhere, every other register is a local of guest_code
+static const char *reg(uint8_t r, char buf[8]) {
+    if(r == 0 || r == REG_SINK) {
+        return "0u";
+    }
+    snprintf(buf, 8, "r%u", r);
+    return buf;
+}
+
+static int writes_reg(const struct DECODED *inst) {
+    return inst->rd != 0 && inst->rd != REG_SINK;
+}
+
+static int is_branch(uint8_t op) {
+    return op >= OP_BEQ && op <= OP_BGEU;
+}
+
+// where a branch or jal lands, PC is 16 bits like the engines' vm->PC
+static uint32_t jump_target(uint32_t pc, const struct DECODED *inst) {
+    return (pc + inst->imm) & 0xffff;
+}
+
+static int in_code(uint32_t target) {
+    return target < INST_MEM_SIZE && target % 4 == 0;
+}
+
+// BLOCKS
+// a label starts at pc 0, every branch and jal target and every line after a control transfer
+static void find_leaders(const struct DECODED *code, uint8_t *leader) {
+    memset(leader, 0, AOT_LINES);
+    leader[0] = 1;
+    for(uint32_t i = 0 ; i < AOT_LINES ; i++) {
+        uint8_t op = code[i].op;
+        if(!is_branch(op) && op != OP_JAL && op != OP_JALR) {
+            continue;
+        }
+        if(op != OP_JALR && in_code(jump_target(i*4, &code[i]))) {
+            leader[jump_target(i*4, &code[i]) / 4] = 1;
+        }
+        if(i + 1 < AOT_LINES) {
+            leader[i + 1] = 1;
+        }
+    }
+}
+
+// a goto to the label, or leaving with rest instructions of the block not run when there is none;
+// a loop idiom's own back edge skips the attempt to run it whole, which already failed
+static void emit_goto(FILE *out, uint32_t target, int rest, const struct IDIOM *idioms, uint32_t pc) {
+    const struct IDIOM *idiom = idioms != NULL && in_code(target) ? &idioms[target / 4] : NULL;
+    if(idiom != NULL && idiom->kind != IDIOM_NONE && pc >= target && pc < target + idiom->len*4) {
+        fprintf(out, "goto I_%04x;", target);
+    }
+    else if(in_code(target)) {
+        fprintf(out, "goto L_%04x;", target);
+    }
+    else {
+        fprintf(out, "LEAVE(0x%04x, %d);", target, rest);
+    }
+}
+
+// INSTRUCTIONS
+static void emit_alu(FILE *out, const struct DECODED *inst) {
+    char d[8], a[8], b[8];
+    const char *rd = reg(inst->rd, d);
+    const char *rs1 = reg(inst->rs1, a);
+    const char *rs2 = reg(inst->rs2, b);
+    uint32_t imm = inst->imm;
+    switch(inst->op) {
+        case OP_ADD:   fprintf(out, "%s = %s + %s;", rd, rs1, rs2); break;
+        case OP_ADDI:  fprintf(out, "%s = %s + 0x%xu;", rd, rs1, imm); break;
+        case OP_SUB:   fprintf(out, "%s = %s - %s;", rd, rs1, rs2); break;
+        case OP_LUI:   fprintf(out, "%s = 0x%xu;", rd, imm); break;
+        case OP_XOR:   fprintf(out, "%s = %s ^ %s;", rd, rs1, rs2); break;
+        case OP_XORI:  fprintf(out, "%s = %s ^ 0x%xu;", rd, rs1, imm); break;
+        case OP_OR:    fprintf(out, "%s = %s | %s;", rd, rs1, rs2); break;
+        case OP_ORI:   fprintf(out, "%s = %s | 0x%xu;", rd, rs1, imm); break;
+        case OP_AND:   fprintf(out, "%s = %s & %s;", rd, rs1, rs2); break;
+        case OP_ANDI:  fprintf(out, "%s = %s & 0x%xu;", rd, rs1, imm); break;
+        case OP_SLL:   fprintf(out, "%s = %s << (%s & 0x1f);", rd, rs1, rs2); break;
+        case OP_SRL:   fprintf(out, "%s = %s >> (%s & 0x1f);", rd, rs1, rs2); break;
+        case OP_SRA:   fprintf(out, "%s = (uint32_t) ((int32_t) %s >> (%s & 0x1f));", rd, rs1, rs2); break;
+        // a register is never less than itself, and x < x would trip -Wtautological-compare
+        case OP_SLT:
+        case OP_SLTU:
+            if(inst->rs1 == inst->rs2) {
+                fprintf(out, "%s = 0;", rd);
+            }
+            else if(inst->op == OP_SLT) {
+                fprintf(out, "%s = (int32_t) %s < (int32_t) %s;", rd, rs1, rs2);
+            }
+            else {
+                fprintf(out, "%s = %s < %s;", rd, rs1, rs2);
+            }
+            break;
+        case OP_SLTI:  fprintf(out, "%s = (int32_t) %s < %d;", rd, rs1, inst->imm); break;
+        case OP_SLTIU: fprintf(out, "%s = %s < 0x%xu;", rd, rs1, imm); break;
+    }
+}
+
+// the direct path inline, virtual routines and everything else through mem_load_slow with the
+// state a routine may look at written back first
+static void emit_load(FILE *out, const struct DECODED *inst, uint32_t pc, int rest) {
+    char d[8], a[8];
+    int size = inst->op == OP_LW ? 4 : inst->op == OP_LH || inst->op == OP_LHU ? 2 : 1;
+    fprintf(out, "a = %s + 0x%xu;\n", reg(inst->rs1, a), (uint32_t) inst->imm);
+    fprintf(out, "    if(!mem_load_direct(vm, a, %d, &v)) { SYNC(0x%04x, %d); v = mem_load_slow(vm, a, %d); LOAD_REGS(); }",
+        size, pc, rest, size);
+    if(!writes_reg(inst)) {
+        return;
+    }
+    const char *rd = reg(inst->rd, d);
+    switch(inst->op) {
+        case OP_LB:  fprintf(out, "\n    %s = (uint32_t) (int8_t) v;", rd); break;
+        case OP_LH:  fprintf(out, "\n    %s = (uint32_t) (int16_t) v;", rd); break;
+        case OP_LBU: fprintf(out, "\n    %s = v & 0xff;", rd); break;
+        case OP_LHU: fprintf(out, "\n    %s = v & 0xffff;", rd); break;
+        default:     fprintf(out, "\n    %s = v;", rd); break;
+    }
+}
+
+// a store into instruction memory leaves, the engine runs the rewritten code
+static void emit_store(FILE *out, const struct DECODED *inst, uint32_t pc, int rest) {
+    char a[8], b[8];
+    int size = inst->op == OP_SW ? 4 : inst->op == OP_SH ? 2 : 1;
+    const char *rs2 = reg(inst->rs2, b);
+    fprintf(out, "a = %s + 0x%xu;\n", reg(inst->rs1, a), (uint32_t) inst->imm);
+    fprintf(out, "    if(!mem_store_direct(vm, a, %s, %d)) {\n", rs2, size);
+    fprintf(out, "        SYNC(0x%04x, %d); mem_store_slow(vm, a, %s, %d); LOAD_REGS();\n", pc, rest, rs2, size);
+    fprintf(out, "        if(vm->code_gen != code_gen) { LEAVE(0x%04x, %d); }\n    }", pc + 4, rest);
+}
+
+static void emit_branch(FILE *out, const struct DECODED *inst, uint32_t pc, int rest, const struct IDIOM *idioms) {
+    static const char *conds[] = {
+        [OP_BEQ - OP_BEQ] = "%s == %s", [OP_BNE - OP_BEQ] = "%s != %s",
+        [OP_BLT - OP_BEQ] = "(int32_t) %s < (int32_t) %s", [OP_BLTU - OP_BEQ] = "%s < %s",
+        [OP_BGE - OP_BEQ] = "(int32_t) %s >= (int32_t) %s", [OP_BGEU - OP_BEQ] = "%s >= %s"
+    };
+    // comparing a register with itself is decided here, the compiler would warn about it
+    if(inst->rs1 == inst->rs2) {
+        if(inst->op == OP_BEQ || inst->op == OP_BGE || inst->op == OP_BGEU) {
+            emit_goto(out, jump_target(pc, inst), rest, idioms, pc);
+        }
+        else {
+            fprintf(out, ";");
+        }
+        return;
+    }
+    char a[8], b[8];
+    fprintf(out, "if(");
+    fprintf(out, conds[inst->op - OP_BEQ], reg(inst->rs1, a), reg(inst->rs2, b));
+    fprintf(out, ") { ");
+    emit_goto(out, jump_target(pc, inst), rest, idioms, pc);
+    fprintf(out, " }");
+}
+
+// one line at pc, rest being how many of its block come after it
+static void emit_line(FILE *out, const struct DECODED *inst, uint32_t pc, int rest, const struct IDIOM *idioms) {
+    char d[8], a[8];
+    fprintf(out, "    ");
+    switch(inst->op) {
+        case OP_LB: case OP_LH: case OP_LW: case OP_LBU: case OP_LHU:
+            emit_load(out, inst, pc, rest);
+            break;
+        case OP_SB: case OP_SH: case OP_SW:
+            emit_store(out, inst, pc, rest);
+            break;
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLTU: case OP_BGE: case OP_BGEU:
+            emit_branch(out, inst, pc, rest, idioms);
+            break;
+        case OP_JAL:
+            if(writes_reg(inst)) {
+                fprintf(out, "%s = 0x%xu; ", reg(inst->rd, d), pc + 4);
+            }
+            emit_goto(out, jump_target(pc, inst), rest, idioms, pc);
+            break;
+        case OP_JALR:
+            // rs1 is read before rd is written, they may be the same register
+            fprintf(out, "pc = ((%s + 0x%xu) & ~1u) & 0xffff; ", reg(inst->rs1, a), (uint32_t) inst->imm);
+            if(writes_reg(inst)) {
+                fprintf(out, "%s = 0x%xu; ", reg(inst->rd, d), pc + 4);
+            }
+            fprintf(out, "goto dispatch;");
+            break;
+        case OP_INVALID:
+            // the engine reports it with the same message and dump
+            fprintf(out, "LEAVE(0x%04x, %d);", pc, rest + 1);
+            break;
+        default:
+            if(writes_reg(inst)) {
+                emit_alu(out, inst);
+            }
+            break;
+    }
+    fprintf(out, "\n");
+}
+
+// FILE
+static void emit_prologue(FILE *out, const char *image) {
+    fprintf(out, "// %s translated by vm_riskxvii --aot, build it against the library:\n", image);
+    fprintf(out, "//   cc -O2 -std=c11 -D_GNU_SOURCE -I<vm source> prog.c libriskxvii.a -pthread\n");
+    fprintf(out, "#include <stdio.h>\n#include <stdint.h>\n#include <string.h>\n\n");
+    fprintf(out, "#include \"structs_enums.h\"\n#include \"memory.h\"\n#include \"idiom.h\"\n#include \"riskxvii.h\"\n\n");
+
+    // registers written back before anything outside guest_code may look at them
+    fprintf(out, "#define SAVE_REGS() do {");
+    for(int r = 1 ; r < 32 ; r++) {
+        fprintf(out, "%s vm->registers[%d] = r%d;", r % 8 == 0 ? " \\\n   " : "", r, r);
+    }
+    fprintf(out, " } while(0)\n#define LOAD_REGS() do {");
+    for(int r = 1 ; r < 32 ; r++) {
+        fprintf(out, "%s r%d = vm->registers[%d];", r % 8 == 0 ? " \\\n   " : "", r, r);
+    }
+    fprintf(out, " } while(0)\n");
+    fprintf(out, "// state as the engines have it while the instruction at at runs\n");
+    fprintf(out, "#define SYNC(at, rest) do { SAVE_REGS(); vm->PC = (at); vm->insn_count = insns - (rest); } while(0)\n");
+    fprintf(out, "// hand over to the engine at at, rest instructions of the block did not run\n");
+    fprintf(out, "#define LEAVE(at, rest) do { pc = (at); insns -= (rest); goto leave; } while(0)\n\n");
+}
+
+// a recognized copy/fill/strlen loop first tries idiom_run, as the engines do at OP_IDIOM
+static void emit_idiom(FILE *out, const struct IDIOM *idiom, uint32_t pc) {
+    fprintf(out, "    SAVE_REGS();\n    if((ran = idiom_run(vm, 0x%04x)) != 0) { insns += ran; LOAD_REGS(); ", pc);
+    emit_goto(out, pc + idiom->len*4, 0, NULL, 0);
+    fprintf(out, " }\nI_%04x:\n", pc);
+}
+
+static void emit_code(FILE *out, const struct DECODED *code, const struct IDIOM *idioms) {
+    uint8_t leader[AOT_LINES];
+    find_leaders(code, leader);
+    // what the image uses, -Wall complains about the rest
+    int loads = 0, stores = 0, jalr = 0, loops = 0;
+    for(uint32_t i = 0 ; i < AOT_LINES ; i++) {
+        loads |= code[i].op >= OP_LB && code[i].op <= OP_LHU;
+        stores |= code[i].op >= OP_SB && code[i].op <= OP_SW;
+        jalr |= code[i].op == OP_JALR;
+        loops |= leader[i] && idioms[i].kind != IDIOM_NONE;
+    }
+
+    fprintf(out, "static void guest_code(struct VM *vm) {\n");
+    fprintf(out, "    uint32_t r1, r2, r3, r4, r5, r6, r7, r8, r9, r10, r11, r12, r13, r14, r15, r16,\n");
+    fprintf(out, "        r17, r18, r19, r20, r21, r22, r23, r24, r25, r26, r27, r28, r29, r30, r31;\n");
+    fprintf(out, "    LOAD_REGS();\n");
+    fprintf(out, "    uint64_t insns = vm->insn_count;\n");
+    fprintf(out, "    uint32_t pc = vm->PC;\n");
+    if(stores) {
+        fprintf(out, "    uint32_t code_gen = vm->code_gen;\n");
+    }
+    if(loops) {
+        fprintf(out, "    uint64_t ran;\n");
+    }
+    if(loads || stores) {
+        fprintf(out, "    uint32_t a;\n");
+    }
+    if(loads) {
+        fprintf(out, "    uint32_t v;\n");
+    }
+    fprintf(out, "\n%s    switch(pc) {\n", jalr ? "dispatch:\n" : "");
+    for(uint32_t i = 0 ; i < AOT_LINES ; i++) {
+        if(leader[i]) {
+            fprintf(out, "        case 0x%04x: goto L_%04x;\n", i*4, i*4);
+        }
+    }
+    fprintf(out, "    }\n    LEAVE(pc, 0);\n");
+
+    for(uint32_t i = 0 ; i < AOT_LINES ; ) {
+        uint32_t end = i + 1;
+        while(end < AOT_LINES && !leader[end]) {
+            end++;
+        }
+        fprintf(out, "\nL_%04x:\n", i*4);
+        if(idioms[i].kind != IDIOM_NONE) {
+            emit_idiom(out, &idioms[i], i*4);
+        }
+        fprintf(out, "    insns += %u;\n", end - i);
+        for(uint32_t j = i ; j < end ; j++) {
+            emit_line(out, &code[j], j*4, end - j - 1, idioms);
+        }
+        i = end;
+    }
+    fprintf(out, "    LEAVE(0x%04x, 0);\n\n", INST_MEM_SIZE);
+    fprintf(out, "leave:\n    SAVE_REGS();\n    vm->PC = pc;\n    vm->insn_count = insns;\n}\n\n");
+}
+
+static void emit_main(FILE *out, const uint8_t *image) {
+    fprintf(out, "static const uint8_t image[IMAGE_SIZE] = {");
+    for(int i = 0 ; i < IMAGE_SIZE ; i++) {
+        fprintf(out, "%s0x%02x,", i % 16 == 0 ? "\n    " : " ", image[i]);
+    }
+    fprintf(out, "\n};\n\n");
+    fprintf(out, "// usage: prog [--stats], the console is stdin/stdout as for vm_riskxvii\n");
+    fprintf(out, "int main(int argc, char *argv[]) {\n");
+    fprintf(out, "    struct VM *vm = vm_create();\n");
+    fprintf(out, "    if(vm == NULL) {\n        printf(\"Out of memory\\n\");\n        return 1;\n    }\n");
+    fprintf(out, "    vm_set_io(vm, stdin, 1, 1);\n");
+    fprintf(out, "    int status = vm_load_image(vm, image, IMAGE_SIZE);\n");
+    fprintf(out, "    if(status == VM_OK) {\n        status = vm_run_compiled(vm, guest_code);\n    }\n");
+    fprintf(out, "    if(argc > 1 && strcmp(argv[1], \"--stats\") == 0) {\n");
+    fprintf(out, "        fprintf(stderr, \"run time: %%.1f us\\n\", vm->run_ns / 1e3);\n");
+    fprintf(out, "        fprintf(stderr, \"instructions: %%llu\\n\", (unsigned long long) vm_insn_count(vm));\n    }\n");
+    fprintf(out, "    vm_destroy(vm);\n");
+    fprintf(out, "    return status == VM_OK || status == VM_HALT ? 0 : 1;\n}\n");
+}
+
+int run_aot(struct OPTIONS *opts) {
+    struct VM *vm = vm_create();
+    if(vm == NULL) {
+        printf("Out of memory\n");
+        return 1;
+    }
+    if(vm_load(vm, opts->filename) != VM_OK) {
+        vm_destroy(vm);
+        return 1;
+    }
+    // from the raw lines, the decoded ones carry loop idiom heads
+    struct DECODED code[AOT_LINES];
+    for(uint32_t i = 0 ; i < AOT_LINES ; i++) {
+        decode_line(inst_line(vm, i), &code[i]);
+    }
+    FILE *out = fopen(opts->aot_out, "w");
+    if(out == NULL) {
+        printf("Cannot write translation: %s\n", opts->aot_out);
+        vm_destroy(vm);
+        return 1;
+    }
+    emit_prologue(out, opts->filename);
+    emit_code(out, code, vm->idioms);
+    emit_main(out, vm->image);
+    int failed = ferror(out);
+    failed |= fclose(out) != 0;
+    vm_destroy(vm);
+    if(failed) {
+        printf("Cannot write translation: %s\n", opts->aot_out);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,13 @@
+#ifndef AOT_H_
+#define AOT_H_
+#include "structs_enums.h"
+
+// AHEAD OF TIME TRANSLATION (aot.c)
+// writes opts->filename as C to opts->aot_out: one label per basic block of instruction memory,
+// branches and jal as gotos, jalr through a switch over the labels, guest registers as locals;
+// loads and stores take the library's direct page path inline and its slow path (virtual
+// routines, the heap, tracked pages) through mem_load_slow/mem_store_slow, and the program's
+// main runs the result with vm_run_compiled. 0 if the file was written
+int run_aot(struct OPTIONS *opts);
+
+#endif
@@ -0,0 +1,295 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+#include "batch.h"
+
+// MANIFEST
+// returns the number of jobs, -1 if the manifest cannot be read; strings point into *text
+static long read_manifest(const char *filename, char **text, struct BATCH_JOB **jobs) {
+    FILE *file = fopen(filename, "rb");
+    if(file == NULL) {
+        printf("File does not exist\n");
+        return -1;
+    }
+    // read to the end rather than trusting the file size, so pipes and fifos work too
+    size_t size = 0;
+    size_t cap = 4096;
+    *text = malloc(cap);
+    while(*text != NULL) {
+        size += fread(*text + size, 1, cap - 1 - size, file);
+        if(size < cap - 1) {
+            break;
+        }
+        char *grown = realloc(*text, cap * 2);
+        if(grown == NULL) {
+            free(*text);
+        }
+        *text = grown;
+        cap *= 2;
+    }
+    if(*text == NULL || ferror(file)) {
+        fclose(file);
+        free(*text);
+        printf("fread error\n");
+        return -1;
+    }
+    fclose(file);
+    (*text)[size] = '\0';
+
+    // upper bound, one job per line
+    size_t max_jobs = 1;
+    for(size_t i = 0 ; i < size ; i++) {
+        max_jobs += (*text)[i] == '\n';
+    }
+    *jobs = calloc(max_jobs, sizeof(struct BATCH_JOB));
+    if(*jobs == NULL) {
+        printf("Out of memory\n");
+        return -1;
+    }
+
+    long num_jobs = 0;
+    char *save_line;
+    for(char *line = strtok_r(*text, "\n", &save_line) ; line != NULL ; line = strtok_r(NULL, "\n", &save_line)) {
+        char *fields[3] = { NULL, NULL, NULL };
+        int num_fields = 0;
+        char *save_field;
+        for(char *field = strtok_r(line, " \t\r", &save_field) ; field != NULL && num_fields < 3 ;
+            field = strtok_r(NULL, " \t\r", &save_field)) {
+            fields[num_fields++] = field;
+        }
+        // blank lines and # comments
+        if(num_fields == 0 || fields[0][0] == '#') {
+            continue;
+        }
+        struct BATCH_JOB *job = &(*jobs)[num_jobs++];
+        job->image = fields[0];
+        job->input = fields[1] != NULL && strcmp(fields[1], "-") != 0 ? fields[1] : NULL;
+        job->output = fields[2] != NULL && strcmp(fields[2], "-") != 0 ? fields[2] : NULL;
+    }
+    return num_jobs;
+}
+
+// WORK STEALING
+// next job index for worker, taken from its own queue or stolen from another, -1 when all are empty
+static long take_job(struct BATCH_WORKER *worker) {
+    struct BATCH *batch = worker->batch;
+    long job = -1;
+    pthread_mutex_lock(&worker->lock);
+    if(worker->next < worker->end) {
+        job = worker->next++;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    if(job >= 0) {
+        return job;
+    }
+
+    // only one lock is held at a time, a thief's own queue is empty while it steals
+    for(int i = 1 ; i < batch->num_workers ; i++) {
+        struct BATCH_WORKER *victim = &batch->workers[(worker->id + i) % batch->num_workers];
+        pthread_mutex_lock(&victim->lock);
+        size_t left = victim->end - victim->next;
+        size_t start = victim->end;
+        size_t end = victim->end;
+        if(left > 0) {
+            // the back half, the victim keeps working through the front
+            start = victim->end - (left + 1) / 2;
+            victim->end = start;
+        }
+        pthread_mutex_unlock(&victim->lock);
+        if(start < end) {
+            pthread_mutex_lock(&worker->lock);
+            worker->next = start + 1;
+            worker->end = end;
+            worker->steals++;
+            pthread_mutex_unlock(&worker->lock);
+            return start;
+        }
+    }
+    return -1;
+}
+
+// detach (and flush) before the handles go away
+static void job_close(struct VM *vm, int out_fd) {
+    vm_set_io(vm, NULL, -1, 0);
+    if(out_fd >= 0) {
+        close(out_fd);
+    }
+}
+
+// vm loaded with the job's image and attached to its files, VM_OK or VM_LOAD_ERROR with
+// nothing left open
+static int job_open(struct VM *vm, struct BATCH_JOB *job, int *out_fd) {
+    *out_fd = -1;
+    if(job->output != NULL && (*out_fd = open(job->output, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        return VM_LOAD_ERROR;
+    }
+
+    // the input file is mapped and parsed in place
+    vm_set_io(vm, NULL, *out_fd, 0);
+    int status = job->input != NULL && vm_set_input(vm, job->input) != 0 ? VM_LOAD_ERROR : vm_load(vm, job->image);
+    if(status != VM_OK) {
+        job_close(vm, *out_fd);
+    }
+    return status;
+}
+
+static int run_job(struct VM *vm, struct BATCH_JOB *job, enum ENGINE engine) {
+    int out_fd;
+    int status = job_open(vm, job, &out_fd);
+    if(status == VM_OK) {
+        status = vm_run(vm, engine);
+        job_close(vm, out_fd);
+    }
+    return status;
+}
+
+// up to one job per vm, the loaded ones run together by the lane engine
+static void run_lanes(struct BATCH_WORKER *worker, struct VM **vms, long *jobs, int num) {
+    struct BATCH *batch = worker->batch;
+    struct VM *loaded[LANES_MAX];
+    int out_fds[LANES_MAX];
+    int status[LANES_MAX];
+    int num_loaded = 0;
+    for(int i = 0 ; i < num ; i++) {
+        batch->jobs[jobs[i]].status = job_open(vms[i], &batch->jobs[jobs[i]], &out_fds[i]);
+        if(batch->jobs[jobs[i]].status == VM_OK) {
+            loaded[num_loaded++] = vms[i];
+        }
+    }
+    int ganged = vm_run_lanes(loaded, num_loaded, batch->engine, status);
+    worker->ganged += ganged > 0 ? ganged : 0;
+    for(int i = 0, lane = 0 ; i < num ; i++) {
+        if(batch->jobs[jobs[i]].status == VM_OK) {
+            batch->jobs[jobs[i]].status = ganged >= 0 ? status[lane++] : VM_LOAD_ERROR;
+            job_close(vms[i], out_fds[i]);
+        }
+    }
+    worker->ran += num;
+}
+
+// one vm per worker, or one per lane, reloaded for every job it runs
+static void *worker_main(void *arg) {
+    struct BATCH_WORKER *worker = arg;
+    struct BATCH *batch = worker->batch;
+    struct VM *vms[LANES_MAX];
+    int num_vms = 0;
+    while(num_vms < batch->lanes) {
+        struct VM *vm = vm_create();
+        if(vm == NULL) {
+            break;
+        }
+        vm_set_limits(vm, batch->max_insns, batch->timeout_ms);
+        if(vm_set_memory(vm, batch->memory) != 0) {
+            vm_destroy(vm);
+            break;
+        }
+        vms[num_vms++] = vm;
+    }
+    if(num_vms == batch->lanes && batch->lanes > 1) {
+        for(;;) {
+            long jobs[LANES_MAX];
+            long job;
+            int num = 0;
+            while(num < batch->lanes && (job = take_job(worker)) >= 0) {
+                jobs[num++] = job;
+            }
+            if(num == 0) {
+                break;
+            }
+            run_lanes(worker, vms, jobs, num);
+        }
+    }
+    else if(num_vms == batch->lanes) {
+        for(long job = take_job(worker) ; job >= 0 ; job = take_job(worker)) {
+            batch->jobs[job].status = run_job(vms[0], &batch->jobs[job], batch->engine);
+            worker->ran++;
+        }
+    }
+    for(int i = 0 ; i < num_vms ; i++) {
+        vm_destroy(vms[i]);
+    }
+    return NULL;
+}
+
+static double now_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// BATCH RUNNER (batch.h)
+int run_batch(struct OPTIONS *opts) {
+    struct BATCH batch;
+    char *text = NULL;
+    long num_jobs = read_manifest(opts->batch, &text, &batch.jobs);
+    if(num_jobs < 0) {
+        return 1;
+    }
+    batch.num_jobs = num_jobs;
+    batch.engine = opts->engine;
+    batch.max_insns = opts->max_insns;
+    batch.timeout_ms = opts->timeout_ms;
+    batch.memory = opts->memory;
+    batch.lanes = opts->lanes;
+    batch.num_workers = opts->jobs > 0 ? opts->jobs : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if(batch.num_workers > num_jobs) {
+        batch.num_workers = num_jobs;
+    }
+    if(batch.num_workers < 1) {
+        batch.num_workers = 1;
+    }
+    batch.workers = calloc(batch.num_workers, sizeof(struct BATCH_WORKER));
+
+    // every job starts out queued, worker i gets the i-th contiguous slice
+    for(int i = 0 ; i < batch.num_workers ; i++) {
+        struct BATCH_WORKER *worker = &batch.workers[i];
+        worker->id = i;
+        worker->batch = &batch;
+        worker->next = batch.num_jobs * i / batch.num_workers;
+        worker->end = batch.num_jobs * (i+1) / batch.num_workers;
+        pthread_mutex_init(&worker->lock, NULL);
+    }
+    for(size_t i = 0 ; i < batch.num_jobs ; i++) {
+        batch.jobs[i].status = VM_LOAD_ERROR;
+    }
+
+    double start = now_seconds();
+    for(int i = 0 ; i < batch.num_workers ; i++) {
+        pthread_create(&batch.workers[i].thread, NULL, worker_main, &batch.workers[i]);
+    }
+    uint64_t steals = 0;
+    uint64_t ganged = 0;
+    for(int i = 0 ; i < batch.num_workers ; i++) {
+        pthread_join(batch.workers[i].thread, NULL);
+        pthread_mutex_destroy(&batch.workers[i].lock);
+        steals += batch.workers[i].steals;
+        ganged += batch.workers[i].ganged;
+    }
+    double elapsed = now_seconds() - start;
+
+    size_t failed = 0;
+    for(size_t i = 0 ; i < batch.num_jobs ; i++) {
+        int status = batch.jobs[i].status;
+        if(status != VM_OK && status != VM_HALT) {
+            fprintf(stderr, "%s: %s\n", batch.jobs[i].image, vm_status_name(status));
+            failed++;
+        }
+    }
+    printf("batch: %zu images, %zu ok, %zu failed, %d workers, %lu steals\n", batch.num_jobs,
+        batch.num_jobs - failed, failed, batch.num_workers, (unsigned long) steals);
+    printf("batch: %.3f s, %.1f images/s\n", elapsed, elapsed > 0 ? batch.num_jobs / elapsed : 0.0);
+    if(batch.lanes > 1) {
+        printf("batch: %lu images in gangs of up to %d lanes\n", (unsigned long) ganged, batch.lanes);
+    }
+
+    free(batch.workers);
+    free(batch.jobs);
+    free(text);
+    return failed == 0 ? 0 : 1;
+}
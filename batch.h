@@ -0,0 +1,45 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "structs_enums.h"
+
+// one manifest line: image [input] [output], "-" or a missing field for none
+struct BATCH_JOB {
+    char *image;
+    char *input;    // R_CHAR/R_INT read from here, NULL reads as 0
+    char *output;   // console output, NULL drops it
+    int status;     // enum VM_STATUS
+};
+
+// jobs [next, end) are queued on this worker, the owner takes from next and thieves from end
+struct BATCH_WORKER {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    size_t next;
+    size_t end;
+    int id;
+    uint64_t ran;
+    uint64_t steals;
+    uint64_t ganged;    // images run in lanes rather than on their own
+    struct BATCH *batch;
+};
+
+struct BATCH {
+    struct BATCH_JOB *jobs;
+    size_t num_jobs;
+    struct BATCH_WORKER *workers;
+    int num_workers;
+    enum ENGINE engine;
+    uint64_t max_insns;     // per job, 0 for no limit
+    uint64_t timeout_ms;
+    enum VM_MEMORY memory;
+    int lanes;      // jobs taken and run together at a time, 1 runs them one by one
+};
+
+// BATCH RUNNER (batch.c)
+// run every image in the manifest, print throughput, 0 if every image ended normally
+int run_batch(struct OPTIONS *opts);
+
+#endif
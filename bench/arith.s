@@ -0,0 +1,17 @@
+# tight arithmetic loop: add/xor/shift chains, no memory traffic
+    li s0, 2000000
+    addi t0, zero, 1
+    addi t1, zero, 7
+loop:
+    add t0, t0, t1
+    xor t1, t1, t0
+    sll t2, t0, t1
+    srl t3, t1, t0
+    sub t0, t0, t3
+    or t1, t1, t2
+    addi s0, s0, -1
+    bne s0, zero, loop
+    li t4, 0x804
+    sw t0, 0(t4)
+    li t4, 0x80c
+    sw zero, 0(t4)
@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Tiny RISK-XVII assembler for the bench corpus: python3 asm.py prog.s prog.mi writes a 2048 byte image."""
+import re, struct, sys
+
+REGS = {f"x{i}": i for i in range(32)}
+ABI = "zero ra sp gp tp t0 t1 t2 s0 s1 a0 a1 a2 a3 a4 a5 a6 a7 s2 s3 s4 s5 s6 s7 s8 s9 s10 s11 t3 t4 t5 t6".split()
+for i, n in enumerate(ABI):
+    REGS[n] = i
+REGS["fp"] = 8
+
+R = {"add": (0, 0), "sub": (0, 0x20), "xor": (4, 0), "or": (6, 0), "and": (7, 0),
+     "sll": (1, 0), "srl": (5, 0), "sra": (5, 0x20), "slt": (2, 0), "sltu": (3, 0)}
+I = {"addi": 0, "xori": 4, "ori": 6, "andi": 7, "slti": 2, "sltiu": 3}
+L = {"lb": 0, "lh": 1, "lw": 2, "lbu": 4, "lhu": 5}
+S = {"sb": 0, "sh": 1, "sw": 2}
+B = {"beq": 0, "bne": 1, "blt": 4, "bge": 5, "bltu": 6, "bgeu": 7}
+
+
+def reg(s):
+    return REGS[s.strip()]
+
+
+def num(s, labels, pc, rel=False):
+    s = s.strip()
+    if s in labels:
+        return labels[s] - pc if rel else labels[s]
+    return int(s, 0)
+
+
+def memop(s):
+    m = re.match(r"(.*)\((\w+)\)", s.strip())
+    return m.group(1) or "0", m.group(2)
+
+
+def assemble(src):
+    lines = []
+    data = bytearray(1024)
+    dp = 0
+    labels = {}
+    pc = 0
+    section = "text"
+    for raw in src.splitlines():
+        line = raw.split("#")[0].strip()
+        if not line:
+            continue
+        while ":" in line and re.match(r"^\w+:", line):
+            lab, line = line.split(":", 1)
+            labels[lab] = pc if section == "text" else 0x400 + dp
+            line = line.strip()
+        if not line:
+            continue
+        if line == ".data":
+            section = "data"
+            continue
+        if line == ".text":
+            section = "text"
+            continue
+        if section == "data":
+            op, rest = (line.split(None, 1) + [""])[:2]
+            if op == ".word":
+                for v in rest.split(","):
+                    data[dp:dp + 4] = struct.pack("<I", int(v, 0) & 0xffffffff)
+                    dp += 4
+            elif op == ".byte":
+                for v in rest.split(","):
+                    data[dp] = int(v, 0) & 0xff
+                    dp += 1
+            elif op == ".asciz":
+                s = bytes(eval(rest), "latin1") + b"\0"
+                data[dp:dp + len(s)] = s
+                dp += len(s)
+            elif op == ".space":
+                dp += int(rest, 0)
+            continue
+        lines.append((pc, line))
+        op = line.split()[0]
+        pc += 8 if op == "li" else 4
+    words = []
+    for pc, line in lines:
+        parts = line.split(None, 1)
+        op = parts[0]
+        args = [a.strip() for a in parts[1].split(",")] if len(parts) > 1 else []
+        if op == "li":
+            v = num(args[1], labels, pc) & 0xffffffff
+            lo = v & 0xfff
+            if lo >= 0x800:
+                lo -= 0x1000
+            hi = ((v - lo) >> 12) & 0xfffff
+            words.append(0x37 | reg(args[0]) << 7 | hi << 12)
+            words.append(0x13 | reg(args[0]) << 7 | reg(args[0]) << 15 | (lo & 0xfff) << 20)
+            continue
+        if op == "nop":
+            op, args = "addi", ["zero", "zero", "0"]
+        if op == "mv":
+            op, args = "addi", [args[0], args[1], "0"]
+        if op == "j":
+            op, args = "jal", ["zero", args[0]]
+        if op == "ret":
+            op, args = "jalr", ["zero", "0(ra)"]
+        if op == "call":
+            op, args = "jal", ["ra", args[0]]
+        if op in R:
+            f3, f7 = R[op]
+            w = 0x33 | reg(args[0]) << 7 | f3 << 12 | reg(args[1]) << 15 | reg(args[2]) << 20 | f7 << 25
+        elif op in I:
+            imm = num(args[2], labels, pc) & 0xfff
+            w = 0x13 | reg(args[0]) << 7 | I[op] << 12 | reg(args[1]) << 15 | imm << 20
+        elif op in L:
+            off, base = memop(args[1])
+            imm = num(off, labels, pc) & 0xfff
+            w = 0x03 | reg(args[0]) << 7 | L[op] << 12 | reg(base) << 15 | imm << 20
+        elif op == "jalr":
+            off, base = memop(args[1])
+            imm = num(off, labels, pc) & 0xfff
+            w = 0x67 | reg(args[0]) << 7 | reg(base) << 15 | imm << 20
+        elif op in S:
+            off, base = memop(args[1])
+            imm = num(off, labels, pc) & 0xfff
+            w = 0x23 | (imm & 0x1f) << 7 | S[op] << 12 | reg(base) << 15 | reg(args[0]) << 20 | (imm >> 5) << 25
+        elif op in B:
+            imm = num(args[2], labels, pc, rel=True) & 0x1fff
+            w = (0x63 | ((imm >> 11) & 1) << 7 | ((imm >> 1) & 0xf) << 8 | B[op] << 12 | reg(args[0]) << 15
+                 | reg(args[1]) << 20 | ((imm >> 5) & 0x3f) << 25 | ((imm >> 12) & 1) << 31)
+        elif op == "lui":
+            w = 0x37 | reg(args[0]) << 7 | (num(args[1], labels, pc) & 0xfffff) << 12
+        elif op == "jal":
+            imm = num(args[1], labels, pc, rel=True) & 0x1fffff
+            w = (0x6f | reg(args[0]) << 7 | ((imm >> 12) & 0xff) << 12 | ((imm >> 11) & 1) << 20
+                 | ((imm >> 1) & 0x3ff) << 21 | ((imm >> 20) & 1) << 31)
+        elif op == ".word":
+            w = int(args[0], 0)
+        else:
+            raise SystemExit(f"unknown op {op}")
+        words.append(w & 0xffffffff)
+    if len(words) > 256:
+        raise SystemExit("program too large")
+    text = b"".join(struct.pack("<I", w) for w in words).ljust(1024, b"\0")
+    return text + bytes(data)
+
+
+if __name__ == "__main__":
+    src = open(sys.argv[1]).read()
+    open(sys.argv[2], "wb").write(assemble(src))
@@ -0,0 +1,40 @@
+# data dependent branches on a linear congruential sequence
+    li s0, 100000
+    li s1, 1103515245
+    addi s4, zero, 1
+    addi s5, zero, 16
+    addi s3, zero, 1
+    addi s2, zero, 12345
+    addi a0, zero, 0
+    addi a1, zero, 0
+loop:
+    # x = x * 1103515245 + 12345 by shift and add, there is no multiply
+    addi t0, zero, 0
+    add t1, s3, zero
+    add t2, s1, zero
+mul:
+    andi t3, t2, 1
+    beq t3, zero, skip
+    add t0, t0, t1
+skip:
+    add t1, t1, t1
+    srl t2, t2, s4
+    bne t2, zero, mul
+    add s3, t0, s2
+    srl t4, s3, s5
+    andi t5, t4, 1
+    beq t5, zero, even
+    addi a0, a0, 1
+    j next
+even:
+    andi t5, t4, 2
+    bne t5, zero, next
+    addi a1, a1, 1
+next:
+    addi s0, s0, -1
+    bne s0, zero, loop
+    li t6, 0x804
+    sw a0, 0(t6)
+    sw a1, 0(t6)
+    li t6, 0x80c
+    sw zero, 0(t6)
@@ -0,0 +1,39 @@
+# heap churn: keep 8 live allocations of varying sizes, free and reallocate one per step
+    li s0, 100000
+    li s1, 0x830    # malloc
+    li s2, 0x834    # free
+    li s3, 0x400    # table of live pointers in data memory
+    addi s4, zero, 1    # size seed
+    addi s5, zero, 0    # slot
+    addi s6, zero, 0    # checksum
+    addi s7, zero, 3
+loop:
+    add t0, s5, s5
+    add t0, t0, t0
+    add t0, t0, s3
+    lw a0, 0(t0)
+    beq a0, zero, fresh
+    lw t1, 0(a0)
+    add s6, s6, t1
+    sw a0, 0(s2)
+fresh:
+    # size 1..1024 from a xorshift of the seed
+    add t2, s4, s4
+    xor s4, s4, t2
+    srl t2, s4, s7
+    xor s4, s4, t2
+    andi t3, s4, 1023
+    addi t3, t3, 1
+    sw t3, 0(s1)
+    sw x28, 0(t0)
+    beq x28, zero, next
+    sw s0, 0(x28)
+next:
+    addi s5, s5, 1
+    andi s5, s5, 7
+    addi s0, s0, -1
+    bne s0, zero, loop
+    li t4, 0x804
+    sw s6, 0(t4)
+    li t4, 0x80c
+    sw zero, 0(t4)
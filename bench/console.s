@@ -0,0 +1,19 @@
+# character at a time console output, 200000 characters in lines of 64
+    li s0, 200000
+    li s1, 0x800
+    addi s2, zero, 64
+    addi t0, zero, 0
+    addi t1, zero, 10
+loop:
+    andi t2, s0, 31
+    addi t2, t2, 64
+    sw t2, 0(s1)
+    addi t0, t0, 1
+    bne t0, s2, same
+    sw t1, 0(s1)
+    addi t0, zero, 0
+same:
+    addi s0, s0, -1
+    bne s0, zero, loop
+    li t4, 0x80c
+    sw zero, 0(t4)
@@ -0,0 +1,43 @@
+# buffer loops: word fill of data memory, byte copy into the heap and a strlen, 2000 passes
+    li s0, 2000
+    li t0, 0x830    # malloc
+    li t1, 1024
+    sw t1, 0(t0)
+    addi s1, x28, 0     # heap buffer
+    li s2, 0x400
+    li s3, 0x800
+    addi s4, zero, 0    # checksum
+pass:
+    # memset(data, pass, 1024) a word at a time
+    addi a0, s2, 0
+fill:
+    sw s0, 0(a0)
+    addi a0, a0, 4
+    bne a0, s3, fill
+    # string terminator at a place that moves with the pass
+    andi t2, s0, 511
+    add t2, t2, s2
+    sb zero, 0(t2)
+    # memcpy(heap, data, 1024) a byte at a time
+    addi a0, s2, 0
+    addi a1, s1, 0
+copy:
+    lbu t3, 0(a0)
+    sb t3, 0(a1)
+    addi a0, a0, 1
+    addi a1, a1, 1
+    bltu a0, s3, copy
+    # strlen(heap)
+    addi a2, s1, 0
+len:
+    lbu t4, 0(a2)
+    addi a2, a2, 1
+    bne t4, zero, len
+    sub t5, a2, s1
+    add s4, s4, t5
+    addi s0, s0, -1
+    bne s0, zero, pass
+    li t0, 0x804
+    sw s4, 0(t0)
+    li t0, 0x80c
+    sw zero, 0(t0)
@@ -0,0 +1,26 @@
+# lw/sw streaming over all of data memory, each word becomes itself plus the word before plus 1
+    li s0, 4000
+    li s1, 0x800
+pass:
+    li t0, 0x400
+    addi t1, zero, 0
+word:
+    lw t2, 0(t0)
+    add t2, t2, t1
+    addi t2, t2, 1
+    sw t2, 0(t0)
+    lw t3, 4(t0)
+    add t3, t3, t2
+    addi t3, t3, 1
+    sw t3, 4(t0)
+    add t1, t3, zero
+    addi t0, t0, 8
+    blt t0, s1, word
+    addi s0, s0, -1
+    bne s0, zero, pass
+    li t4, 0x7fc
+    lw t5, 0(t4)
+    li t4, 0x804
+    sw t5, 0(t4)
+    li t4, 0x80c
+    sw zero, 0(t4)
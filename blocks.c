@@ -0,0 +1,418 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "structs_enums.h"
+#include "store_load_helper.h"
+#include "vir_routine.h"
+#include "heap.h"
+#include "exec_helpers.h"
+#include "blocks.h"
+#include "idiom.h"
+#include "sampler.h"
+
+#if defined(__GNUC__) && !defined(VM_NO_THREADED)
+#define THREADED 1
+#endif
+
+// BLOCK DISCOVERY (blocks.h)
+// branches and jumps end a block, an invalid instruction ends it too since it never returns
+int is_block_end(uint8_t op) {
+    return (op >= OP_BEQ && op <= OP_JALR) || op == OP_INVALID;
+}
+
+// find block leaders from branch and jal targets and the instructions after every jump
+void blocks_init(struct VM *vm) {
+    struct BLOCK_CACHE *cache = &vm->blocks;
+    memset(cache->blocks, 0, sizeof(cache->blocks));
+    memset(cache->leader, 0, sizeof(cache->leader));
+    cache->code_used = 0;
+    cache->num_built = 0;
+    cache->code_gen = vm->code_gen;
+    cache->flush_count++;
+
+    cache->leader[0] = 1;
+    for(int i = 0 ; i < INST_MEM_SIZE/4 ; i++) {
+        struct DECODED *inst = &vm->decoded[i];
+        if(!is_block_end(inst->op)) {
+            continue;
+        }
+        if(i+1 < INST_MEM_SIZE/4) {
+            cache->leader[i+1] = 1;
+        }
+        if(inst->op != OP_JALR && inst->op != OP_INVALID) {
+            uint32_t target = (uint32_t) (i*4 + inst->imm) & 0xffff;
+            if(target <= 0x3ff) {
+                cache->leader[target/4] = 1;
+            }
+        }
+    }
+}
+
+// INSTRUCTION COUNT (blocks.h)
+// every entry of a block counts its whole length, exec_count - counted entries are not in vm->insn_count yet
+static void fold_count(struct VM *vm, struct BLOCK *block) {
+    if(block->built) {
+        vm->insn_count += (block->exec_count - block->counted) * block->len;
+    }
+    block->counted = block->exec_count;
+}
+
+uint64_t blocks_insn_count(struct VM *vm) {
+    uint64_t count = 0;
+    for(uint32_t i = 0 ; i < vm->blocks.num_built ; i++) {
+        struct BLOCK *block = &vm->blocks.blocks[vm->blocks.built_list[i]];
+        count += (block->exec_count - block->counted) * block->len;
+    }
+    return count;
+}
+
+// drop every built block, used when the guest rewrites its own code or the code pool fills
+static void blocks_flush(struct VM *vm) {
+    struct BLOCK_CACHE *cache = &vm->blocks;
+    for(int i = 0 ; i < INST_MEM_SIZE/4 ; i++) {
+        fold_count(vm, &cache->blocks[i]);
+        cache->blocks[i].built = 0;
+        cache->blocks[i].taken = NULL;
+        cache->blocks[i].fallthrough = NULL;
+        cache->blocks[i].native = NULL;
+        cache->blocks[i].no_jit = 0;
+    }
+    cache->code_used = 0;
+    cache->num_built = 0;
+    cache->flush_count++;
+    if(cache->code_gen != vm->code_gen) {
+        uint64_t counts[INST_MEM_SIZE/4];
+        for(int i = 0 ; i < INST_MEM_SIZE/4 ; i++) {
+            counts[i] = cache->blocks[i].exec_count;
+        }
+        blocks_init(vm);
+        for(int i = 0 ; i < INST_MEM_SIZE/4 ; i++) {
+            cache->blocks[i].exec_count = counts[i];
+            cache->blocks[i].counted = counts[i];
+        }
+    }
+}
+
+// copy the decoded run starting at pc into the code pool
+static void block_build(struct VM *vm, struct BLOCK *block, uint32_t pc) {
+    struct BLOCK_CACHE *cache = &vm->blocks;
+    fold_count(vm, block);
+    uint32_t first = pc / 4;
+    uint32_t last = first;
+    while(!is_block_end(vm->decoded[last].op) && last+1 < INST_MEM_SIZE/4 && !cache->leader[last+1]) {
+        last++;
+    }
+    uint32_t len = last - first + 1;
+    if(cache->code_used + len + 1 > BLOCK_CODE_SIZE) {
+        blocks_flush(vm);
+    }
+
+    block->code = &cache->code[cache->code_used];
+    memcpy(block->code, &vm->decoded[first], len * sizeof(struct DECODED));
+    block->code[len].op = OP_BLOCK_END;
+    cache->code_used += len + 1;
+
+    struct DECODED *end = &block->code[len-1];
+    block->start_pc = pc;
+    block->len = len;
+    block->fall_pc = (pc + len*4) & 0xffff;
+    block->taken_pc = 0xffff;
+    if(is_block_end(end->op) && end->op != OP_JALR && end->op != OP_INVALID) {
+        block->taken_pc = (pc + (len-1)*4 + end->imm) & 0xffff;
+    }
+    block->taken = NULL;
+    block->fallthrough = NULL;
+    block->native = NULL;
+    block->no_jit = 0;
+    if(!block->built) {
+        cache->built_list[cache->num_built++] = first;
+    }
+    block->built = 1;
+}
+
+// block starting exactly at pc, built on first use, NULL once pc leaves instruction memory
+struct BLOCK *block_lookup(struct VM *vm, uint32_t pc) {
+    struct BLOCK_CACHE *cache = &vm->blocks;
+    if(cache->code_gen != vm->code_gen) {
+        blocks_flush(vm);
+    }
+    if(pc > 0x3ff) {
+        return NULL;
+    }
+    struct BLOCK *block = &cache->blocks[pc/4];
+    if(!block->built || block->start_pc != pc) {
+        // entered mid-block (jalr), it becomes a leader of its own
+        cache->leader[pc/4] = 1;
+        block_build(vm, block, pc);
+    }
+    return block;
+}
+
+// per-block execution counts, hottest first
+void dump_block_counts(struct VM *vm, FILE *out) {
+    struct BLOCK *order[INST_MEM_SIZE/4];
+    int num = 0;
+    for(int i = 0 ; i < INST_MEM_SIZE/4 ; i++) {
+        if(vm->blocks.blocks[i].exec_count != 0) {
+            order[num++] = &vm->blocks.blocks[i];
+        }
+    }
+    // insertion sort, there are at most 256 blocks
+    for(int i = 1 ; i < num ; i++) {
+        struct BLOCK *cur = order[i];
+        int j = i - 1;
+        while(j >= 0 && order[j]->exec_count < cur->exec_count) {
+            order[j+1] = order[j];
+            j--;
+        }
+        order[j+1] = cur;
+    }
+    for(int i = 0 ; i < num ; i++) {
+        fprintf(out, "block 0x%04x len %u count %llu\n", order[i]->start_pc, order[i]->len,
+            (unsigned long long) order[i]->exec_count);
+    }
+}
+
+// BLOCK EXECUTION (blocks.h)
+// runs whole blocks without PC bound checks, following the successor pointers between them,
+// returns with vm->PC at the first block entered again that has run hot_threshold times
+void run_blocks(struct VM *vm, uint64_t hot_threshold) {
+    uint32_t *reg = vm->registers;
+    struct BLOCK *block;
+    struct DECODED *inst;
+    uint32_t target;
+
+#ifdef THREADED
+    static void *const handlers[OP_NUM+1] = {
+        [OP_ADD] = &&do_ADD,     [OP_ADDI] = &&do_ADDI,   [OP_SUB] = &&do_SUB,
+        [OP_LUI] = &&do_LUI,     [OP_XOR] = &&do_XOR,     [OP_XORI] = &&do_XORI,
+        [OP_OR] = &&do_OR,       [OP_ORI] = &&do_ORI,     [OP_AND] = &&do_AND,
+        [OP_ANDI] = &&do_ANDI,   [OP_SLL] = &&do_SLL,     [OP_SRL] = &&do_SRL,
+        [OP_SRA] = &&do_SRA,     [OP_LB] = &&do_LB,       [OP_LH] = &&do_LH,
+        [OP_LW] = &&do_LW,       [OP_LBU] = &&do_LBU,     [OP_LHU] = &&do_LHU,
+        [OP_SB] = &&do_SB,       [OP_SH] = &&do_SH,       [OP_SW] = &&do_SW,
+        [OP_SLT] = &&do_SLT,     [OP_SLTI] = &&do_SLTI,   [OP_SLTU] = &&do_SLTU,
+        [OP_SLTIU] = &&do_SLTIU, [OP_BEQ] = &&do_BEQ,     [OP_BNE] = &&do_BNE,
+        [OP_BLT] = &&do_BLT,     [OP_BLTU] = &&do_BLTU,   [OP_BGE] = &&do_BGE,
+        [OP_BGEU] = &&do_BGEU,   [OP_JAL] = &&do_JAL,     [OP_JALR] = &&do_JALR,
+        [OP_IDIOM] = &&do_IDIOM, [OP_INVALID] = &&do_INVALID, [OP_BLOCK_END] = &&do_BLOCK_END
+    };
+#define HANDLER(op) do_##op:
+#define DISPATCH() goto *handlers[inst->op]
+#else
+#define HANDLER(op) case OP_##op:
+#define DISPATCH() continue
+#endif
+
+// PC of the instruction being run, only needed by the slow paths
+#define CUR_PC() ((block->start_pc + (uint32_t) (inst - block->code) * 4) & 0xffff)
+#define NEXT() { inst++; DISPATCH(); }
+// chain into a successor, resolving the pointer the first time the edge is taken
+#define CHAIN(edge, pc) { \
+        if(block->edge == NULL) { \
+            block->edge = block_lookup(vm, (pc)); \
+            if(block->edge == NULL) { \
+                vm->PC = (pc); \
+                return; \
+            } \
+        } \
+        ENTER(block->edge); \
+    }
+#define ENTER(next) { \
+        block = (next); \
+        LIMIT_TICK(vm, block->start_pc); \
+        if(block->exec_count >= hot_threshold && !block->no_jit) { \
+            vm->PC = block->start_pc; \
+            return; \
+        } \
+        block->exec_count++; \
+        vm->cur_block = block; \
+        inst = block->code; \
+        DISPATCH(); \
+    }
+// a store may have rewritten instruction memory, leave the stale block if so
+#define STORE(num_bytes) { \
+        vm->PC = CUR_PC(); \
+        store_raw(vm, inst, num_bytes); \
+        if(vm->code_gen != vm->blocks.code_gen) { \
+            uncount_rest(vm, vm->PC + 4); \
+            block = block_lookup(vm, vm->PC + 4); \
+            if(block == NULL) { \
+                vm->PC += 4; \
+                return; \
+            } \
+            ENTER(block); \
+        } \
+        NEXT(); \
+    }
+
+    block = block_lookup(vm, vm->PC);
+    if(block == NULL) {
+        return;
+    }
+    block->exec_count++;
+    vm->cur_block = block;
+    inst = block->code;
+
+#ifdef THREADED
+    DISPATCH();
+#else
+    for(;;) {
+        switch(inst->op) {
+#endif
+
+    // arithmetic and logic operations
+    HANDLER(ADD)
+        reg[inst->rd] = reg[inst->rs1] + reg[inst->rs2];
+        NEXT();
+    HANDLER(ADDI)
+        reg[inst->rd] = reg[inst->rs1] + inst->imm;
+        NEXT();
+    HANDLER(SUB)
+        reg[inst->rd] = reg[inst->rs1] - reg[inst->rs2];
+        NEXT();
+    HANDLER(LUI)
+        reg[inst->rd] = inst->imm;
+        NEXT();
+    HANDLER(XOR)
+        reg[inst->rd] = reg[inst->rs1] ^ reg[inst->rs2];
+        NEXT();
+    HANDLER(XORI)
+        reg[inst->rd] = reg[inst->rs1] ^ inst->imm;
+        NEXT();
+    HANDLER(OR)
+        reg[inst->rd] = reg[inst->rs1] | reg[inst->rs2];
+        NEXT();
+    HANDLER(ORI)
+        reg[inst->rd] = reg[inst->rs1] | inst->imm;
+        NEXT();
+    HANDLER(AND)
+        reg[inst->rd] = reg[inst->rs1] & reg[inst->rs2];
+        NEXT();
+    HANDLER(ANDI)
+        reg[inst->rd] = reg[inst->rs1] & inst->imm;
+        NEXT();
+    HANDLER(SLL)
+        reg[inst->rd] = reg[inst->rs1] << (reg[inst->rs2] & 0x1f);
+        NEXT();
+    HANDLER(SRL)
+        reg[inst->rd] = reg[inst->rs1] >> (reg[inst->rs2] & 0x1f);
+        NEXT();
+    HANDLER(SRA)
+        reg[inst->rd] = (int32_t) reg[inst->rs1] >> (reg[inst->rs2] & 0x1f);
+        NEXT();
+
+    // memory access operations
+    HANDLER(LB)
+        reg[inst->rd] = sext(load_raw_at(vm, inst, 1, CUR_PC()) & 0xff, 8);
+        NEXT();
+    HANDLER(LH)
+        reg[inst->rd] = sext(load_raw_at(vm, inst, 2, CUR_PC()) & 0xffff, 16);
+        NEXT();
+    HANDLER(LW)
+        reg[inst->rd] = load_raw_at(vm, inst, 4, CUR_PC());
+        NEXT();
+    HANDLER(LBU)
+        reg[inst->rd] = load_raw_at(vm, inst, 1, CUR_PC()) & 0xff;
+        NEXT();
+    HANDLER(LHU)
+        reg[inst->rd] = load_raw_at(vm, inst, 2, CUR_PC()) & 0xffff;
+        NEXT();
+    HANDLER(SB)
+        STORE(1);
+    HANDLER(SH)
+        STORE(2);
+    HANDLER(SW)
+        STORE(4);
+
+    // program flow operations
+    HANDLER(SLT)
+        reg[inst->rd] = (int32_t) reg[inst->rs1] < (int32_t) reg[inst->rs2];
+        NEXT();
+    HANDLER(SLTI)
+        reg[inst->rd] = (int32_t) reg[inst->rs1] < inst->imm;
+        NEXT();
+    HANDLER(SLTU)
+        reg[inst->rd] = reg[inst->rs1] < reg[inst->rs2];
+        NEXT();
+    HANDLER(SLTIU)
+        reg[inst->rd] = reg[inst->rs1] < (uint32_t) inst->imm;
+        NEXT();
+    HANDLER(BEQ)
+        if(reg[inst->rs1] == reg[inst->rs2]) {
+            CHAIN(taken, block->taken_pc);
+        }
+        CHAIN(fallthrough, block->fall_pc);
+    HANDLER(BNE)
+        if(reg[inst->rs1] != reg[inst->rs2]) {
+            CHAIN(taken, block->taken_pc);
+        }
+        CHAIN(fallthrough, block->fall_pc);
+    HANDLER(BLT)
+        if((int32_t) reg[inst->rs1] < (int32_t) reg[inst->rs2]) {
+            CHAIN(taken, block->taken_pc);
+        }
+        CHAIN(fallthrough, block->fall_pc);
+    HANDLER(BLTU)
+        if(reg[inst->rs1] < reg[inst->rs2]) {
+            CHAIN(taken, block->taken_pc);
+        }
+        CHAIN(fallthrough, block->fall_pc);
+    HANDLER(BGE)
+        if((int32_t) reg[inst->rs1] >= (int32_t) reg[inst->rs2]) {
+            CHAIN(taken, block->taken_pc);
+        }
+        CHAIN(fallthrough, block->fall_pc);
+    HANDLER(BGEU)
+        if(reg[inst->rs1] >= reg[inst->rs2]) {
+            CHAIN(taken, block->taken_pc);
+        }
+        CHAIN(fallthrough, block->fall_pc);
+    HANDLER(JAL)
+        SAMPLE_HOOK_JUMP(vm, inst, block->taken_pc);
+        reg[inst->rd] = CUR_PC() + 4;
+        CHAIN(taken, block->taken_pc);
+    HANDLER(JALR)
+        // the taken edge caches the last target, returns usually go back to the same site
+        target = ((reg[inst->rs1] + inst->imm) & ~1u) & 0xffff;
+        SAMPLE_HOOK_JUMP(vm, inst, target);
+        reg[inst->rd] = CUR_PC() + 4;
+        if(block->taken == NULL || block->taken_pc != target) {
+            block->taken_pc = target;
+            block->taken = NULL;
+        }
+        CHAIN(taken, target);
+
+    // head of a copy/fill/strlen loop (idiom.h): run it whole and leave the block at its end
+    HANDLER(IDIOM) {
+        uint32_t pc = CUR_PC();
+        uint64_t ran = idiom_run(vm, pc);
+        if(ran != 0) {
+            uncount_rest(vm, pc);
+            vm->insn_count += ran;
+            block = block_lookup(vm, vm->PC);
+            if(block == NULL) {
+                return;
+            }
+            ENTER(block);
+        }
+        if(idiom_head_is_store(&vm->idioms[pc / 4])) {
+            STORE(vm->idioms[pc / 4].size);
+        }
+        reg[inst->rd] = idiom_head_load(vm, inst, &vm->idioms[pc / 4], pc);
+        NEXT();
+    }
+    HANDLER(INVALID)
+        vm->PC = CUR_PC();
+        inst_not_implemented(vm);
+    HANDLER(BLOCK_END)
+        // block stopped before the next leader, carry on sequentially
+        CHAIN(fallthrough, block->fall_pc);
+
+#ifndef THREADED
+        }
+    }
+#endif
+}
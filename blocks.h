@@ -0,0 +1,22 @@
+#ifndef BLOCKS_H_
+#define BLOCKS_H_
+#include <stdio.h>
+#include "structs_enums.h"
+
+// internal op closing every block's copied code, never produced by the decoder
+#define OP_BLOCK_END OP_NUM
+
+int is_block_end(uint8_t op);
+
+void blocks_init(struct VM *vm);
+
+struct BLOCK *block_lookup(struct VM *vm, uint32_t pc);
+
+// instructions run by blocks that vm->insn_count does not include yet
+uint64_t blocks_insn_count(struct VM *vm);
+
+void dump_block_counts(struct VM *vm, FILE *out);
+
+void run_blocks(struct VM *vm, uint64_t hot_threshold);
+
+#endif
@@ -0,0 +1,227 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+#include "serve.h"
+
+// CLIENT FOR vm_riskxvii --serve
+// usage: vm_riskxvii_client <socket> [--inline] [--engine=NAME] [--input=file]
+//                           [--bench=N] [--stats] [--hangup] <image>
+// runs the image on the daemon, guest input comes from --input or stdin;
+// --bench sends the same request N times and prints per-request latency instead of the output;
+// --hangup closes the connection as soon as the request is sent, as a client that gives up would
+
+struct CLIENT_OPTIONS {
+    char *socket;
+    char *image;
+    char *input;
+    int inline_image;
+    int engine;
+    long bench;
+    int stats;
+    int hangup;
+};
+
+// whole file (or stream) into a malloc'd buffer, exits when it does not fit in memory
+static uint8_t *slurp(FILE *file, size_t *len) {
+    size_t cap = 4096;
+    uint8_t *buf = malloc(cap);
+    *len = 0;
+    size_t got;
+    while(buf != NULL && (got = fread(buf + *len, 1, cap - *len, file)) > 0) {
+        *len += got;
+        if(*len == cap) {
+            uint8_t *grown = realloc(buf, cap * 2);
+            if(grown == NULL) {
+                free(buf);
+            }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    if(buf == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    return buf;
+}
+
+static int parse_client_args(int argc, char *argv[], struct CLIENT_OPTIONS *opts) {
+    memset(opts, 0, sizeof(*opts));
+    opts->engine = ENGINE_BLOCKS;
+    for(int i = 1 ; i < argc ; i++) {
+        if(strcmp(argv[i], "--inline") == 0) {
+            opts->inline_image = 1;
+        }
+        else if(strcmp(argv[i], "--stats") == 0) {
+            opts->stats = 1;
+        }
+        else if(strcmp(argv[i], "--hangup") == 0) {
+            opts->hangup = 1;
+        }
+        else if(strncmp(argv[i], "--input=", 8) == 0) {
+            opts->input = argv[i] + 8;
+        }
+        else if(strncmp(argv[i], "--bench=", 8) == 0) {
+            opts->bench = atol(argv[i] + 8);
+        }
+        else if(strncmp(argv[i], "--engine=", 9) == 0) {
+            char *name = argv[i] + 9;
+            int engine = vm_engine_by_name(name);
+            if(engine < 0) {
+                printf("Unknown engine: %s\n", name);
+                return 1;
+            }
+            opts->engine = engine;
+        }
+        else if(opts->socket == NULL && strncmp(argv[i], "--", 2) != 0) {
+            opts->socket = argv[i];
+        }
+        else if(opts->image == NULL && strncmp(argv[i], "--", 2) != 0) {
+            opts->image = argv[i];
+        }
+        else {
+            printf("Wrong number of arguments\n");
+            return 1;
+        }
+    }
+    if(opts->socket == NULL || opts->image == NULL || opts->bench < 0 || (opts->hangup && opts->bench != 0)) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    return 0;
+}
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]) {
+    struct CLIENT_OPTIONS opts;
+    if(parse_client_args(argc, argv, &opts) != 0) {
+        exit(1);
+    }
+
+    // request body: the image path or the image, then the input
+    uint8_t *image = (uint8_t *) opts.image;
+    size_t image_len = strlen(opts.image);
+    if(opts.inline_image) {
+        FILE *file = fopen(opts.image, "rb");
+        if(file == NULL) {
+            printf("File does not exist\n");
+            exit(1);
+        }
+        image = slurp(file, &image_len);
+        fclose(file);
+        if(image_len != IMAGE_SIZE) {
+            printf("Invalid image size: %zu bytes\n", image_len);
+            exit(1);
+        }
+    }
+    uint8_t *input = NULL;
+    size_t input_len = 0;
+    if(opts.input != NULL || opts.bench == 0) {
+        FILE *file = opts.input != NULL ? fopen(opts.input, "rb") : stdin;
+        if(file == NULL) {
+            printf("File does not exist\n");
+            exit(1);
+        }
+        input = slurp(file, &input_len);
+        if(file != stdin) {
+            fclose(file);
+        }
+    }
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, opts.socket, sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(fd < 0 || connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        printf("Cannot connect to %s\n", opts.socket);
+        exit(1);
+    }
+
+    struct SERVE_REQUEST req;
+    req.magic = SERVE_REQUEST_MAGIC;
+    req.flags = opts.inline_image ? SERVE_INLINE_IMAGE : 0;
+    req.engine = opts.engine;
+    req.image_len = image_len;
+    req.input_len = input_len;
+
+    long num_requests = opts.bench > 0 ? opts.bench : 1;
+    double *latency = malloc(num_requests * sizeof(double));
+    struct SERVE_REPLY reply;
+    uint8_t *output = NULL;
+    double start = now_us();
+    for(long i = 0 ; i < num_requests ; i++) {
+        double sent = now_us();
+        if(write_full(fd, &req, sizeof(req)) != 0 || write_full(fd, image, image_len) != 0
+            || write_full(fd, input, input_len) != 0) {
+            printf("Connection lost\n");
+            exit(1);
+        }
+        if(opts.hangup) {
+            close(fd);
+            free(latency);
+            free(input);
+            if(opts.inline_image) {
+                free(image);
+            }
+            return 0;
+        }
+        if(read_full(fd, &reply, sizeof(reply)) != 0 || reply.magic != SERVE_REPLY_MAGIC) {
+            printf("Connection lost\n");
+            exit(1);
+        }
+        uint8_t *grown = realloc(output, reply.output_len + 1);
+        if(grown == NULL) {
+            printf("Out of memory\n");
+            exit(1);
+        }
+        output = grown;
+        if(read_full(fd, output, reply.output_len) != 0) {
+            printf("Connection lost\n");
+            exit(1);
+        }
+        latency[i] = now_us() - sent;
+    }
+    double elapsed = now_us() - start;
+    close(fd);
+
+    if(opts.bench > 0) {
+        qsort(latency, num_requests, sizeof(double), compare_double);
+        printf("requests: %ld\n", num_requests);
+        printf("latency p50: %.1f us\n", latency[num_requests / 2]);
+        printf("latency p99: %.1f us\n", latency[(num_requests * 99) / 100]);
+        printf("latency max: %.1f us\n", latency[num_requests - 1]);
+        printf("throughput: %.1f requests/s\n", num_requests / (elapsed / 1e6));
+    }
+    else {
+        fwrite(output, 1, reply.output_len, stdout);
+    }
+    if(opts.stats) {
+        fprintf(stderr, "status: %s\n", vm_status_name(reply.status));
+        fprintf(stderr, "instructions: %llu\n", (unsigned long long) reply.insn_count);
+    }
+    free(output);
+    free(latency);
+    free(input);
+    if(opts.inline_image) {
+        free(image);
+    }
+    return reply.status == VM_OK || reply.status == VM_HALT ? 0 : 1;
+}
@@ -0,0 +1,248 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "structs_enums.h"
+#include "parse.h"
+#include "store_load_helper.h"
+#include "decode.h"
+#include "idiom.h"
+
+char *op_names[OP_NUM] = {
+    [OP_ADD] = "add",   [OP_ADDI] = "addi", [OP_SUB] = "sub",   [OP_LUI] = "lui",
+    [OP_XOR] = "xor",   [OP_XORI] = "xori", [OP_OR] = "or",     [OP_ORI] = "ori",
+    [OP_AND] = "and",   [OP_ANDI] = "andi", [OP_SLL] = "sll",   [OP_SRL] = "srl",
+    [OP_SRA] = "sra",   [OP_LB] = "lb",     [OP_LH] = "lh",     [OP_LW] = "lw",
+    [OP_LBU] = "lbu",   [OP_LHU] = "lhu",   [OP_SB] = "sb",     [OP_SH] = "sh",
+    [OP_SW] = "sw",     [OP_SLT] = "slt",   [OP_SLTI] = "slti", [OP_SLTU] = "sltu",
+    [OP_SLTIU] = "sltiu", [OP_BEQ] = "beq", [OP_BNE] = "bne",   [OP_BLT] = "blt",
+    [OP_BLTU] = "bltu", [OP_BGE] = "bge",   [OP_BGEU] = "bgeu", [OP_JAL] = "jal",
+    [OP_JALR] = "jalr", [OP_IDIOM] = "idiom", [OP_INVALID] = "invalid"
+};
+
+// DECODE FUNCTIONS (decode.h)
+// decode one instruction line into its operation and operands
+void decode_line(uint32_t line, struct DECODED *out) {
+    uint8_t func3 = extract_func3(line);
+    uint8_t func7 = extract_func7(line);
+    uint32_t imm;
+
+    out->op = OP_INVALID;
+    out->rd = extract_rd(line);
+    out->rs1 = extract_rs1(line);
+    out->rs2 = extract_rs2(line);
+    out->imm = 0;
+
+    switch(inst_type(extract_opcode(line))) {
+        case TYPE_R:
+            switch(func3) {
+                case ADD_FUNC3:
+                    if(func7 == ADD_FUNC7) {
+                        out->op = OP_ADD;
+                    }
+                    else if(func7 == SUB_FUNC7) {
+                        out->op = OP_SUB;
+                    }
+                    break;
+                case XOR_FUNC3:
+                    out->op = OP_XOR;
+                    break;
+                case OR_FUNC3:
+                    out->op = OP_OR;
+                    break;
+                case AND_FUNC3:
+                    out->op = OP_AND;
+                    break;
+                case SLL_FUNC3:
+                    out->op = OP_SLL;
+                    break;
+                case SRL_FUNC3:
+                    if(func7 == SRL_FUNC7) {
+                        out->op = OP_SRL;
+                    }
+                    else if(func7 == SRA_FUNC7) {
+                        out->op = OP_SRA;
+                    }
+                    break;
+                case SLT_FUNC3:
+                    out->op = OP_SLT;
+                    break;
+                case SLTU_FUNC3:
+                    out->op = OP_SLTU;
+                    break;
+            }
+            break;
+        case TYPE_I_JMP:
+            out->imm = sext(extract_bits(line, 31, 20), 12);
+            if(func3 == JALR_FUNC3) {
+                out->op = OP_JALR;
+            }
+            break;
+        case TYPE_I_LOAD:
+            out->imm = sext(extract_bits(line, 31, 20), 12);
+            switch(func3) {
+                case LB_FUNC3:
+                    out->op = OP_LB;
+                    break;
+                case LH_FUNC3:
+                    out->op = OP_LH;
+                    break;
+                case LW_FUNC3:
+                    out->op = OP_LW;
+                    break;
+                case LBU_FUNC3:
+                    out->op = OP_LBU;
+                    break;
+                case LHU_FUNC3:
+                    out->op = OP_LHU;
+                    break;
+            }
+            break;
+        case TYPE_I:
+            out->imm = sext(extract_bits(line, 31, 20), 12);
+            switch(func3) {
+                case ADDI_FUNC3:
+                    out->op = OP_ADDI;
+                    break;
+                case XORI_FUNC3:
+                    out->op = OP_XORI;
+                    break;
+                case ORI_FUNC3:
+                    out->op = OP_ORI;
+                    break;
+                case ANDI_FUNC3:
+                    out->op = OP_ANDI;
+                    break;
+                case SLTI_FUNC3:
+                    out->op = OP_SLTI;
+                    break;
+                case SLTIU_FUNC3:
+                    // sltiu compares against the raw 12 bit immediate
+                    out->op = OP_SLTIU;
+                    out->imm = extract_bits(line, 31, 20);
+                    break;
+            }
+            break;
+        case TYPE_S:
+            imm = extract_bits(line, 11, 7) | (extract_bits(line, 31, 25) << 5);
+            out->imm = sext(imm, 12);
+            switch(func3) {
+                case SB_FUNC3:
+                    out->op = OP_SB;
+                    break;
+                case SH_FUNC3:
+                    out->op = OP_SH;
+                    break;
+                case SW_FUNC3:
+                    out->op = OP_SW;
+                    break;
+            }
+            break;
+        case TYPE_SB:
+            // bit 7 offset by 11, bits 8-11 offset by 1, bits 25-30 offset by 5, bit 31 offset by 12
+            imm = (extract_bits(line, 7, 7) << 11) | (extract_bits(line, 11, 8) << 1);
+            imm = imm | (extract_bits(line, 30, 25) << 5) | (extract_bits(line, 31, 31) << 12);
+            out->imm = sext(imm, 13);
+            switch(func3) {
+                case BEQ_FUNC3:
+                    out->op = OP_BEQ;
+                    break;
+                case BNE_FUNC3:
+                    out->op = OP_BNE;
+                    break;
+                case BLT_FUNC3:
+                    out->op = OP_BLT;
+                    break;
+                case BLTU_FUNC3:
+                    out->op = OP_BLTU;
+                    break;
+                case BGE_FUNC3:
+                    out->op = OP_BGE;
+                    break;
+                case BGEU_FUNC3:
+                    out->op = OP_BGEU;
+                    break;
+            }
+            break;
+        case TYPE_U:
+            out->imm = extract_bits(line, 31, 12) << 12;
+            out->op = OP_LUI;
+            break;
+        case TYPE_UJ:
+            //extract bit 12:19, bit 11, bits 21:30 and bit 20
+            imm = (extract_bits(line, 19, 12) << 12) | (extract_bits(line, 20, 20) << 11);
+            imm = imm | (extract_bits(line, 30, 21) << 1) | (extract_bits(line, 31, 31) << 20);
+            out->imm = sext(imm, 21);
+            out->op = OP_JAL;
+            break;
+        case TYPE_INVALID:
+            break;
+    }
+
+    // writes to x0 go to the sink register so no engine has to re-zero x0
+    if(out->rd == 0) {
+        out->rd = REG_SINK;
+    }
+}
+
+// little endian instruction word index of inst_mem
+uint32_t inst_line(struct VM *vm, uint32_t index) {
+    uint8_t *bytes = &vm->inst_mem[index*4];
+    return bytes[0] | (bytes[1] << 8) | (bytes[2] << 16) | ((uint32_t) bytes[3] << 24);
+}
+
+// decode every instruction line once, after the image has been loaded
+void decode_all(struct VM *vm) {
+    for(int i = 0 ; i < INST_MEM_SIZE/4 ; i++) {
+        decode_line(inst_line(vm, i), &vm->decoded[i]);
+    }
+    idioms_scan(vm);
+    vm->code_gen++;
+}
+
+// guest stored into instruction memory: re-decode the touched lines,
+// code_gen tells the block engine its copies are stale
+void refresh_decoded(struct VM *vm, uint32_t addr, int num_bytes) {
+    uint32_t first = addr / 4;
+    uint32_t last = (addr + num_bytes - 1) / 4;
+    for(uint32_t i = first ; i <= last && i < INST_MEM_SIZE/4 ; i++) {
+        decode_line(inst_line(vm, i), &vm->decoded[i]);
+    }
+    idioms_refresh(vm, first, last);
+    vm->code_gen++;
+}
+
+static int reg_num(uint8_t reg) {
+    return reg == REG_SINK ? 0 : reg;
+}
+
+// one line of assembly from the decoded form, branch and jal targets as absolute addresses
+void disassemble(const struct DECODED *inst, uint32_t pc, char *buf, size_t size) {
+    const char *name = op_names[inst->op];
+    int rd = reg_num(inst->rd);
+    switch(inst->op) {
+        case OP_ADDI: case OP_XORI: case OP_ORI: case OP_ANDI: case OP_SLTI: case OP_SLTIU:
+            snprintf(buf, size, "%s x%d, x%d, %d", name, rd, inst->rs1, inst->imm);
+            break;
+        case OP_LUI:
+            snprintf(buf, size, "%s x%d, 0x%x", name, rd, (uint32_t) inst->imm >> 12);
+            break;
+        case OP_LB: case OP_LH: case OP_LW: case OP_LBU: case OP_LHU: case OP_JALR:
+            snprintf(buf, size, "%s x%d, %d(x%d)", name, rd, inst->imm, inst->rs1);
+            break;
+        case OP_SB: case OP_SH: case OP_SW:
+            snprintf(buf, size, "%s x%d, %d(x%d)", name, inst->rs2, inst->imm, inst->rs1);
+            break;
+        case OP_BEQ: case OP_BNE: case OP_BLT: case OP_BLTU: case OP_BGE: case OP_BGEU:
+            snprintf(buf, size, "%s x%d, x%d, 0x%04x", name, inst->rs1, inst->rs2, (pc + inst->imm) & 0xffff);
+            break;
+        case OP_JAL:
+            snprintf(buf, size, "%s x%d, 0x%04x", name, rd, (pc + inst->imm) & 0xffff);
+            break;
+        case OP_INVALID:
+            snprintf(buf, size, "%s", name);
+            break;
+        default:
+            snprintf(buf, size, "%s x%d, x%d, x%d", name, rd, inst->rs1, inst->rs2);
+            break;
+    }
+}
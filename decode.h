@@ -0,0 +1,19 @@
+#ifndef DECODE_H_
+#define DECODE_H_
+#include <stddef.h>
+#include <stdint.h>
+#include "structs_enums.h"
+
+extern char *op_names[OP_NUM];
+
+uint32_t inst_line(struct VM *vm, uint32_t index);
+
+void decode_line(uint32_t line, struct DECODED *out);
+
+void decode_all(struct VM *vm);
+
+void refresh_decoded(struct VM *vm, uint32_t addr, int num_bytes);
+
+void disassemble(const struct DECODED *inst, uint32_t pc, char *buf, size_t size);
+
+#endif
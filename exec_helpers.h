@@ -0,0 +1,48 @@
+#ifndef EXEC_HELPERS_H_
+#define EXEC_HELPERS_H_
+#include <stdint.h>
+#include "structs_enums.h"
+#include "store_load_helper.h"
+#include "memory.h"
+
+// LOAD AND STORE HANDLER HELPERS, shared by every execution engine
+// raw little endian value for a load, virtual routines run through the mmio table
+static inline uint32_t load_raw(struct VM *vm, struct DECODED *inst, int num_bytes) {
+    return mem_load(vm, vm->registers[inst->rs1] + inst->imm, num_bytes);
+}
+
+static inline uint32_t load_raw_at(struct VM *vm, struct DECODED *inst, int num_bytes, uint32_t pc) {
+    return mem_load_at(vm, vm->registers[inst->rs1] + inst->imm, num_bytes, pc);
+}
+
+// store R[rs2]
+static inline void store_raw(struct VM *vm, struct DECODED *inst, int num_bytes) {
+    mem_store(vm, vm->registers[inst->rs1] + inst->imm, vm->registers[inst->rs2], num_bytes);
+}
+
+// LIMITS
+// jumps and block entries between checks of the deadline
+#define LIMIT_POLL_TICKS (1u << 14)
+
+// countdown ran out: end the run if its budget or deadline is spent, otherwise rearm it
+void limit_check(struct VM *vm);
+
+// at a taken jump or block entry, before anything at pc has run or been counted
+#define LIMIT_TICK(vm, pc) { \
+        if(--(vm)->limit_countdown == 0) { \
+            (vm)->PC = (pc); \
+            (vm)->cur_block = NULL; \
+            limit_check(vm); \
+        } \
+    }
+
+// INSTRUCTION COUNT
+// a block entry counts the block's whole length, take back what did not run when it is left at next_pc
+static inline void uncount_rest(struct VM *vm, uint32_t next_pc) {
+    struct BLOCK *block = vm->cur_block;
+    if(block != NULL) {
+        vm->insn_count -= (block->start_pc + block->len*4 - next_pc) / 4;
+    }
+}
+
+#endif
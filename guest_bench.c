@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// GUEST BENCHMARK (make bench)
+// usage: guest_bench [--vm=path] [--runs=N] [--baseline=file.csv] <image>...
+// runs every image on every engine N times through vm_riskxvii --stats and prints one CSV row
+// per image and engine on stdout; with a baseline in the same format each row is also compared
+// on stderr, a MIPS drop (startup slowdown for tiny images) of more than REGRESSION_PCT percent is marked
+
+#define REGRESSION_PCT 10.0
+#define STARTUP_INSNS 1000
+#define MAX_ROWS 256
+
+static const char *engines[] = { "threaded", "blocks", "jit", "checked", "traced", "profiled" };
+
+struct BENCH_ROW {
+    char image[64];
+    char engine[16];
+    unsigned long long insns;
+    double run_us;      // best vm_run time
+    double wall_us;     // best time from fork to exit
+    double startup_us;  // wall - run of the best run: exec, load and teardown
+    long peak_rss_kb;   // worst of the runs
+};
+
+static double now_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// one run, guest output to /dev/null and --stats read back from stderr, 0 on success
+static int run_once(const char *vm, const char *engine, const char *image, struct BENCH_ROW *row) {
+    char engine_arg[32];
+    snprintf(engine_arg, sizeof(engine_arg), "--engine=%s", engine);
+    int fds[2];
+    if(pipe(fds) != 0) {
+        return 1;
+    }
+    double start = now_us();
+    pid_t pid = fork();
+    if(pid == 0) {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, 1);
+        dup2(fds[1], 2);
+        close(fds[0]);
+        execl(vm, vm, "--stats", engine_arg, image, (char *) NULL);
+        _exit(127);
+    }
+    close(fds[1]);
+    char stats[4096];
+    size_t len = 0;
+    ssize_t got;
+    while(pid > 0 && (got = read(fds[0], stats + len, sizeof(stats) - 1 - len)) > 0) {
+        len += got;
+    }
+    stats[len] = '\0';
+    close(fds[0]);
+    int wstatus = 0;
+    struct rusage usage;
+    if(pid < 0 || wait4(pid, &wstatus, 0, &usage) != pid) {
+        return 1;
+    }
+    double wall = now_us() - start;
+
+    char *insns = strstr(stats, "instructions: ");
+    char *run = strstr(stats, "run time: ");
+    if(!WIFEXITED(wstatus) || WEXITSTATUS(wstatus) != 0 || insns == NULL || run == NULL) {
+        return 1;
+    }
+    double run_us = atof(run + 10);
+    row->insns = strtoull(insns + 14, NULL, 10);
+    if(row->run_us == 0 || run_us < row->run_us) {
+        row->run_us = run_us;
+    }
+    if(row->wall_us == 0 || wall < row->wall_us) {
+        row->wall_us = wall;
+        row->startup_us = wall - run_us;
+    }
+    if(usage.ru_maxrss > row->peak_rss_kb) {
+        row->peak_rss_kb = usage.ru_maxrss;
+    }
+    return 0;
+}
+
+static double mips(struct BENCH_ROW *row) {
+    return row->run_us > 0 ? row->insns / row->run_us : 0;
+}
+
+static void print_header(FILE *out) {
+    fprintf(out, "image,engine,insns,run_us,mips,ns_per_insn,wall_us,startup_us,peak_rss_kb\n");
+}
+
+static void print_row(FILE *out, struct BENCH_ROW *row) {
+    fprintf(out, "%s,%s,%llu,%.1f,%.2f,%.3f,%.1f,%.1f,%ld\n", row->image, row->engine, row->insns,
+        row->run_us, mips(row), row->insns > 0 ? row->run_us * 1e3 / row->insns : 0,
+        row->wall_us, row->startup_us, row->peak_rss_kb);
+}
+
+// rows of an earlier run, returns how many were read
+static int read_baseline(const char *path, struct BENCH_ROW *rows) {
+    FILE *file = fopen(path, "r");
+    if(file == NULL) {
+        return 0;
+    }
+    char line[512];
+    int count = 0;
+    while(count < MAX_ROWS && fgets(line, sizeof(line), file) != NULL) {
+        struct BENCH_ROW *row = &rows[count];
+        double mips_unused, ns_unused;
+        if(sscanf(line, "%63[^,],%15[^,],%llu,%lf,%lf,%lf,%lf,%lf,%ld", row->image, row->engine,
+                &row->insns, &row->run_us, &mips_unused, &ns_unused, &row->wall_us,
+                &row->startup_us, &row->peak_rss_kb) == 9) {
+            count++;
+        }
+    }
+    fclose(file);
+    return count;
+}
+
+static void compare(struct BENCH_ROW *row, struct BENCH_ROW *base, int num_base) {
+    for(int i = 0 ; i < num_base ; i++) {
+        if(strcmp(base[i].image, row->image) != 0 || strcmp(base[i].engine, row->engine) != 0) {
+            continue;
+        }
+        // images that barely run anything (startup) are judged on startup time instead
+        double change;
+        if(row->insns < STARTUP_INSNS) {
+            change = base[i].startup_us > 0 ? (base[i].startup_us / row->startup_us - 1) * 100 : 0;
+        }
+        else {
+            change = mips(&base[i]) > 0 ? (mips(row) / mips(&base[i]) - 1) * 100 : 0;
+        }
+        fprintf(stderr, "%-10s %-8s %9.2f MIPS vs %9.2f, startup %7.1f us vs %7.1f, rss %6ld kB vs %6ld: %+6.1f%%%s\n",
+            row->image, row->engine, mips(row), mips(&base[i]), row->startup_us, base[i].startup_us,
+            row->peak_rss_kb, base[i].peak_rss_kb, change, change < -REGRESSION_PCT ? "  REGRESSION" : "");
+        return;
+    }
+    fprintf(stderr, "%-10s %-8s not in the baseline\n", row->image, row->engine);
+}
+
+int main(int argc, char *argv[]) {
+    const char *vm = "./vm_riskxvii";
+    const char *baseline = NULL;
+    int runs = 5;
+    int first = 1;
+    for( ; first < argc && strncmp(argv[first], "--", 2) == 0 ; first++) {
+        if(strncmp(argv[first], "--vm=", 5) == 0) {
+            vm = argv[first] + 5;
+        }
+        else if(strncmp(argv[first], "--runs=", 7) == 0) {
+            runs = atoi(argv[first] + 7);
+        }
+        else if(strncmp(argv[first], "--baseline=", 11) == 0) {
+            baseline = argv[first] + 11;
+        }
+        else {
+            break;
+        }
+    }
+    if(first == argc || runs <= 0) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+
+    static struct BENCH_ROW base[MAX_ROWS];
+    int num_base = baseline != NULL ? read_baseline(baseline, base) : 0;
+    if(baseline != NULL && num_base == 0) {
+        fprintf(stderr, "no baseline rows in %s\n", baseline);
+    }
+
+    int failed = 0;
+    print_header(stdout);
+    for(int i = first ; i < argc ; i++) {
+        for(size_t e = 0 ; e < sizeof(engines) / sizeof(engines[0]) ; e++) {
+            struct BENCH_ROW row = {0};
+            // image name without directory or extension
+            const char *name = strrchr(argv[i], '/') != NULL ? strrchr(argv[i], '/') + 1 : argv[i];
+            snprintf(row.image, sizeof(row.image), "%.*s", (int) strcspn(name, "."), name);
+            snprintf(row.engine, sizeof(row.engine), "%s", engines[e]);
+            int ok = 1;
+            for(int r = 0 ; r < runs && ok ; r++) {
+                ok = run_once(vm, engines[e], argv[i], &row) == 0;
+            }
+            if(!ok) {
+                fprintf(stderr, "%s %s: run failed\n", argv[i], engines[e]);
+                failed = 1;
+                continue;
+            }
+            print_row(stdout, &row);
+            fflush(stdout);
+            if(num_base > 0) {
+                compare(&row, base, num_base);
+            }
+        }
+    }
+    return failed;
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "structs_enums.h"
+#include "vir_routine.h"
+#include "heap.h"
+#include "largemem.h"
+
+// LARGEST FREE RUN (heap.h)
+int largest_free_run(const uint64_t *used, int total) {
+    int largest = 0;
+    int bank = 0;
+    while(bank < total) {
+        int free_start = next_bank(used, total, bank, 0);
+        int free_end = next_bank(used, total, free_start, 1);
+        if(free_end - free_start > largest) {
+            largest = free_end - free_start;
+        }
+        bank = free_end;
+    }
+    return largest;
+}
+
+// HEAP BANK ALLOCATOR (heap.h)
+void heap_init(struct VM *vm) {
+    memset(&vm->heap_alloc, 0, sizeof(vm->heap_alloc));
+}
+
+int heap_alloc_banks(struct VM *vm, uint32_t num_banks) {
+    struct HEAP_ALLOC *alloc = &vm->heap_alloc;
+    int bank = first_fit(alloc->used, HEAP_BANK_NUM, num_banks);
+    if(bank < 0) {
+        return -1;
+    }
+    mark_banks(alloc->used, bank, num_banks, 1);
+    alloc->run_len[bank] = num_banks;
+    alloc->stats.banks_used += num_banks;
+    if(alloc->stats.banks_used > alloc->stats.peak_banks_used) {
+        alloc->stats.peak_banks_used = alloc->stats.banks_used;
+    }
+    return bank;
+}
+
+int heap_free_banks(struct VM *vm, uint32_t bank) {
+    struct HEAP_ALLOC *alloc = &vm->heap_alloc;
+    if(bank >= HEAP_BANK_NUM || alloc->run_len[bank] == 0) {
+        return 0;
+    }
+    int num_banks = alloc->run_len[bank];
+    mark_banks(alloc->used, bank, num_banks, 0);
+    alloc->run_len[bank] = 0;
+    alloc->stats.banks_used -= num_banks;
+    return 1;
+}
+
+// HEAP_MALLOC: allocate R[rs2] bytes, pointer (0 on failure) goes to R[28]
+void heap_malloc(struct VM *vm, uint32_t num_bytes) {
+    // a zero byte request still takes a bank so the pointer is unique
+    uint32_t num_banks = num_bytes == 0 ? 1 : (num_bytes - 1) / HEAP_BANK_SIZE + 1;
+    int bank = num_bytes > HEAP_SIZE ? -1 : heap_alloc_banks(vm, num_banks);
+    vm->heap_alloc.stats.mallocs++;
+    // the large profile takes what the small heap cannot
+    if(bank < 0 && vm->large_heap != NULL) {
+        vm->registers[28] = large_malloc(vm, num_bytes);
+        if(vm->registers[28] != 0) {
+            return;
+        }
+    }
+    if(bank < 0) {
+        vm->heap_alloc.stats.failed_mallocs++;
+        vm->registers[28] = 0;
+        return;
+    }
+    // store mapped addr
+    vm->registers[28] = HEAP_START + bank*HEAP_BANK_SIZE;
+}
+
+// HEAP_FREE: ptr has to be the start of a live allocation
+void heap_free(struct VM *vm, uint32_t ptr) {
+    if(ptr >= LARGE_HEAP_START && vm->large_heap != NULL) {
+        if(!large_free(vm, ptr)) {
+            illegal_operation(vm);
+            return;
+        }
+        vm->heap_alloc.stats.frees++;
+        return;
+    }
+    uint32_t offset = ptr - HEAP_START;
+    if(ptr < HEAP_START || offset % HEAP_BANK_SIZE != 0
+        || !heap_free_banks(vm, offset / HEAP_BANK_SIZE)) {
+        illegal_operation(vm);
+        return;
+    }
+    vm->heap_alloc.stats.frees++;
+}
+
+void heap_print_stats(struct VM *vm, FILE *out) {
+    struct HEAP_ALLOC *alloc = &vm->heap_alloc;
+    int free_banks = HEAP_BANK_NUM - alloc->stats.banks_used;
+    int largest_run = largest_free_run(alloc->used, HEAP_BANK_NUM);
+    // share of the free banks unusable for a request as large as all of them
+    double fragmentation = free_banks == 0 ? 0.0 : 1.0 - (double) largest_run / free_banks;
+    fprintf(out, "heap mallocs: %lu\n", (unsigned long) alloc->stats.mallocs);
+    fprintf(out, "heap failed mallocs: %lu\n", (unsigned long) alloc->stats.failed_mallocs);
+    fprintf(out, "heap frees: %lu\n", (unsigned long) alloc->stats.frees);
+    fprintf(out, "heap banks used: %u/%d (peak %u)\n", alloc->stats.banks_used, HEAP_BANK_NUM,
+        alloc->stats.peak_banks_used);
+    fprintf(out, "heap largest free run: %d banks\n", largest_run);
+    fprintf(out, "heap fragmentation: %.3f\n", fragmentation);
+    large_print_stats(vm, out);
+}
@@ -1,8 +1,79 @@
 #ifndef HEAP_H_
 #define HEAP_H_
 #include <stdint.h>
+#include <stdio.h>
 #include "structs_enums.h"
-uint32_t is_heap(char *inst_name, uint8_t rs1, int imm, struct VM *vm);
-uint32_t malloc_heap(struct VM *vm, uint32_t num_bytes);
-int exe_heap(struct INST *inst, struct VM *vm);
+
+// BANK BITMAPS, one bit per bank out of total, shared with the large heap; inline so the
+// small heap's constant total folds into the loops
+
+// index of the first bank at or after from whose used bit equals set, total if none
+static inline int next_bank(const uint64_t *used, int total, int from, int set) {
+    for(int w = from / 64 ; w < (total + 63) / 64 ; w++) {
+        uint64_t word = set ? used[w] : ~used[w];
+        if(w == from / 64) {
+            word &= ~0ULL << (from % 64);
+        }
+        if(word != 0) {
+            int bank = w*64 + __builtin_ctzll(word);
+            return bank < total ? bank : total;
+        }
+    }
+    return total;
+}
+
+// set or clear the used bits of banks [first, first+num_banks)
+static inline void mark_banks(uint64_t *used, int first, int num_banks, int set) {
+    while(num_banks > 0) {
+        int bit = first % 64;
+        int n = num_banks < 64 - bit ? num_banks : 64 - bit;
+        uint64_t mask = (n == 64 ? ~0ULL : ((1ULL << n) - 1)) << bit;
+        if(set) {
+            used[first / 64] |= mask;
+        }
+        else {
+            used[first / 64] &= ~mask;
+        }
+        first += n;
+        num_banks -= n;
+    }
+}
+
+// first bank of a free run of num_banks, -1 if there is none; first fit, hopping from free
+// run to free run whole words at a time
+static inline int first_fit(const uint64_t *used, int total, uint32_t num_banks) {
+    if(num_banks == 0 || num_banks > (uint32_t) total) {
+        return -1;
+    }
+    int bank = 0;
+    while(bank + (int) num_banks <= total) {
+        int free_start = next_bank(used, total, bank, 0);
+        if(free_start + (int) num_banks > total) {
+            return -1;
+        }
+        int free_end = next_bank(used, total, free_start, 1);
+        if(free_end - free_start >= (int) num_banks) {
+            return free_start;
+        }
+        bank = free_end;
+    }
+    return -1;
+}
+
+// LARGEST FREE RUN (heap.c)
+int largest_free_run(const uint64_t *used, int total);
+
+// HEAP BANK ALLOCATOR (heap.c)
+void heap_init(struct VM *vm);
+
+// first bank of a free run of num_banks, -1 if there is none
+int heap_alloc_banks(struct VM *vm, uint32_t num_banks);
+
+// returns 0 if bank does not start an allocation
+int heap_free_banks(struct VM *vm, uint32_t bank);
+
+void heap_malloc(struct VM *vm, uint32_t num_bytes);
+void heap_free(struct VM *vm, uint32_t ptr);
+
+void heap_print_stats(struct VM *vm, FILE *out);
 #endif
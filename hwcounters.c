@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+#include "hwcounters.h"
+
+static const char *event_names[HW_NUM] = {
+    [HW_CYCLES] = "cycles", [HW_INSTRUCTIONS] = "instructions",
+    [HW_BRANCH_MISSES] = "branch-misses", [HW_L1D_MISSES] = "l1d-read-misses", [HW_NS] = "ns"
+};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} event_attrs[HW_PERF_EVENTS] = {
+    [HW_CYCLES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    [HW_INSTRUCTIONS] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    [HW_BRANCH_MISSES] = {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    [HW_L1D_MISSES] = {PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D
+            | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16}
+};
+
+// this thread's user space only, which is what perf_event_paranoid 2 still allows
+static int open_event(int event, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event_attrs[event].type;
+    attr.config = event_attrs[event].config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int) syscall(SYS_perf_event_open, &attr, 0, -1, group, 0);
+}
+
+// the first event that opens leads, the rest join its group so one read(2) samples them all
+static void hw_open(struct HWCOUNTERS *hw) {
+    hw->leader = -1;
+    hw->num_open = 0;
+    for(int i = 0 ; i < HW_PERF_EVENTS ; i++) {
+        hw->fd[i] = open_event(i, hw->leader);
+        if(hw->fd[i] < 0) {
+            continue;
+        }
+        if(hw->leader < 0) {
+            hw->leader = hw->fd[i];
+        }
+        hw->slot[i] = hw->num_open++;
+    }
+}
+
+static void hw_read(struct HWCOUNTERS *hw, uint64_t values[HW_NUM]) {
+    uint64_t group[1 + HW_PERF_EVENTS];     // nr, then the values in the order they joined
+    memset(values, 0, HW_NUM * sizeof(uint64_t));
+    if(hw->leader >= 0 && read(hw->leader, group, sizeof(group)) > 0) {
+        for(int i = 0 ; i < HW_PERF_EVENTS ; i++) {
+            if(hw->fd[i] >= 0) {
+                values[i] = group[1 + hw->slot[i]];
+            }
+        }
+    }
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    values[HW_NS] = now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+static void add_since(uint64_t sum[HW_NUM], const uint64_t start[HW_NUM], const uint64_t now[HW_NUM]) {
+    for(int i = 0 ; i < HW_NUM ; i++) {
+        sum[i] += now[i] - start[i];
+    }
+}
+
+void hw_run_start(struct HWCOUNTERS *hw) {
+    hw->in_routine = 0;
+    hw_read(hw, hw->run_start);
+}
+
+void hw_run_end(struct HWCOUNTERS *hw) {
+    uint64_t now[HW_NUM];
+    hw_read(hw, now);
+    add_since(hw->total, hw->run_start, now);
+    if(hw->in_routine) {
+        add_since(hw->routines, hw->routine_start, now);
+        hw->in_routine = 0;
+    }
+}
+
+void hw_routine_begin(struct HWCOUNTERS *hw) {
+    hw_read(hw, hw->routine_start);
+    hw->in_routine = 1;
+    hw->routine_calls++;
+}
+
+void hw_routine_end(struct HWCOUNTERS *hw) {
+    uint64_t now[HW_NUM];
+    hw_read(hw, now);
+    add_since(hw->routines, hw->routine_start, now);
+    hw->in_routine = 0;
+}
+
+// LIBRARY API (riskxvii.h)
+int vm_hwcounters_start(struct VM *vm) {
+    if(vm->hw == NULL) {
+        vm->hw = calloc(1, sizeof(struct HWCOUNTERS));
+        if(vm->hw == NULL) {
+            return 1;
+        }
+        hw_open(vm->hw);
+    }
+    struct HWCOUNTERS *hw = vm->hw;
+    memset(hw->total, 0, sizeof(hw->total));
+    memset(hw->routines, 0, sizeof(hw->routines));
+    hw->routine_calls = 0;
+    return 0;
+}
+
+static void print_ratio(FILE *out, const char *name, uint64_t count, uint64_t per, int open) {
+    if(open && per != 0) {
+        fprintf(out, " %s %.3f", name, (double) count / per);
+    }
+}
+
+void vm_hwcounters_report(struct VM *vm, FILE *out) {
+    struct HWCOUNTERS *hw = vm->hw;
+    if(hw == NULL) {
+        return;
+    }
+    if(hw->num_open == 0) {
+        fprintf(out, "host counters: perf events unavailable, clock only\n");
+    }
+    // the loads/stores that reach a routine are guest instructions too, but few enough to
+    // leave in; what the ratios are after is the cost of the interpreter loop itself
+    uint64_t exec[HW_NUM];
+    for(int i = 0 ; i < HW_NUM ; i++) {
+        exec[i] = hw->total[i] - hw->routines[i];
+    }
+    fprintf(out, "%-16s %16s %16s %16s\n", "host counter", "total", "execution", "routines");
+    for(int i = 0 ; i < HW_NUM ; i++) {
+        if(i < HW_PERF_EVENTS && hw->fd[i] < 0) {
+            fprintf(out, "%-16s %16s %16s %16s\n", event_names[i], "-", "-", "-");
+            continue;
+        }
+        fprintf(out, "%-16s %16llu %16llu %16llu\n", event_names[i], (unsigned long long) hw->total[i],
+                (unsigned long long) exec[i], (unsigned long long) hw->routines[i]);
+    }
+
+    uint64_t insns = vm_insn_count(vm);
+    fprintf(out, "per guest instruction:");
+    for(int i = 0 ; i < HW_NUM ; i++) {
+        print_ratio(out, event_names[i], exec[i], insns, i == HW_NS || hw->fd[i] >= 0);
+    }
+    fprintf(out, "\nroutine calls: %llu, per call:", (unsigned long long) hw->routine_calls);
+    for(int i = 0 ; i < HW_NUM ; i++) {
+        print_ratio(out, event_names[i], hw->routines[i], hw->routine_calls, i == HW_NS || hw->fd[i] >= 0);
+    }
+    fprintf(out, "\n");
+}
+
+void hw_release(struct VM *vm) {
+    if(vm->hw == NULL) {
+        return;
+    }
+    for(int i = 0 ; i < HW_PERF_EVENTS ; i++) {
+        if(vm->hw->fd[i] >= 0) {
+            close(vm->hw->fd[i]);
+        }
+    }
+    free(vm->hw);
+    vm->hw = NULL;
+}
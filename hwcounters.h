@@ -0,0 +1,55 @@
+#ifndef HWCOUNTERS_H_
+#define HWCOUNTERS_H_
+#include <stdio.h>
+#include <stdint.h>
+#include "structs_enums.h"
+
+// HOST COUNTERS (hwcounters.c)
+// perf events of the host thread sampled when vm_run starts and ends and around every virtual
+// routine call, so routine time can be told apart from plain ALU/branch execution; events the
+// kernel will not give us (restricted containers, no PMU) read as missing and HW_NS still works
+
+enum HW_EVENT {
+    HW_CYCLES,
+    HW_INSTRUCTIONS,
+    HW_BRANCH_MISSES,
+    HW_L1D_MISSES,      // L1 data cache read misses
+    HW_NS,              // CLOCK_MONOTONIC, always there
+    HW_NUM
+};
+#define HW_PERF_EVENTS HW_NS    // the ones that come from perf_event_open
+
+struct HWCOUNTERS {
+    int leader;                 // fd a group read returns every open event from, -1 for none
+    int fd[HW_PERF_EVENTS];     // -1 for an event that could not be opened
+    int slot[HW_PERF_EVENTS];   // its position in a group read
+    int num_open;
+    uint64_t run_start[HW_NUM];
+    uint64_t routine_start[HW_NUM];
+    int in_routine;             // a routine that ends the run never gets to hw_routine_end
+    uint64_t total[HW_NUM];     // over every vm_run
+    uint64_t routines[HW_NUM];  // the part of total spent inside virtual routines
+    uint64_t routine_calls;
+};
+
+void hw_run_start(struct HWCOUNTERS *hw);
+void hw_run_end(struct HWCOUNTERS *hw);
+void hw_routine_begin(struct HWCOUNTERS *hw);
+void hw_routine_end(struct HWCOUNTERS *hw);
+
+// close the events and free the counters
+void hw_release(struct VM *vm);
+
+// around the MMIO handlers in memory.c
+#define HW_ROUTINE_BEGIN(vm) do { \
+        if((vm)->hw != NULL) { \
+            hw_routine_begin((vm)->hw); \
+        } \
+    } while(0)
+#define HW_ROUTINE_END(vm) do { \
+        if((vm)->hw != NULL) { \
+            hw_routine_end((vm)->hw); \
+        } \
+    } while(0)
+
+#endif
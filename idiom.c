@@ -0,0 +1,304 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "structs_enums.h"
+#include "decode.h"
+#include "idiom.h"
+
+// RECOGNITION
+static int load_size(uint8_t op) {
+    switch(op) {
+        case OP_LB: case OP_LBU:
+            return 1;
+        case OP_LH: case OP_LHU:
+            return 2;
+        case OP_LW:
+            return 4;
+    }
+    return 0;
+}
+
+static int store_size(uint8_t op) {
+    switch(op) {
+        case OP_SB:
+            return 1;
+        case OP_SH:
+            return 2;
+        case OP_SW:
+            return 4;
+    }
+    return 0;
+}
+
+// line i as decoded, with its own op even when it heads a loop
+static struct DECODED line_at(struct VM *vm, uint32_t i) {
+    struct DECODED inst = vm->decoded[i];
+    if(inst.op == OP_IDIOM) {
+        inst.op = vm->idioms[i].op;
+    }
+    return inst;
+}
+
+// addi reg, reg, size; x0 is never a pointer since its writes decode to REG_SINK
+static int is_step(const struct DECODED *inst, uint8_t reg, int size) {
+    return inst->op == OP_ADDI && inst->rd == reg && inst->rs1 == reg && inst->imm == size;
+}
+
+// bne/bltu back to the head comparing pointer p or q against an end register neither changes
+static int match_branch(const struct DECODED *inst, int back, uint8_t p, uint8_t q, struct IDIOM *idiom) {
+    if((inst->op != OP_BNE && inst->op != OP_BLTU) || inst->imm != -back*4) {
+        return 0;
+    }
+    uint8_t cmp = inst->rs1;
+    uint8_t end = inst->rs2;
+    if(inst->op == OP_BNE && (end == p || end == q)) {
+        cmp = inst->rs2;
+        end = inst->rs1;
+    }
+    if((cmp != p && cmp != q) || end == p || end == q) {
+        return 0;
+    }
+    idiom->branch = inst->op;
+    idiom->cmp = cmp;
+    idiom->end = end;
+    return 1;
+}
+
+// load rv, ls(src); then a store of rv through dst and a step of each pointer in any order;
+// bne/bltu src or dst, end
+static int match_copy(const struct DECODED *code, int num, struct IDIOM *idiom) {
+    const struct DECODED *load = &code[0];
+    int size = load_size(load->op);
+    if(num < 5 || size == 0 || load->rd == REG_SINK || load->rd == load->rs1) {
+        return 0;
+    }
+    idiom->rv = load->rd;
+    idiom->src = load->rs1;
+    idiom->src_off = load->imm;
+    int store_at = 0;
+    for(int i = 1 ; i <= 3 ; i++) {
+        if(store_size(code[i].op) == size && code[i].rs2 == idiom->rv) {
+            store_at = i;
+        }
+    }
+    if(store_at == 0) {
+        return 0;
+    }
+    idiom->dst = code[store_at].rs1;
+    if(idiom->dst == idiom->src || idiom->dst == idiom->rv) {
+        return 0;
+    }
+    int src_step = 0;
+    int dst_step = 0;
+    for(int i = 1 ; i <= 3 ; i++) {
+        if(is_step(&code[i], idiom->src, size)) {
+            src_step = i;
+        }
+        else if(is_step(&code[i], idiom->dst, size)) {
+            dst_step = i;
+        }
+    }
+    if(src_step == 0 || dst_step == 0) {
+        return 0;
+    }
+    idiom->dst_off = code[store_at].imm + (dst_step < store_at ? size : 0);
+    if(!match_branch(&code[4], 4, idiom->src, idiom->dst, idiom) || idiom->end == idiom->rv) {
+        return 0;
+    }
+    idiom->kind = IDIOM_COPY;
+    idiom->len = 5;
+    idiom->size = size;
+    return 1;
+}
+
+// store rv, sd(dst); addi dst, dst, size; bne/bltu dst, end
+static int match_fill(const struct DECODED *code, int num, struct IDIOM *idiom) {
+    const struct DECODED *store = &code[0];
+    int size = store_size(store->op);
+    if(num < 3 || size == 0 || store->rs1 == store->rs2 || !is_step(&code[1], store->rs1, size)) {
+        return 0;
+    }
+    idiom->rv = store->rs2;
+    idiom->dst = store->rs1;
+    idiom->dst_off = store->imm;
+    if(!match_branch(&code[2], 2, idiom->dst, idiom->dst, idiom)) {
+        return 0;
+    }
+    idiom->kind = IDIOM_FILL;
+    idiom->len = 3;
+    idiom->size = size;
+    return 1;
+}
+
+// lb/lbu rv, ls(src); addi src, src, 1; bne rv, x0
+static int match_strlen(const struct DECODED *code, int num, struct IDIOM *idiom) {
+    const struct DECODED *load = &code[0];
+    const struct DECODED *branch = &code[2];
+    uint8_t rv = load->rd;
+    if(num < 3 || (load->op != OP_LB && load->op != OP_LBU) || rv == REG_SINK || rv == load->rs1
+            || !is_step(&code[1], load->rs1, 1) || branch->op != OP_BNE || branch->imm != -8
+            || !((branch->rs1 == rv && branch->rs2 == 0) || (branch->rs1 == 0 && branch->rs2 == rv))) {
+        return 0;
+    }
+    idiom->rv = rv;
+    idiom->src = load->rs1;
+    idiom->src_off = load->imm;
+    idiom->kind = IDIOM_STRLEN;
+    idiom->len = 3;
+    idiom->size = 1;
+    return 1;
+}
+
+static void recognize(struct VM *vm, uint32_t head) {
+    struct DECODED code[IDIOM_MAX_LEN];
+    int num = 0;
+    while(num < IDIOM_MAX_LEN && head + num < INST_MEM_SIZE/4) {
+        code[num] = line_at(vm, head + num);
+        num++;
+    }
+    struct IDIOM idiom;
+    memset(&idiom, 0, sizeof(idiom));
+    if(!match_copy(code, num, &idiom) && !match_fill(code, num, &idiom) && !match_strlen(code, num, &idiom)) {
+        return;
+    }
+    idiom.op = code[0].op;
+    vm->idioms[head] = idiom;
+    vm->decoded[head].op = OP_IDIOM;
+    if(idiom.kind == IDIOM_FILL) {
+        // a store's rd bits are part of its offset, the trace reads rd for every OP_IDIOM
+        vm->decoded[head].rd = REG_SINK;
+    }
+}
+
+// LOOP IDIOMS (idiom.h)
+void idioms_scan(struct VM *vm) {
+    memset(vm->idioms, 0, sizeof(vm->idioms));
+    for(uint32_t i = 0 ; i < INST_MEM_SIZE/4 ; i++) {
+        recognize(vm, i);
+    }
+}
+
+void idioms_refresh(struct VM *vm, uint32_t first, uint32_t last) {
+    uint32_t from = first >= IDIOM_MAX_LEN-1 ? first - (IDIOM_MAX_LEN-1) : 0;
+    for(uint32_t i = from ; i <= last && i < INST_MEM_SIZE/4 ; i++) {
+        if(vm->decoded[i].op == OP_IDIOM) {
+            decode_line(inst_line(vm, i), &vm->decoded[i]);
+        }
+        vm->idioms[i].kind = IDIOM_NONE;
+    }
+    for(uint32_t i = from ; i <= last && i < INST_MEM_SIZE/4 ; i++) {
+        recognize(vm, i);
+    }
+}
+
+// EXECUTION
+// bytes from guest addr on, at most max, that lie in pages with flag placed back to back in
+// the vm, so that *host covers all of them
+static uint32_t direct_bytes(struct VM *vm, uint32_t addr, uint32_t max, uint8_t flag, uint8_t **host) {
+    if(addr >= MEM_SPACE) {
+        return 0;
+    }
+    uint32_t index = addr >> MEM_PAGE_BITS;
+    struct MEM_PAGE *first = &vm->pages[index];
+    uint32_t bytes = 0;
+    uint32_t offset = addr & (MEM_PAGE_SIZE-1);
+    for(uint32_t i = index ; i < MEM_PAGES && bytes < max ; i++) {
+        struct MEM_PAGE *page = &vm->pages[i];
+        if(!(page->flags & flag) || page->offset != first->offset + (i - index) * MEM_PAGE_SIZE) {
+            break;
+        }
+        bytes += MEM_PAGE_SIZE - (i == index ? offset : 0);
+    }
+    *host = (uint8_t *) vm + first->offset + offset;
+    return bytes < max ? bytes : max;
+}
+
+// times the closing branch runs, 0 unless the loop ends before its pointer wraps around
+static uint64_t iterations(struct IDIOM *idiom, uint32_t cmp, uint32_t end) {
+    uint32_t size = idiom->size;
+    uint32_t dist = end - cmp;
+    if(idiom->branch == OP_BNE) {
+        if(dist == 0 || dist % size != 0 || dist > MEM_SPACE) {
+            return 0;
+        }
+        return dist / size;
+    }
+    // bltu: the body always runs once, then while cmp < end
+    if((uint64_t) cmp + size > UINT32_MAX) {
+        return 0;
+    }
+    if(end <= cmp + size) {
+        return 1;
+    }
+    uint64_t n = (dist + size - 1) / size;
+    if(dist > MEM_SPACE || cmp + n * size > UINT32_MAX) {
+        return 0;
+    }
+    return n;
+}
+
+// what the last load of a copy left in rv
+static uint32_t loaded_value(const uint8_t *bytes, uint8_t op) {
+    uint32_t value = 0;
+    int size = load_size(op);
+    for(int i = 0 ; i < size ; i++) {
+        value |= (uint32_t) bytes[i] << (8*i);
+    }
+    if(op == OP_LB || op == OP_LH) {
+        value = sext(value, size*8);
+    }
+    return value;
+}
+
+uint64_t idiom_run(struct VM *vm, uint32_t pc) {
+    struct IDIOM *idiom = &vm->idioms[pc / 4];
+    uint32_t *reg = vm->registers;
+    // these need every instruction seen or counted on its own
+    if(vm->trace != NULL || vm->profile != NULL || vm->insn_limit != UINT64_MAX) {
+        return 0;
+    }
+
+    uint64_t n;
+    uint8_t *from;
+    uint8_t *to;
+    if(idiom->kind == IDIOM_STRLEN) {
+        uint32_t avail = direct_bytes(vm, reg[idiom->src] + idiom->src_off, MEM_SPACE, PAGE_LOAD_DIRECT, &from);
+        uint8_t *nul = avail > 0 ? memchr(from, 0, avail) : NULL;
+        if(nul == NULL) {
+            return 0;
+        }
+        n = nul - from + 1;
+        reg[idiom->src] += n;
+        reg[idiom->rv] = 0;
+        vm->PC = pc + idiom->len*4;
+        return n * idiom->len;
+    }
+
+    n = iterations(idiom, reg[idiom->cmp], reg[idiom->end]);
+    uint32_t bytes = n * idiom->size;
+    if(n == 0 || direct_bytes(vm, reg[idiom->dst] + idiom->dst_off, bytes, PAGE_STORE_DIRECT, &to) != bytes) {
+        return 0;
+    }
+    if(idiom->kind == IDIOM_COPY) {
+        if(direct_bytes(vm, reg[idiom->src] + idiom->src_off, bytes, PAGE_LOAD_DIRECT, &from) != bytes
+                || (from < to + bytes && to < from + bytes)) {
+            return 0;
+        }
+        memcpy(to, from, bytes);
+        reg[idiom->rv] = loaded_value(from + bytes - idiom->size, idiom->op);
+        reg[idiom->src] += bytes;
+    }
+    else {
+        uint32_t value = reg[idiom->rv];
+        if(idiom->size == 1) {
+            memset(to, value & 0xff, bytes);
+        }
+        for(uint32_t i = 0 ; i < bytes && idiom->size > 1 ; i++) {
+            to[i] = value >> (8 * (i % idiom->size));
+        }
+    }
+    reg[idiom->dst] += bytes;
+    vm->PC = pc + idiom->len*4;
+    return n * idiom->len;
+}
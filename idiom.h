@@ -0,0 +1,46 @@
+#ifndef IDIOM_H_
+#define IDIOM_H_
+#include <stdint.h>
+#include "structs_enums.h"
+#include "store_load_helper.h"
+#include "exec_helpers.h"
+
+// LOOP IDIOMS (idiom.c)
+// canonical byte/halfword/word copy, fill and strlen loops are found when the image is decoded,
+// their first instruction becomes OP_IDIOM and the engines try to run the whole loop as one
+// memcpy/memset/memchr; whenever the result could differ from running it (overlap, virtual
+// routines, instruction memory, unmapped or tracked pages, limits, tracing, profiling) the
+// loop runs normally
+#define IDIOM_MAX_LEN 5     // instructions in the longest loop shape
+
+// find the loops in all of instruction memory, right after decode_all
+void idioms_scan(struct VM *vm);
+
+// lines first..last were re-decoded: forget and re-find every loop that could touch them
+void idioms_refresh(struct VM *vm, uint32_t first, uint32_t last);
+
+// run the loop headed at pc to its end; returns the instructions that took, with vm->PC after
+// the loop, or 0 with nothing changed when it has to run an iteration at a time
+uint64_t idiom_run(struct VM *vm, uint32_t pc);
+
+// the head instruction alone when idiom_run returned 0, stores are left to the engine
+static inline int idiom_head_is_store(struct IDIOM *idiom) {
+    return idiom->kind == IDIOM_FILL;
+}
+
+static inline uint32_t idiom_head_load(struct VM *vm, struct DECODED *inst, struct IDIOM *idiom, uint32_t pc) {
+    switch(idiom->op) {
+        case OP_LB:
+            return sext(load_raw_at(vm, inst, 1, pc) & 0xff, 8);
+        case OP_LH:
+            return sext(load_raw_at(vm, inst, 2, pc) & 0xffff, 16);
+        case OP_LBU:
+            return load_raw_at(vm, inst, 1, pc) & 0xff;
+        case OP_LHU:
+            return load_raw_at(vm, inst, 2, pc) & 0xffff;
+        default:
+            return load_raw_at(vm, inst, 4, pc);
+    }
+}
+
+#endif
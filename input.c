@@ -0,0 +1,223 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "input.h"
+#include "output.h"
+
+// REFILL
+// next chunk into in->chunk, 0 at end of input
+static int in_refill(struct IN_STREAM *in) {
+    size_t got = 0;
+    if(in->fd >= 0) {
+        // pending output is a prompt the reader may be waiting on
+        struct pollfd ready = { .fd = in->fd, .events = POLLIN };
+        if(in->flush != NULL && poll(&ready, 1, 0) == 0) {
+            out_flush(in->flush);
+        }
+        ssize_t len;
+        while((len = read(in->fd, in->chunk, IN_CHUNK_SIZE)) < 0 && errno == EINTR) {
+        }
+        if(len < 0 && errno == EAGAIN) {
+            // nothing yet is not the end, only in_ready's 64 KiB tokens get here
+            in->pos = in->end = in->chunk;
+            return 0;
+        }
+        if(len <= 0) {
+            // end of input stays the end, as it does for a stdio stream
+            if(in->own_fd) {
+                close(in->fd);
+                in->own_fd = 0;
+            }
+            in->fd = -1;
+            return 0;
+        }
+        got = len;
+    }
+    else if(in->file != NULL) {
+        got = fread(in->chunk, 1, IN_CHUNK_SIZE, in->file);
+    }
+    in->pos = in->chunk;
+    in->end = in->chunk + got;
+    return got > 0;
+}
+
+// what is left unread moved to the front of in->chunk and whatever the descriptor has read
+// in after it, 1 if some came, 0 at end of input, -1 if there is nothing yet
+static int in_append(struct IN_STREAM *in) {
+    size_t left = in->end - in->pos;
+    memmove(in->chunk, in->pos, left);
+    in->pos = in->chunk;
+    in->end = in->chunk + left;
+    ssize_t len;
+    while((len = read(in->fd, in->chunk + left, IN_CHUNK_SIZE - left)) < 0 && errno == EINTR) {
+    }
+    if(len < 0 && errno == EAGAIN) {
+        return -1;
+    }
+    if(len <= 0) {
+        if(in->own_fd) {
+            close(in->fd);
+            in->own_fd = 0;
+        }
+        in->fd = -1;
+        return 0;
+    }
+    in->end += len;
+    return 1;
+}
+
+// whether the buffer holds all of what the next read takes and the byte after it, in_int
+// looks at that byte to know the number is over
+static int token_buffered(const uint8_t *pos, const uint8_t *end, int is_int) {
+    if(is_int) {
+        while(pos < end && (*pos == ' ' || (*pos >= '\t' && *pos <= '\r'))) {
+            pos++;
+        }
+        if(pos < end && (*pos == '-' || *pos == '+')) {
+            pos++;
+        }
+        while(pos < end && *pos >= '0' && *pos <= '9') {
+            pos++;
+        }
+    }
+    return pos < end;
+}
+
+static inline int in_peek(struct IN_STREAM *in) {
+    if(in->pos == in->end && !in_refill(in)) {
+        return EOF;
+    }
+    return *in->pos;
+}
+
+// INPUT STREAM (input.h)
+static void in_init(struct IN_STREAM *in, struct OUT_STREAM *flush) {
+    in->pos = in->end = in->chunk;
+    in->fd = -1;
+    in->own_fd = 0;
+    in->nonblock = 0;
+    in->file = NULL;
+    in->map = NULL;
+    in->map_len = 0;
+    in->flush = flush;
+}
+
+void in_open_file(struct IN_STREAM *in, FILE *file, struct OUT_STREAM *flush) {
+    in_init(in, flush);
+    if(file != NULL) {
+        in->fd = fileno(file);
+        in->file = in->fd < 0 ? file : NULL;
+    }
+}
+
+int in_open_path(struct IN_STREAM *in, const char *path, struct OUT_STREAM *flush) {
+    in_init(in, flush);
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        return 1;
+    }
+    struct stat st;
+    if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        // an empty file maps to nothing and reads as end of input
+        if(st.st_size > 0) {
+            void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(map != MAP_FAILED) {
+                madvise(map, st.st_size, MADV_SEQUENTIAL);
+                in->map = map;
+                in->map_len = st.st_size;
+                in->pos = map;
+                in->end = in->pos + st.st_size;
+            }
+        }
+        if(in->map != NULL || st.st_size == 0) {
+            close(fd);
+            return 0;
+        }
+    }
+    in->fd = fd;
+    in->own_fd = 1;
+    return 0;
+}
+
+void in_open_pipe(struct IN_STREAM *in, int fd, struct OUT_STREAM *flush) {
+    in_init(in, flush);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    in->fd = fd;
+    in->own_fd = 1;
+    in->nonblock = 1;
+}
+
+void in_close(struct IN_STREAM *in) {
+    if(in->map != NULL) {
+        munmap(in->map, in->map_len);
+    }
+    if(in->own_fd) {
+        close(in->fd);
+    }
+    in_init(in, in->flush);
+}
+
+int in_ready(struct IN_STREAM *in, int is_int) {
+    // a token filling the whole chunk is read as far as it goes, like a blocking stream would
+    while(in->nonblock && in->fd >= 0 && !token_buffered(in->pos, in->end, is_int)
+            && in->end - in->pos < IN_CHUNK_SIZE) {
+        if(in_append(in) < 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+uint32_t in_char(struct IN_STREAM *in) {
+    int c = in_peek(in);
+    if(c == EOF) {
+        return 0;
+    }
+    in->pos++;
+    return c < 0x80 ? c : 0;
+}
+
+int32_t in_int(struct IN_STREAM *in) {
+    int c = in_peek(in);
+    while(c == ' ' || (c >= '\t' && c <= '\r')) {
+        in->pos++;
+        c = in_peek(in);
+    }
+    int negative = c == '-';
+    if(c == '-' || c == '+') {
+        in->pos++;
+        c = in_peek(in);
+    }
+    if(c < '0' || c > '9') {
+        return 0;
+    }
+    // magnitude up to the long range of the sign, past it the long saturates
+    uint64_t limit = negative ? 1ull << 63 : (1ull << 63) - 1;
+    uint64_t mag = 0;
+    int overflow = 0;
+    do {
+        uint32_t digit = c - '0';
+        if(mag > (limit - digit) / 10) {
+            overflow = 1;
+        }
+        else {
+            mag = mag * 10 + digit;
+        }
+        in->pos++;
+        // digits in the buffer go without the refill check
+        while(in->pos < in->end && *in->pos >= '0' && *in->pos <= '9' && !overflow
+                && mag <= (limit - 9) / 10) {
+            mag = mag * 10 + (*in->pos++ - '0');
+        }
+        c = in_peek(in);
+    } while(c >= '0' && c <= '9');
+    uint64_t value = overflow ? limit : mag;
+    return (int32_t) (uint32_t) (negative ? 0 - value : value);
+}
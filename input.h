@@ -0,0 +1,49 @@
+#ifndef INPUT_H_
+#define INPUT_H_
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "output.h"
+
+#define IN_CHUNK_SIZE (64 * 1024)
+
+// console input for R_CHAR/R_INT: a mapped file read in place, or chunks read from a file
+// descriptor (read(2)) or a stdio stream without one (fread, e.g. fmemopen)
+struct IN_STREAM {
+    const uint8_t *pos;     // next unread byte
+    const uint8_t *end;
+    int fd;                 // refilled from when >= 0, -1 once it hit end of input
+    int own_fd;             // opened by in_open_path or handed to in_open_pipe, closed by in_close
+    int nonblock;           // fd never waits, in_ready tells whether a read can be answered
+    FILE *file;             // refilled from when there is no fd
+    void *map;              // whole file mapped by in_open_path, NULL if it was not mappable
+    size_t map_len;
+    struct OUT_STREAM *flush;   // flushed before a read that would block
+    uint8_t chunk[IN_CHUNK_SIZE];
+};
+
+// read file through its descriptor when it has one, so nothing should have been read from it
+// through stdio before; NULL reads as end of input
+void in_open_file(struct IN_STREAM *in, FILE *file, struct OUT_STREAM *flush);
+
+// map path, or read it in chunks if it cannot be mapped (pipes...), 0 or 1 if it cannot be opened
+int in_open_path(struct IN_STREAM *in, const char *path, struct OUT_STREAM *flush);
+
+// read the pipe fd without ever waiting on it, taking ownership of it
+void in_open_pipe(struct IN_STREAM *in, int fd, struct OUT_STREAM *flush);
+
+void in_close(struct IN_STREAM *in);
+
+// whether the next in_char (is_int 0) or in_int can be answered from what has arrived, taking
+// in whatever the descriptor has without waiting; always 1 unless the stream is nonblocking
+int in_ready(struct IN_STREAM *in, int is_int);
+
+// scanf("%lc") in the C locale: one byte, 0 for bytes above 0x7f and at end of input
+uint32_t in_char(struct IN_STREAM *in);
+
+// scanf("%d"): whitespace, a sign and decimal digits, 0 when there are none, the sign stays
+// consumed and the first byte after the number does not; like glibc the digits go through a
+// saturating 64 bit long and the low 32 bits are kept
+int32_t in_int(struct IN_STREAM *in);
+
+#endif
@@ -0,0 +1,49 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+
+#include "structs_enums.h"
+#include "parse.h"
+#include "store_load_helper.h"
+#include "vir_routine.h"
+#include "heap.h"
+#include "exec_helpers.h"
+#include "interp.h"
+#include "profile.h"
+#include "trace.h"
+#include "idiom.h"
+#include "blocks.h"
+
+// computed goto needs the GNU labels-as-values extension, everything else gets the switch
+#if defined(__GNUC__) && !defined(VM_NO_THREADED)
+#define THREADED 1
+#endif
+
+// hooks a variant of the execution core can carry, each one compiles away when left out
+#define VARIANT_LIMITS  (1 << 0)    // limit ticks at taken jumps (exec_helpers.h)
+#define VARIANT_BUDGET  (1 << 1)    // the instruction limit checked before every instruction
+#define VARIANT_STEPS   (1 << 2)    // a steps argument, return once that many have run
+#define VARIANT_TRACE   (1 << 3)    // record every instruction into vm->trace (trace.h)
+#define VARIANT_PROFILE (1 << 4)    // count every instruction into vm->profile (profile.h)
+
+// EXECUTION CORE (interp.h)
+// the same handlers once per variant
+#define INTERP_NAME run_threaded
+#define INTERP_VARIANT 0
+#include "interp_core.h"
+
+#define INTERP_NAME run_threaded_steps
+#define INTERP_VARIANT VARIANT_STEPS
+#include "interp_core.h"
+
+#define INTERP_NAME run_threaded_checked
+#define INTERP_VARIANT (VARIANT_LIMITS | VARIANT_BUDGET)
+#include "interp_core.h"
+
+#define INTERP_NAME run_threaded_trace
+#define INTERP_VARIANT (VARIANT_LIMITS | VARIANT_BUDGET | VARIANT_TRACE)
+#include "interp_core.h"
+
+#define INTERP_NAME run_threaded_profile
+#define INTERP_VARIANT (VARIANT_LIMITS | VARIANT_BUDGET | VARIANT_PROFILE)
+#include "interp_core.h"
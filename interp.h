@@ -0,0 +1,22 @@
+#ifndef INTERP_H_
+#define INTERP_H_
+#include <stdint.h>
+#include "structs_enums.h"
+
+// THREADED VARIANTS (interp.c), one handler source compiled with different hooks
+// nothing but the instructions: no limits, tracing or profiling
+void run_threaded(struct VM *vm);
+
+// at most steps instructions, for running a reference alongside another engine
+void run_threaded_steps(struct VM *vm, uint64_t steps);
+
+// run_threaded that stops exactly at the instruction limit and polls the deadline
+void run_threaded_checked(struct VM *vm);
+
+// run_threaded_checked recording every instruction's effects into vm->trace
+void run_threaded_trace(struct VM *vm);
+
+// run_threaded_checked counting every instruction into vm->profile
+void run_threaded_profile(struct VM *vm);
+
+#endif
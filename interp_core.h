@@ -0,0 +1,265 @@
+// EXECUTION CORE, included by interp.c once per variant without an include guard
+// INTERP_NAME is the function to define and INTERP_VARIANT the VARIANT_* hooks it carries;
+// one handler per operation, dispatched on the decoded op id
+#define INTERP_HAS(hook) ((INTERP_VARIANT & VARIANT_##hook) != 0)
+#if INTERP_HAS(TRACE)
+#define TRACE_HOOK_DONE(vm, inst, jump) trace_record(vm, inst, jump)
+#define TRACE_HOOK_STORE(vm, inst, n) trace_store(vm, inst, n)
+#else
+#define TRACE_HOOK_DONE(vm, inst, jump)
+#define TRACE_HOOK_STORE(vm, inst, n)
+#endif
+#if INTERP_HAS(PROFILE)
+#define PROFILE_HOOK(vm, inst) profile_insn(vm, inst)
+#else
+#define PROFILE_HOOK(vm, inst)
+#endif
+#if INTERP_HAS(LIMITS)
+#define LIMIT_HOOK(vm, pc) LIMIT_TICK(vm, pc)
+#else
+#define LIMIT_HOOK(vm, pc)
+#endif
+#if INTERP_HAS(BUDGET)
+// stop with PC at the first instruction past the budget, not only at the next jump
+#define BUDGET_HOOK() { \
+        if(vm->insn_count >= budget) { \
+            limit_check(vm); \
+        } \
+    }
+#else
+#define BUDGET_HOOK()
+#endif
+#if INTERP_HAS(STEPS)
+#define OUT_OF_STEPS() (steps-- == 0)
+void INTERP_NAME(struct VM *vm, uint64_t steps) {
+#else
+#define OUT_OF_STEPS() 0
+void INTERP_NAME(struct VM *vm) {
+#endif
+    uint32_t *reg = vm->registers;
+    struct DECODED *inst;
+    uint32_t target;
+#if INTERP_HAS(BUDGET)
+    // what insn_count may reach, the blocks' share of vm_insn_count does not move in here
+    uint64_t built = blocks_insn_count(vm);
+    uint64_t budget = vm->insn_limit > built ? vm->insn_limit - built : 0;
+#endif
+
+#ifdef THREADED
+    static void *const handlers[OP_NUM] = {
+        [OP_ADD] = &&do_ADD,     [OP_ADDI] = &&do_ADDI,   [OP_SUB] = &&do_SUB,
+        [OP_LUI] = &&do_LUI,     [OP_XOR] = &&do_XOR,     [OP_XORI] = &&do_XORI,
+        [OP_OR] = &&do_OR,       [OP_ORI] = &&do_ORI,     [OP_AND] = &&do_AND,
+        [OP_ANDI] = &&do_ANDI,   [OP_SLL] = &&do_SLL,     [OP_SRL] = &&do_SRL,
+        [OP_SRA] = &&do_SRA,     [OP_LB] = &&do_LB,       [OP_LH] = &&do_LH,
+        [OP_LW] = &&do_LW,       [OP_LBU] = &&do_LBU,     [OP_LHU] = &&do_LHU,
+        [OP_SB] = &&do_SB,       [OP_SH] = &&do_SH,       [OP_SW] = &&do_SW,
+        [OP_SLT] = &&do_SLT,     [OP_SLTI] = &&do_SLTI,   [OP_SLTU] = &&do_SLTU,
+        [OP_SLTIU] = &&do_SLTIU, [OP_BEQ] = &&do_BEQ,     [OP_BNE] = &&do_BNE,
+        [OP_BLT] = &&do_BLT,     [OP_BLTU] = &&do_BLTU,   [OP_BGE] = &&do_BGE,
+        [OP_BGEU] = &&do_BGEU,   [OP_JAL] = &&do_JAL,     [OP_JALR] = &&do_JALR,
+        [OP_IDIOM] = &&do_IDIOM, [OP_INVALID] = &&do_INVALID
+    };
+#define HANDLER(op) do_##op:
+#define DISPATCH() do { \
+        if(vm->PC > 0x3ff || OUT_OF_STEPS()) { \
+            return; \
+        } \
+        BUDGET_HOOK(); \
+        inst = &vm->decoded[vm->PC / 4]; \
+        vm->insn_count++; \
+        PROFILE_HOOK(vm, inst); \
+        goto *handlers[inst->op]; \
+    } while(0)
+#else
+#define HANDLER(op) case OP_##op:
+#define DISPATCH() continue
+#endif
+
+// plain blocks, a do/while wrapper would swallow the switch fallback's continue
+// the trace hook sees the finished instruction and how far its successor is from pc + 4
+#define NEXT() { TRACE_HOOK_DONE(vm, inst, 0); vm->PC += 4; DISPATCH(); }
+// taken jumps are where runaway loops get stopped
+#define JUMP(pc) { \
+        target = (pc); \
+        TRACE_HOOK_DONE(vm, inst, (uint16_t) target - vm->PC - 4); \
+        vm->PC = target; \
+        LIMIT_HOOK(vm, vm->PC); \
+        DISPATCH(); \
+    }
+
+    vm->cur_block = NULL;
+#ifdef THREADED
+    DISPATCH();
+#else
+    while(vm->PC <= 0x3ff && !OUT_OF_STEPS()) {
+        BUDGET_HOOK();
+        inst = &vm->decoded[vm->PC / 4];
+        vm->insn_count++;
+        PROFILE_HOOK(vm, inst);
+        switch(inst->op) {
+#endif
+
+    // arithmetic and logic operations
+    HANDLER(ADD)
+        reg[inst->rd] = reg[inst->rs1] + reg[inst->rs2];
+        NEXT();
+    HANDLER(ADDI)
+        reg[inst->rd] = reg[inst->rs1] + inst->imm;
+        NEXT();
+    HANDLER(SUB)
+        reg[inst->rd] = reg[inst->rs1] - reg[inst->rs2];
+        NEXT();
+    HANDLER(LUI)
+        reg[inst->rd] = inst->imm;
+        NEXT();
+    HANDLER(XOR)
+        reg[inst->rd] = reg[inst->rs1] ^ reg[inst->rs2];
+        NEXT();
+    HANDLER(XORI)
+        reg[inst->rd] = reg[inst->rs1] ^ inst->imm;
+        NEXT();
+    HANDLER(OR)
+        reg[inst->rd] = reg[inst->rs1] | reg[inst->rs2];
+        NEXT();
+    HANDLER(ORI)
+        reg[inst->rd] = reg[inst->rs1] | inst->imm;
+        NEXT();
+    HANDLER(AND)
+        reg[inst->rd] = reg[inst->rs1] & reg[inst->rs2];
+        NEXT();
+    HANDLER(ANDI)
+        reg[inst->rd] = reg[inst->rs1] & inst->imm;
+        NEXT();
+    HANDLER(SLL)
+        reg[inst->rd] = reg[inst->rs1] << (reg[inst->rs2] & 0x1f);
+        NEXT();
+    HANDLER(SRL)
+        reg[inst->rd] = reg[inst->rs1] >> (reg[inst->rs2] & 0x1f);
+        NEXT();
+    HANDLER(SRA)
+        reg[inst->rd] = (int32_t) reg[inst->rs1] >> (reg[inst->rs2] & 0x1f);
+        NEXT();
+
+    // memory access operations
+    HANDLER(LB)
+        reg[inst->rd] = sext(load_raw(vm, inst, 1) & 0xff, 8);
+        NEXT();
+    HANDLER(LH)
+        reg[inst->rd] = sext(load_raw(vm, inst, 2) & 0xffff, 16);
+        NEXT();
+    HANDLER(LW)
+        reg[inst->rd] = load_raw(vm, inst, 4);
+        NEXT();
+    HANDLER(LBU)
+        reg[inst->rd] = load_raw(vm, inst, 1) & 0xff;
+        NEXT();
+    HANDLER(LHU)
+        reg[inst->rd] = load_raw(vm, inst, 2) & 0xffff;
+        NEXT();
+    HANDLER(SB)
+        TRACE_HOOK_STORE(vm, inst, 1);
+        store_raw(vm, inst, 1);
+        NEXT();
+    HANDLER(SH)
+        TRACE_HOOK_STORE(vm, inst, 2);
+        store_raw(vm, inst, 2);
+        NEXT();
+    HANDLER(SW)
+        TRACE_HOOK_STORE(vm, inst, 4);
+        store_raw(vm, inst, 4);
+        NEXT();
+
+    // program flow operations
+    HANDLER(SLT)
+        reg[inst->rd] = (int32_t) reg[inst->rs1] < (int32_t) reg[inst->rs2];
+        NEXT();
+    HANDLER(SLTI)
+        reg[inst->rd] = (int32_t) reg[inst->rs1] < inst->imm;
+        NEXT();
+    HANDLER(SLTU)
+        reg[inst->rd] = reg[inst->rs1] < reg[inst->rs2];
+        NEXT();
+    HANDLER(SLTIU)
+        reg[inst->rd] = reg[inst->rs1] < (uint32_t) inst->imm;
+        NEXT();
+    HANDLER(BEQ)
+        if(reg[inst->rs1] == reg[inst->rs2]) {
+            JUMP(vm->PC + inst->imm);
+        }
+        NEXT();
+    HANDLER(BNE)
+        if(reg[inst->rs1] != reg[inst->rs2]) {
+            JUMP(vm->PC + inst->imm);
+        }
+        NEXT();
+    HANDLER(BLT)
+        if((int32_t) reg[inst->rs1] < (int32_t) reg[inst->rs2]) {
+            JUMP(vm->PC + inst->imm);
+        }
+        NEXT();
+    HANDLER(BLTU)
+        if(reg[inst->rs1] < reg[inst->rs2]) {
+            JUMP(vm->PC + inst->imm);
+        }
+        NEXT();
+    HANDLER(BGE)
+        if((int32_t) reg[inst->rs1] >= (int32_t) reg[inst->rs2]) {
+            JUMP(vm->PC + inst->imm);
+        }
+        NEXT();
+    HANDLER(BGEU)
+        if(reg[inst->rs1] >= reg[inst->rs2]) {
+            JUMP(vm->PC + inst->imm);
+        }
+        NEXT();
+    HANDLER(JAL)
+        reg[inst->rd] = vm->PC + 4;
+        JUMP(vm->PC + inst->imm);
+    HANDLER(JALR)
+        // read rs1 before writing rd, they may be the same register
+        target = (reg[inst->rs1] + inst->imm) & ~1u;
+        reg[inst->rd] = vm->PC + 4;
+        JUMP(target);
+
+    // head of a copy/fill/strlen loop (idiom.h), run whole unless every step has to be seen
+    HANDLER(IDIOM)
+#if !INTERP_HAS(STEPS) && !INTERP_HAS(TRACE) && !INTERP_HAS(PROFILE)
+        {
+            uint64_t ran = idiom_run(vm, vm->PC);
+            if(ran != 0) {
+                vm->insn_count += ran - 1;      // dispatch counted the head
+                DISPATCH();
+            }
+        }
+#endif
+        if(idiom_head_is_store(&vm->idioms[vm->PC / 4])) {
+            TRACE_HOOK_STORE(vm, inst, vm->idioms[vm->PC / 4].size);
+            store_raw(vm, inst, vm->idioms[vm->PC / 4].size);
+            NEXT();
+        }
+        reg[inst->rd] = idiom_head_load(vm, inst, &vm->idioms[vm->PC / 4], vm->PC);
+        NEXT();
+
+    HANDLER(INVALID)
+        inst_not_implemented(vm);
+
+#ifndef THREADED
+        }
+    }
+#endif
+}
+
+#undef HANDLER
+#undef DISPATCH
+#undef NEXT
+#undef JUMP
+#undef OUT_OF_STEPS
+#undef TRACE_HOOK_DONE
+#undef TRACE_HOOK_STORE
+#undef PROFILE_HOOK
+#undef LIMIT_HOOK
+#undef BUDGET_HOOK
+#undef INTERP_HAS
+#undef INTERP_NAME
+#undef INTERP_VARIANT
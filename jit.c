@@ -0,0 +1,488 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "structs_enums.h"
+#include "parse.h"
+#include "blocks.h"
+#include "exec_helpers.h"
+#include "jit.h"
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define JIT_X86_64 1
+#endif
+
+#ifdef JIT_X86_64
+
+// translated block, returns the guest PC to continue at
+typedef uint32_t (*jit_fn)(uint32_t *registers, struct VM *vm);
+
+struct EMIT {
+    uint8_t *code;
+    size_t pos;
+    size_t cap;     // bytes past cap are counted but not written
+};
+
+// host registers, rbx holds vm->registers and r12 the vm for the whole block
+#define EAX 0
+#define ECX 1
+
+// x86 condition codes
+#define CC_B  0x2
+#define CC_AE 0x3
+#define CC_E  0x4
+#define CC_NE 0x5
+#define CC_L  0xc
+#define CC_GE 0xd
+
+// JIT HELPERS, called from translated code for everything that touches memory
+static uint32_t jit_load(struct VM *vm, struct DECODED *inst, uint32_t pc) {
+    switch(inst->op) {
+        case OP_LB:
+            return sext(load_raw_at(vm, inst, 1, pc) & 0xff, 8);
+        case OP_LH:
+            return sext(load_raw_at(vm, inst, 2, pc) & 0xffff, 16);
+        case OP_LW:
+            return load_raw_at(vm, inst, 4, pc);
+        case OP_LBU:
+            return load_raw_at(vm, inst, 1, pc) & 0xff;
+        default:
+            return load_raw_at(vm, inst, 2, pc) & 0xffff;
+    }
+}
+
+// returns 1 if the store rewrote instruction memory and the block has to be left
+static uint32_t jit_store(struct VM *vm, struct DECODED *inst, uint32_t pc) {
+    uint32_t code_gen = vm->code_gen;
+    int num_bytes = 4;
+    if(inst->op == OP_SB) {
+        num_bytes = 1;
+    }
+    else if(inst->op == OP_SH) {
+        num_bytes = 2;
+    }
+    vm->PC = pc;
+    store_raw(vm, inst, num_bytes);
+    if(vm->code_gen != code_gen) {
+        uncount_rest(vm, pc + 4);
+        return 1;
+    }
+    return 0;
+}
+
+// CODE EMISSION
+static void emit8(struct EMIT *e, uint8_t byte) {
+    if(e->pos < e->cap) {
+        e->code[e->pos] = byte;
+    }
+    e->pos++;
+}
+
+static void emit32(struct EMIT *e, uint32_t val) {
+    for(int i = 0 ; i < 4 ; i++) {
+        emit8(e, extract_bits(val, (8*(i+1))-1, 8*i));
+    }
+}
+
+static void emit64(struct EMIT *e, uint64_t val) {
+    emit32(e, (uint32_t) val);
+    emit32(e, (uint32_t) (val >> 32));
+}
+
+// <opcode> r32, [rbx + 4*guest]
+static void emit_reg_mem(struct EMIT *e, uint8_t opcode, int host, uint8_t guest) {
+    emit8(e, opcode);
+    emit8(e, 0x80 | (host << 3) | 3);
+    emit32(e, guest * 4);
+}
+
+static void load_guest(struct EMIT *e, int host, uint8_t guest) {
+    emit_reg_mem(e, 0x8b, host, guest);
+}
+
+static void store_guest(struct EMIT *e, int host, uint8_t guest) {
+    emit_reg_mem(e, 0x89, host, guest);
+}
+
+// mov dword [rbx + 4*guest], imm32
+static void store_guest_imm(struct EMIT *e, uint8_t guest, uint32_t imm) {
+    emit8(e, 0xc7);
+    emit8(e, 0x83);
+    emit32(e, guest * 4);
+    emit32(e, imm);
+}
+
+// setcc al; movzx eax, al
+static void emit_setcc(struct EMIT *e, uint8_t cc) {
+    emit8(e, 0x0f);
+    emit8(e, 0x90 | cc);
+    emit8(e, 0xc0);
+    emit8(e, 0x0f);
+    emit8(e, 0xb6);
+    emit8(e, 0xc0);
+}
+
+// jcc rel32 with the target patched later, returns the offset just after it
+static size_t emit_jcc(struct EMIT *e, uint8_t cc) {
+    emit8(e, 0x0f);
+    emit8(e, 0x80 | cc);
+    emit32(e, 0);
+    return e->pos;
+}
+
+static void patch_rel32(struct EMIT *e, size_t after, size_t target) {
+    if(after > e->cap) {
+        return;
+    }
+    uint32_t rel = (uint32_t) (target - after);
+    memcpy(&e->code[after-4], &rel, 4);
+}
+
+static void emit_prologue(struct EMIT *e) {
+    emit8(e, 0x53);                                             // push rbx
+    emit8(e, 0x41); emit8(e, 0x54);                             // push r12
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xec); emit8(e, 0x08);    // sub rsp, 8
+    emit8(e, 0x48); emit8(e, 0x89); emit8(e, 0xfb);             // mov rbx, rdi
+    emit8(e, 0x49); emit8(e, 0x89); emit8(e, 0xf4);             // mov r12, rsi
+}
+
+// return to the dispatcher with the next guest PC in eax
+static void emit_exit(struct EMIT *e) {
+    emit8(e, 0x48); emit8(e, 0x83); emit8(e, 0xc4); emit8(e, 0x08);    // add rsp, 8
+    emit8(e, 0x41); emit8(e, 0x5c);                             // pop r12
+    emit8(e, 0x5b);                                             // pop rbx
+    emit8(e, 0xc3);                                             // ret
+}
+
+static void emit_exit_pc(struct EMIT *e, uint32_t pc) {
+    emit8(e, 0xb8);                                             // mov eax, pc
+    emit32(e, pc);
+    emit_exit(e);
+}
+
+// helper(vm, inst, pc), result in eax
+static void emit_call(struct EMIT *e, void *helper, struct DECODED *inst, uint32_t pc) {
+    emit8(e, 0x4c); emit8(e, 0x89); emit8(e, 0xe7);             // mov rdi, r12
+    emit8(e, 0x48); emit8(e, 0xbe); emit64(e, (uintptr_t) inst);    // mov rsi, inst
+    emit8(e, 0xba); emit32(e, pc);                              // mov edx, pc
+    emit8(e, 0x48); emit8(e, 0xb8); emit64(e, (uintptr_t) helper);  // mov rax, helper
+    emit8(e, 0xff); emit8(e, 0xd0);                             // call rax
+}
+
+// jump back to the top of a block that loops on itself, one limit tick per iteration; when
+// the ticks run out leave with the count back at 1, so the dispatcher's own tick runs limit_check
+static void emit_loop_back(struct EMIT *e, struct BLOCK *block, size_t loop_start) {
+    emit8(e, 0x41); emit8(e, 0xff); emit8(e, 0x8c); emit8(e, 0x24);    // dec dword [r12 + countdown]
+    emit32(e, offsetof(struct VM, limit_countdown));
+    patch_rel32(e, emit_jcc(e, CC_NE), loop_start);
+    emit8(e, 0x41); emit8(e, 0xff); emit8(e, 0x84); emit8(e, 0x24);    // inc dword [r12 + countdown]
+    emit32(e, offsetof(struct VM, limit_countdown));
+    emit_exit_pc(e, block->start_pc);
+}
+
+// conditional exit: taken goes to taken_pc (or loops in place), otherwise fall_pc
+static void emit_branch(struct EMIT *e, struct BLOCK *block, struct DECODED *inst, uint8_t cc, size_t loop_start) {
+    load_guest(e, EAX, inst->rs1);
+    emit_reg_mem(e, 0x3b, EAX, inst->rs2);                      // cmp eax, rs2
+    if(block->taken_pc == block->start_pc) {
+        size_t taken = emit_jcc(e, cc);
+        emit_exit_pc(e, block->fall_pc);
+        patch_rel32(e, taken, e->pos);
+        emit_loop_back(e, block, loop_start);
+        return;
+    }
+    size_t taken = emit_jcc(e, cc);
+    emit_exit_pc(e, block->fall_pc);
+    patch_rel32(e, taken, e->pos);
+    emit_exit_pc(e, block->taken_pc);
+}
+
+// emit the whole block, returns the code size (may exceed e->cap)
+static size_t jit_emit_block(struct EMIT *e, struct BLOCK *block) {
+    emit_prologue(e);
+    size_t loop_start = e->pos;
+    // count every entry, including the ones that loop back inside the translation
+    emit8(e, 0x48); emit8(e, 0xb8); emit64(e, (uintptr_t) &block->exec_count);   // mov rax, &count
+    emit8(e, 0x48); emit8(e, 0xff); emit8(e, 0x00);             // inc qword [rax]
+
+    for(int i = 0 ; i < block->len ; i++) {
+        struct DECODED *inst = &block->code[i];
+        uint32_t pc = (block->start_pc + i*4) & 0xffff;
+        size_t skip;
+        switch(inst->op) {
+            // arithmetic and logic operations
+            case OP_ADD:
+            case OP_SUB:
+            case OP_XOR:
+            case OP_OR:
+            case OP_AND:
+                load_guest(e, EAX, inst->rs1);
+                emit_reg_mem(e, inst->op == OP_ADD ? 0x03 : inst->op == OP_SUB ? 0x2b :
+                    inst->op == OP_XOR ? 0x33 : inst->op == OP_OR ? 0x0b : 0x23, EAX, inst->rs2);
+                store_guest(e, EAX, inst->rd);
+                break;
+            case OP_ADDI:
+            case OP_XORI:
+            case OP_ORI:
+            case OP_ANDI:
+                load_guest(e, EAX, inst->rs1);
+                emit8(e, inst->op == OP_ADDI ? 0x05 : inst->op == OP_XORI ? 0x35 :
+                    inst->op == OP_ORI ? 0x0d : 0x25);              // <op> eax, imm32
+                emit32(e, inst->imm);
+                store_guest(e, EAX, inst->rd);
+                break;
+            case OP_LUI:
+                store_guest_imm(e, inst->rd, inst->imm);
+                break;
+            case OP_SLL:
+            case OP_SRL:
+            case OP_SRA:
+                // x86 masks the count to 5 bits just like the handlers do
+                load_guest(e, EAX, inst->rs1);
+                load_guest(e, ECX, inst->rs2);
+                emit8(e, 0xd3);
+                emit8(e, inst->op == OP_SLL ? 0xe0 : inst->op == OP_SRL ? 0xe8 : 0xf8);
+                store_guest(e, EAX, inst->rd);
+                break;
+            case OP_SLT:
+            case OP_SLTU:
+                load_guest(e, EAX, inst->rs1);
+                emit_reg_mem(e, 0x3b, EAX, inst->rs2);
+                emit_setcc(e, inst->op == OP_SLT ? CC_L : CC_B);
+                store_guest(e, EAX, inst->rd);
+                break;
+            case OP_SLTI:
+            case OP_SLTIU:
+                load_guest(e, EAX, inst->rs1);
+                emit8(e, 0x3d);                                     // cmp eax, imm32
+                emit32(e, inst->imm);
+                emit_setcc(e, inst->op == OP_SLTI ? CC_L : CC_B);
+                store_guest(e, EAX, inst->rd);
+                break;
+
+            // memory access operations go through the helpers
+            case OP_LB:
+            case OP_LH:
+            case OP_LW:
+            case OP_LBU:
+            case OP_LHU:
+                emit_call(e, (void *) jit_load, inst, pc);
+                store_guest(e, EAX, inst->rd);
+                break;
+            case OP_SB:
+            case OP_SH:
+            case OP_SW:
+                emit_call(e, (void *) jit_store, inst, pc);
+                emit8(e, 0x85); emit8(e, 0xc0);                     // test eax, eax
+                skip = emit_jcc(e, CC_E);
+                emit_exit_pc(e, (pc + 4) & 0xffff);
+                patch_rel32(e, skip, e->pos);
+                break;
+
+            // program flow operations
+            case OP_BEQ:
+                emit_branch(e, block, inst, CC_E, loop_start);
+                break;
+            case OP_BNE:
+                emit_branch(e, block, inst, CC_NE, loop_start);
+                break;
+            case OP_BLT:
+                emit_branch(e, block, inst, CC_L, loop_start);
+                break;
+            case OP_BGE:
+                emit_branch(e, block, inst, CC_GE, loop_start);
+                break;
+            case OP_BLTU:
+                emit_branch(e, block, inst, CC_B, loop_start);
+                break;
+            case OP_BGEU:
+                emit_branch(e, block, inst, CC_AE, loop_start);
+                break;
+            case OP_JAL:
+                store_guest_imm(e, inst->rd, pc + 4);
+                if(block->taken_pc == block->start_pc) {
+                    emit_loop_back(e, block, loop_start);
+                }
+                else {
+                    emit_exit_pc(e, block->taken_pc);
+                }
+                break;
+            case OP_JALR:
+                // target is computed before rd is written, they may be the same register
+                load_guest(e, EAX, inst->rs1);
+                emit8(e, 0x05); emit32(e, inst->imm);               // add eax, imm
+                emit8(e, 0x25); emit32(e, 0xfffe);                  // and eax, 0xfffe
+                store_guest_imm(e, inst->rd, pc + 4);
+                emit_exit(e);
+                break;
+        }
+    }
+
+    // block stopped before the next leader
+    if(!is_block_end(block->code[block->len-1].op)) {
+        emit_exit_pc(e, block->fall_pc);
+    }
+    return e->pos;
+}
+
+// drop every translation, the blocks fall back to the interpreter until they are hot again
+static void jit_reset(struct JIT *jit, struct VM *vm) {
+    for(int i = 0 ; i < INST_MEM_SIZE/4 ; i++) {
+        vm->blocks.blocks[i].native = NULL;
+    }
+    jit->used = 0;
+    jit->flush_count = vm->blocks.flush_count;
+}
+
+static void jit_compile(struct JIT *jit, struct VM *vm, struct BLOCK *block) {
+    for(int i = 0 ; i < block->len ; i++) {
+        // loop heads stay with the block interpreter, which runs the loop whole (idiom.h)
+        if(block->code[i].op == OP_INVALID || block->code[i].op == OP_IDIOM) {
+            block->no_jit = 1;
+            return;
+        }
+    }
+
+    for(int attempt = 0 ; attempt < 2 ; attempt++) {
+        struct EMIT e = { jit->buf + jit->used, 0, JIT_BUFFER_SIZE - jit->used };
+        // buffer is never writable and executable at the same time
+        if(mprotect(jit->buf, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE) != 0) {
+            break;
+        }
+        size_t size = jit_emit_block(&e, block);
+        if(mprotect(jit->buf, JIT_BUFFER_SIZE, PROT_READ | PROT_EXEC) != 0) {
+            break;
+        }
+        if(size <= e.cap) {
+            block->native = jit->buf + jit->used;
+            jit->used += (size + 15) & ~(size_t) 15;
+            return;
+        }
+        jit_reset(jit, vm);
+    }
+    block->no_jit = 1;
+}
+
+// follow the edge the translation left through, reusing the interpreter's successor pointers
+static struct BLOCK *jit_next_block(struct VM *vm, struct BLOCK *block, uint32_t next) {
+    if(vm->code_gen == vm->blocks.code_gen) {
+        if(block->taken != NULL && block->taken_pc == next) {
+            return block->taken;
+        }
+        if(block->fallthrough != NULL && block->fall_pc == next) {
+            return block->fallthrough;
+        }
+    }
+    struct BLOCK *found = block_lookup(vm, next);
+    if(found != NULL && block->built) {
+        if(block->code[block->len-1].op == OP_JALR) {
+            block->taken_pc = next;
+        }
+        if(block->taken_pc == next) {
+            block->taken = found;
+        }
+        else if(block->fall_pc == next) {
+            block->fallthrough = found;
+        }
+    }
+    return found;
+}
+
+int jit_available(void) {
+    return 1;
+}
+
+// JIT ENGINE (jit.h)
+// interpret blocks until they are hot, then run their x86-64 translation
+// the buffer belongs to the vm and outlives a run, so blocks stay translated across
+// runs until the block cache is flushed; 0 if it cannot be mapped
+static int jit_prepare(struct VM *vm) {
+    if(vm->jit.buf == NULL) {
+        void *buf = mmap(NULL, JIT_BUFFER_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(buf == MAP_FAILED) {
+            return 0;
+        }
+        vm->jit.buf = buf;
+        jit_reset(&vm->jit, vm);
+    }
+    return 1;
+}
+
+void run_jit(struct VM *vm) {
+    if(!jit_prepare(vm)) {
+        run_blocks(vm, UINT64_MAX);
+        return;
+    }
+    struct JIT *jit = &vm->jit;
+    struct BLOCK *block = block_lookup(vm, vm->PC);
+    while(block != NULL) {
+        if(jit->flush_count != vm->blocks.flush_count) {
+            jit_reset(jit, vm);
+        }
+        if(block->native == NULL && !block->no_jit && block->exec_count >= JIT_THRESHOLD) {
+            jit_compile(jit, vm, block);
+        }
+        if(block->native != NULL) {
+            LIMIT_TICK(vm, block->start_pc);
+            vm->cur_block = block;
+            vm->PC = ((jit_fn) block->native)(vm->registers, vm);
+            block = jit_next_block(vm, block, vm->PC);
+            continue;
+        }
+        run_blocks(vm, JIT_THRESHOLD);
+        block = block_lookup(vm, vm->PC);
+    }
+}
+
+// one translated block, or the interpreter up to the next block entry
+void jit_step(struct VM *vm) {
+    struct BLOCK *block = block_lookup(vm, vm->PC);
+    if(block == NULL) {
+        return;
+    }
+    if(!jit_prepare(vm)) {
+        run_blocks(vm, 0);
+        return;
+    }
+    if(vm->jit.flush_count != vm->blocks.flush_count) {
+        jit_reset(&vm->jit, vm);
+    }
+    if(block->native == NULL && !block->no_jit && block->exec_count >= JIT_THRESHOLD) {
+        jit_compile(&vm->jit, vm, block);
+    }
+    if(block->native != NULL) {
+        vm->cur_block = block;
+        vm->PC = ((jit_fn) block->native)(vm->registers, vm);
+        return;
+    }
+    run_blocks(vm, 0);
+}
+
+void jit_release(struct VM *vm) {
+    if(vm->jit.buf != NULL) {
+        munmap(vm->jit.buf, JIT_BUFFER_SIZE);
+        vm->jit.buf = NULL;
+    }
+}
+
+#else
+
+int jit_available(void) {
+    return 0;
+}
+
+// no native backend for this host, the block interpreter runs everything
+void run_jit(struct VM *vm) {
+    run_blocks(vm, UINT64_MAX);
+}
+
+void jit_step(struct VM *vm) {
+    run_blocks(vm, 0);
+}
+
+void jit_release(struct VM *vm) {
+}
+
+#endif
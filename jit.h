@@ -0,0 +1,18 @@
+#ifndef JIT_H_
+#define JIT_H_
+#include "structs_enums.h"
+
+#define JIT_THRESHOLD 32        // block entries before it is translated
+#define JIT_BUFFER_SIZE (1 << 20)
+
+int jit_available(void);
+
+void run_jit(struct VM *vm);
+
+// run one block (natively once it is hot) and return with vm->PC at the next one
+void jit_step(struct VM *vm);
+
+// unmap the vm's translation buffer
+void jit_release(struct VM *vm);
+
+#endif
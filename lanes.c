@@ -0,0 +1,481 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <setjmp.h>
+#include <time.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+#include "decode.h"
+#include "memory.h"
+#include "interp.h"
+#include "exec_helpers.h"
+
+// LANE ENGINE
+// vms loaded with the same instruction memory run as one gang, their registers and pcs kept
+// structure-of-arrays: a register is one vector holding that register of every lane, so an
+// alu instruction is a few vector operations for all of them. Each pick runs the lanes at the
+// lowest pc together through straight-line code to the next branch or jump, the rest masked
+// off until their pc is the lowest (min-pc reconvergence, divergent lanes meet again where the
+// paths join). Loads and stores go lane by lane to each vm's own memory; a virtual routine or
+// anything off the direct pages is that one instruction on the lane's own threaded variant,
+// and a lane that leaves the common path for good (a store into instruction memory, a pc
+// outside it, close to its limits) finishes on the scalar engine
+
+typedef uint32_t lanes_u __attribute__((vector_size(LANES_MAX * 4)));
+typedef int32_t lanes_s __attribute__((vector_size(LANES_MAX * 4)));
+
+#define LANE_DONE 0xffffffffu   // pc of a lane no longer in the gang, never the lowest
+#define LANE_RUN (1u << 16)     // instructions one pick may run
+
+struct GANG {
+    lanes_u reg[33];    // x0-x31 and the x0 write sink, like vm->registers
+    lanes_u pc;
+    uint64_t count[LANES_MAX];  // instructions each lane has run, less those of the current pick
+    struct VM *vms[LANES_MAX];
+    int *status[LANES_MAX];
+    uint32_t live;      // lanes still in the gang
+    enum ENGINE engine;     // where lanes that leave finish
+    uint64_t budget;    // a lane this close to its instruction limit finishes on the engine
+    uint64_t deadline_ns;
+    struct DECODED decoded[INST_MEM_SIZE/4];    // plain decode, no idiom heads
+};
+
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// LANE STATE
+static void lane_to_vm(struct GANG *g, int lane) {
+    struct VM *vm = g->vms[lane];
+    for(int i = 0 ; i < 33 ; i++) {
+        vm->registers[i] = g->reg[i][lane];
+    }
+    vm->PC = g->pc[lane];
+    vm->insn_count = g->count[lane];
+    vm->cur_block = NULL;
+}
+
+static void lane_from_vm(struct GANG *g, int lane) {
+    struct VM *vm = g->vms[lane];
+    for(int i = 0 ; i < 33 ; i++) {
+        g->reg[i][lane] = vm->registers[i];
+    }
+    g->pc[lane] = vm->PC;
+    g->count[lane] = vm->insn_count;
+}
+
+static void lane_leave(struct GANG *g, int lane, int status) {
+    *g->status[lane] = status;
+    g->live &= ~(1u << lane);
+    g->pc[lane] = LANE_DONE;
+}
+
+// the rest of the lane's program on the scalar engine, its deadline the one it had in the gang
+static void lane_finish(struct GANG *g, int lane) {
+    struct VM *vm = g->vms[lane];
+    lane_to_vm(g, lane);
+    uint64_t timeout_ns = vm->timeout_ns;
+    if(g->deadline_ns != 0) {
+        uint64_t now = monotonic_ns();
+        vm->timeout_ns = now < g->deadline_ns ? g->deadline_ns - now : 1;
+    }
+    int status = vm_run(vm, g->engine);
+    vm->timeout_ns = timeout_ns;
+    lane_leave(g, lane, status);
+}
+
+static int step_one(struct VM *vm) {
+    int status = setjmp(vm->exit_jmp);
+    if(status != 0) {
+        return status;
+    }
+    run_threaded_steps(vm, 1);
+    return VM_OK;
+}
+
+// the instruction at the lane's pc on its own vm, 0 if the lane left the gang doing it
+static int lane_step(struct GANG *g, int lane) {
+    struct VM *vm = g->vms[lane];
+    lane_to_vm(g, lane);
+    uint32_t code_gen = vm->code_gen;
+    int status = step_one(vm);
+    if(status != VM_OK) {
+        lane_leave(g, lane, status);
+        return 0;
+    }
+    lane_from_vm(g, lane);
+    // its instruction memory is no longer the one the gang decoded
+    if(vm->code_gen != code_gen) {
+        lane_finish(g, lane);
+        return 0;
+    }
+    return 1;
+}
+
+// a load or store of a lane that is not direct, done by lane_step in the middle of a pick that
+// has run n instructions so far; 1 if the lane goes on with the rest of the pick
+static int lane_slow(struct GANG *g, int lane, uint32_t pc, uint32_t n) {
+    g->pc[lane] = pc;
+    g->count[lane] += n;
+    if(!lane_step(g, lane) || g->pc[lane] != pc + 4) {
+        return 0;
+    }
+    // the end of the pick counts this one and the ones before it again
+    g->count[lane] -= n + 1;
+    return 1;
+}
+
+// GANG
+// the lower value of each lane
+#define LANES_MIN2(a, b) ((((b) < (a)) & (b)) | (~((b) < (a)) & (a)))
+
+// lowest value of any lane; vectors go by address, as arguments their abi depends on the target
+static inline uint32_t lanes_min(const lanes_u *lanes) {
+    lanes_u v = *lanes;
+    lanes_u w = __builtin_shuffle(v, (lanes_u) { 8, 9, 10, 11, 12, 13, 14, 15, 0, 1, 2, 3, 4, 5, 6, 7 });
+    v = (lanes_u) LANES_MIN2(v, w);
+    w = __builtin_shuffle(v, (lanes_u) { 4, 5, 6, 7, 0, 1, 2, 3, 4, 5, 6, 7, 0, 1, 2, 3 });
+    v = (lanes_u) LANES_MIN2(v, w);
+    w = __builtin_shuffle(v, (lanes_u) { 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1, 2, 3, 0, 1 });
+    v = (lanes_u) LANES_MIN2(v, w);
+    w = __builtin_shuffle(v, (lanes_u) { 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0, 1, 0 });
+    v = (lanes_u) LANES_MIN2(v, w);
+    return v[0];
+}
+
+static inline int lanes_zero(const lanes_u *lanes) {
+    uint64_t words[LANES_MAX / 2];
+    memcpy(words, lanes, sizeof(lanes_u));
+    uint64_t any = 0;
+    for(int i = 0 ; i < LANES_MAX / 2 ; i++) {
+        any |= words[i];
+    }
+    return any == 0;
+}
+
+static void gang_run(struct GANG *g) {
+    static void *labels[OP_NUM] = {
+        [OP_ADD] = &&do_ADD,     [OP_ADDI] = &&do_ADDI,   [OP_SUB] = &&do_SUB,     [OP_LUI] = &&do_LUI,
+        [OP_XOR] = &&do_XOR,     [OP_XORI] = &&do_XORI,   [OP_OR] = &&do_OR,       [OP_ORI] = &&do_ORI,
+        [OP_AND] = &&do_AND,     [OP_ANDI] = &&do_ANDI,   [OP_SLL] = &&do_SLL,     [OP_SRL] = &&do_SRL,
+        [OP_SRA] = &&do_SRA,     [OP_LB] = &&do_LB,       [OP_LH] = &&do_LH,       [OP_LW] = &&do_LW,
+        [OP_LBU] = &&do_LBU,     [OP_LHU] = &&do_LHU,     [OP_SB] = &&do_SB,       [OP_SH] = &&do_SH,
+        [OP_SW] = &&do_SW,       [OP_SLT] = &&do_SLT,     [OP_SLTI] = &&do_SLTI,   [OP_SLTU] = &&do_SLTU,
+        [OP_SLTIU] = &&do_SLTIU, [OP_BEQ] = &&do_BEQ,     [OP_BNE] = &&do_BNE,     [OP_BLT] = &&do_BLT,
+        [OP_BLTU] = &&do_BLTU,   [OP_BGE] = &&do_BGE,     [OP_BGEU] = &&do_BGEU,   [OP_JAL] = &&do_JAL,
+        [OP_JALR] = &&do_JALR,   [OP_IDIOM] = &&do_SCALAR, [OP_INVALID] = &&do_SCALAR
+    };
+    const lanes_u lane_bit = { 1 << 0, 1 << 1, 1 << 2, 1 << 3, 1 << 4, 1 << 5, 1 << 6, 1 << 7,
+        1 << 8, 1 << 9, 1 << 10, 1 << 11, 1 << 12, 1 << 13, 1 << 14, 1 << 15 };
+    lanes_u *reg = g->reg;
+    uint32_t ticks = LIMIT_POLL_TICKS;
+    while(g->live != 0) {
+        if(ticks == 0) {
+            ticks = LIMIT_POLL_TICKS;
+            if(g->deadline_ns != 0 && monotonic_ns() >= g->deadline_ns) {
+                for(int lane = 0 ; lane < LANES_MAX ; lane++) {
+                    if(g->live & (1u << lane)) {
+                        lane_finish(g, lane);
+                    }
+                }
+                return;
+            }
+        }
+        // lanes no longer in the gang are at LANE_DONE, so never the lowest
+        uint32_t pc = lanes_min(&g->pc);
+        lanes_u m = (lanes_u) (g->pc == pc);
+        // the pick may go on through a jump that is the same for all its lanes as long as no
+        // other lane is waiting at or before where it goes
+        lanes_u waiting = g->pc | m;
+        uint32_t others = lanes_min(&waiting);
+        uint32_t on = 0;
+        for(int lane = 0 ; lane < LANES_MAX ; lane++) {
+            on |= g->pc[lane] == pc ? 1u << lane : 0;
+        }
+        // the engine has the exact behaviour for a pc it cannot run
+        if(pc >= INST_MEM_SIZE || (pc & 3) != 0) {
+            for(int lane = 0 ; lane < LANES_MAX ; lane++) {
+                if(on & (1u << lane)) {
+                    lane_finish(g, lane);
+                }
+            }
+            continue;
+        }
+        uint32_t n = 0;
+        struct DECODED *inst = &g->decoded[pc / 4];
+        uint32_t value;
+        goto *labels[inst->op];
+
+// the masked lanes get value, the others keep what they had
+#define SET(rd, value) reg[rd] = ((value) & m) | (reg[rd] & ~m)
+#define NEXT() { \
+        n++; \
+        pc += 4; \
+        if(pc >= INST_MEM_SIZE) { \
+            goto fell_off; \
+        } \
+        inst++; \
+        goto *labels[inst->op]; \
+    }
+#define EACH_LANE(lane) for(int lane = 0 ; lane < LANES_MAX ; lane++) if(on & (1u << lane))
+// a lane whose access is not direct takes its one step, and drops out of the pick if it left
+#define SLOW(lane) { \
+        if(!lane_slow(g, lane, pc, n)) { \
+            on &= ~(1u << lane); \
+            m = (lanes_u) ((lane_bit & on) != 0); \
+        } \
+    }
+#define LOAD(num_bytes, extend) { \
+        EACH_LANE(lane) { \
+            if(mem_load_direct(g->vms[lane], reg[inst->rs1][lane] + inst->imm, num_bytes, &value)) { \
+                reg[inst->rd][lane] = extend; \
+            } \
+            else SLOW(lane) \
+        } \
+        if(on == 0) { \
+            continue; \
+        } \
+        NEXT(); \
+    }
+#define STORE(num_bytes) { \
+        EACH_LANE(lane) { \
+            if(!mem_store_direct(g->vms[lane], reg[inst->rs1][lane] + inst->imm, reg[inst->rs2][lane], num_bytes)) \
+                SLOW(lane) \
+        } \
+        if(on == 0) { \
+            continue; \
+        } \
+        NEXT(); \
+    }
+// every masked lane goes to target, a vector of pcs, and the pick ends
+#define JUMP(target) { \
+        g->pc = ((target) & m) | (g->pc & ~m); \
+        n++; \
+        goto end_pick; \
+    }
+// all masked lanes go to target: keep going there unless the gang has to be picked again
+#define FOLLOW(target) { \
+        uint32_t next = (target); \
+        if(next < others && next < INST_MEM_SIZE && (next & 3) == 0 && n < LANE_RUN && --ticks != 0) { \
+            n++; \
+            pc = next; \
+            inst = &g->decoded[pc / 4]; \
+            goto *labels[inst->op]; \
+        } \
+        JUMP((lanes_u) {0} + next); \
+    }
+#define BRANCH(taken) { \
+        lanes_u t = (lanes_u) (taken) & m; \
+        lanes_u not_taken = t ^ m; \
+        if(lanes_zero(&t)) { \
+            FOLLOW(pc + 4); \
+        } \
+        if(lanes_zero(&not_taken)) { \
+            FOLLOW((pc + inst->imm) & 0xffff); \
+        } \
+        JUMP((t & ((pc + inst->imm) & 0xffff)) | (~t & (pc + 4))); \
+    }
+
+    // arithmetic and logic operations
+    do_ADD:
+        SET(inst->rd, reg[inst->rs1] + reg[inst->rs2]);
+        NEXT();
+    do_ADDI:
+        SET(inst->rd, reg[inst->rs1] + (uint32_t) inst->imm);
+        NEXT();
+    do_SUB:
+        SET(inst->rd, reg[inst->rs1] - reg[inst->rs2]);
+        NEXT();
+    do_LUI:
+        SET(inst->rd, (lanes_u) {0} + (uint32_t) inst->imm);
+        NEXT();
+    do_XOR:
+        SET(inst->rd, reg[inst->rs1] ^ reg[inst->rs2]);
+        NEXT();
+    do_XORI:
+        SET(inst->rd, reg[inst->rs1] ^ (uint32_t) inst->imm);
+        NEXT();
+    do_OR:
+        SET(inst->rd, reg[inst->rs1] | reg[inst->rs2]);
+        NEXT();
+    do_ORI:
+        SET(inst->rd, reg[inst->rs1] | (uint32_t) inst->imm);
+        NEXT();
+    do_AND:
+        SET(inst->rd, reg[inst->rs1] & reg[inst->rs2]);
+        NEXT();
+    do_ANDI:
+        SET(inst->rd, reg[inst->rs1] & (uint32_t) inst->imm);
+        NEXT();
+    do_SLL:
+        SET(inst->rd, reg[inst->rs1] << (reg[inst->rs2] & 0x1f));
+        NEXT();
+    do_SRL:
+        SET(inst->rd, reg[inst->rs1] >> (reg[inst->rs2] & 0x1f));
+        NEXT();
+    do_SRA:
+        SET(inst->rd, (lanes_u) ((lanes_s) reg[inst->rs1] >> (lanes_s) (reg[inst->rs2] & 0x1f)));
+        NEXT();
+
+    // memory access operations
+    do_LB:
+        LOAD(1, (uint32_t) (int32_t) (int8_t) value);
+    do_LH:
+        LOAD(2, (uint32_t) (int32_t) (int16_t) value);
+    do_LW:
+        LOAD(4, value);
+    do_LBU:
+        LOAD(1, value);
+    do_LHU:
+        LOAD(2, value);
+    do_SB:
+        STORE(1);
+    do_SH:
+        STORE(2);
+    do_SW:
+        STORE(4);
+
+    // program flow operations, comparisons are -1 per true lane
+    do_SLT:
+        SET(inst->rd, (lanes_u) ((lanes_s) reg[inst->rs1] < (lanes_s) reg[inst->rs2]) & 1);
+        NEXT();
+    do_SLTI:
+        SET(inst->rd, (lanes_u) ((lanes_s) reg[inst->rs1] < inst->imm) & 1);
+        NEXT();
+    do_SLTU:
+        SET(inst->rd, (lanes_u) (reg[inst->rs1] < reg[inst->rs2]) & 1);
+        NEXT();
+    do_SLTIU:
+        SET(inst->rd, (lanes_u) (reg[inst->rs1] < (uint32_t) inst->imm) & 1);
+        NEXT();
+    do_BEQ:
+        BRANCH(reg[inst->rs1] == reg[inst->rs2]);
+    do_BNE:
+        BRANCH(reg[inst->rs1] != reg[inst->rs2]);
+    do_BLT:
+        BRANCH((lanes_s) reg[inst->rs1] < (lanes_s) reg[inst->rs2]);
+    do_BLTU:
+        BRANCH(reg[inst->rs1] < reg[inst->rs2]);
+    do_BGE:
+        BRANCH((lanes_s) reg[inst->rs1] >= (lanes_s) reg[inst->rs2]);
+    do_BGEU:
+        BRANCH(reg[inst->rs1] >= reg[inst->rs2]);
+    do_JAL:
+        SET(inst->rd, (lanes_u) {0} + (pc + 4));
+        FOLLOW((pc + inst->imm) & 0xffff);
+    do_JALR: {
+        lanes_u target = ((reg[inst->rs1] + (uint32_t) inst->imm) & ~1u) & 0xffff;
+        SET(inst->rd, (lanes_u) {0} + (pc + 4));
+        // returns of lanes that called from the same place
+        uint32_t first = target[__builtin_ctz(on)];
+        lanes_u other = (target ^ first) & m;
+        if(lanes_zero(&other)) {
+            FOLLOW(first);
+        }
+        JUMP(target);
+    }
+
+    // what does not decode, the lanes' own engine reports it
+    do_SCALAR:
+        EACH_LANE(lane) {
+            g->pc[lane] = pc;
+            g->count[lane] += n;
+            lane_step(g, lane);
+        }
+        continue;
+
+    fell_off:
+        g->pc = (((lanes_u) {0} + pc) & m) | (g->pc & ~m);
+    end_pick:
+        // a pick runs at most LANE_RUN instructions and all of instruction memory, so a lane
+        // under its budget cannot overrun its limit in the next one
+        EACH_LANE(lane) {
+            g->count[lane] += n;
+            if(g->count[lane] >= g->budget) {
+                lane_finish(g, lane);
+            }
+        }
+        if(ticks > 0) {
+            ticks--;
+        }
+    }
+#undef SET
+#undef NEXT
+#undef EACH_LANE
+#undef SLOW
+#undef LOAD
+#undef STORE
+#undef JUMP
+#undef FOLLOW
+#undef BRANCH
+}
+
+// recording, suspending or still holding block counts, the vm runs on its own
+static int can_gang(struct VM *vm) {
+    return vm->trace == NULL && vm->profile == NULL && vm->sampler == NULL && vm->hw == NULL
+        && vm->yield_at == UINT64_MAX && vm_insn_count(vm) == vm->insn_count;
+}
+
+static int same_gang(struct VM *lead, struct VM *vm) {
+    return vm->insn_limit == lead->insn_limit && vm->timeout_ns == lead->timeout_ns
+        && memcmp(vm->inst_mem, lead->inst_mem, INST_MEM_SIZE) == 0;
+}
+
+// LIBRARY API (riskxvii.h)
+int vm_run_lanes(struct VM **vms, int num, enum ENGINE engine, int *status) {
+    struct GANG *g = aligned_alloc(sizeof(lanes_u), sizeof(struct GANG));
+    char *placed = calloc(num > 0 ? num : 1, 1);
+    if(g == NULL || placed == NULL) {
+        free(g);
+        free(placed);
+        return -1;
+    }
+    int ganged = 0;
+    // each gang is the first vm not yet run and the later ones that match it
+    for(int first = 0 ; first < num ; first++) {
+        if(placed[first]) {
+            continue;
+        }
+        struct VM *lead = vms[first];
+        memset(g, 0, sizeof(struct GANG));
+        g->engine = engine;
+        g->pc = (lanes_u) {0} + LANE_DONE;
+        int lanes = 0;
+        for(int i = first ; i < num && lanes < LANES_MAX && can_gang(lead) ; i++) {
+            if(placed[i] || !can_gang(vms[i]) || !same_gang(lead, vms[i])) {
+                continue;
+            }
+            placed[i] = 1;
+            g->vms[lanes] = vms[i];
+            g->status[lanes] = &status[i];
+            g->live |= 1u << lanes;
+            lane_from_vm(g, lanes);
+            lanes++;
+        }
+        if(lanes < 2) {
+            placed[first] = 1;
+            status[first] = vm_run(lead, engine);
+            continue;
+        }
+        for(int i = 0 ; i < INST_MEM_SIZE/4 ; i++) {
+            decode_line(inst_line(lead, i), &g->decoded[i]);
+        }
+        uint64_t margin = LANE_RUN + INST_MEM_SIZE/4;
+        g->budget = lead->insn_limit > margin ? lead->insn_limit - margin : 0;
+        g->deadline_ns = lead->timeout_ns != 0 ? monotonic_ns() + lead->timeout_ns : 0;
+        for(int lane = 0 ; lane < lanes ; lane++) {
+            if(g->count[lane] >= g->budget) {
+                lane_finish(g, lane);
+            }
+        }
+        gang_run(g);
+        ganged += lanes;
+    }
+    free(placed);
+    free(g);
+    return ganged;
+}
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+#include "heap.h"
+#include "largemem.h"
+
+// LARGE MEMORY PROFILE (largemem.h)
+void large_reset(struct VM *vm) {
+    if(vm->large_mem == NULL) {
+        return;
+    }
+    // reads as zero again, and only what the next run touches is committed
+    madvise(vm->large_mem, vm->large_span, MADV_DONTNEED);
+    memset(vm->large_heap, 0, sizeof(struct LARGE_HEAP));
+}
+
+void large_release(struct VM *vm) {
+    if(vm->large_mem != NULL) {
+        munmap(vm->large_mem, vm->large_span);
+    }
+    free(vm->large_heap);
+    vm->large_mem = NULL;
+    vm->large_span = 0;
+    vm->large_heap = NULL;
+}
+
+uint32_t large_malloc(struct VM *vm, uint32_t num_bytes) {
+    struct LARGE_HEAP *heap = vm->large_heap;
+    uint32_t num_banks = num_bytes == 0 ? 1 : (num_bytes - 1) / LARGE_HEAP_BANK_SIZE + 1;
+    int bank = num_bytes > LARGE_END - LARGE_HEAP_START ? -1
+            : first_fit(heap->used, LARGE_HEAP_BANK_NUM, num_banks);
+    if(bank < 0) {
+        return 0;
+    }
+    mark_banks(heap->used, bank, num_banks, 1);
+    heap->run_len[bank] = num_banks;
+    heap->banks_used += num_banks;
+    if(heap->banks_used > heap->peak_banks_used) {
+        heap->peak_banks_used = heap->banks_used;
+    }
+    return LARGE_HEAP_START + bank*LARGE_HEAP_BANK_SIZE;
+}
+
+int large_free(struct VM *vm, uint32_t ptr) {
+    struct LARGE_HEAP *heap = vm->large_heap;
+    uint32_t offset = ptr - LARGE_HEAP_START;
+    uint32_t bank = offset / LARGE_HEAP_BANK_SIZE;
+    if(ptr < LARGE_HEAP_START || offset % LARGE_HEAP_BANK_SIZE != 0 || bank >= LARGE_HEAP_BANK_NUM
+            || heap->run_len[bank] == 0) {
+        return 0;
+    }
+    uint32_t num_banks = heap->run_len[bank];
+    mark_banks(heap->used, bank, num_banks, 0);
+    heap->run_len[bank] = 0;
+    heap->banks_used -= num_banks;
+    // freed banks stop costing host memory, and read as zero until written again
+    madvise(vm->large_mem + (ptr - LARGE_START), num_banks * LARGE_HEAP_BANK_SIZE, MADV_DONTNEED);
+    return 1;
+}
+
+void large_print_stats(struct VM *vm, FILE *out) {
+    if(vm->large_mem == NULL) {
+        return;
+    }
+    struct LARGE_HEAP *heap = vm->large_heap;
+    fprintf(out, "large heap banks used: %u/%d (peak %u)\n", heap->banks_used, LARGE_HEAP_BANK_NUM,
+        heap->peak_banks_used);
+    fprintf(out, "large heap largest free run: %d banks\n", largest_free_run(heap->used, LARGE_HEAP_BANK_NUM));
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t num_pages = (vm->large_span + page_size - 1) / page_size;
+    unsigned char *resident = malloc(num_pages);
+    if(resident != NULL && mincore(vm->large_mem, vm->large_span, resident) == 0) {
+        size_t num_resident = 0;
+        for(size_t i = 0 ; i < num_pages ; i++) {
+            num_resident += resident[i] & 1;
+        }
+        fprintf(out, "large memory resident: %zu KiB of %u KiB\n", num_resident * page_size / 1024,
+            vm->large_span / 1024);
+    }
+    free(resident);
+}
+
+// LIBRARY API (riskxvii.h)
+int vm_set_memory(struct VM *vm, enum VM_MEMORY memory) {
+    if(memory == VM_MEMORY_SMALL || vm->large_mem != NULL) {
+        if(memory == VM_MEMORY_SMALL) {
+            large_release(vm);
+        }
+        return 0;
+    }
+    // address space only: MAP_NORESERVE keeps it out of the commit charge until touched
+    uint8_t *mem = mmap(NULL, LARGE_END - LARGE_START, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    struct LARGE_HEAP *heap = calloc(1, sizeof(struct LARGE_HEAP));
+    if(mem == MAP_FAILED || heap == NULL) {
+        if(mem != MAP_FAILED) {
+            munmap(mem, LARGE_END - LARGE_START);
+        }
+        free(heap);
+        return 1;
+    }
+    vm->large_mem = mem;
+    vm->large_span = LARGE_END - LARGE_START;
+    vm->large_heap = heap;
+    return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef LARGEMEM_H_
+#define LARGEMEM_H_
+#include <stdio.h>
+#include <stdint.h>
+#include "structs_enums.h"
+
+// LARGE MEMORY PROFILE (largemem.c)
+// LARGE_START..LARGE_END is one anonymous mapping reserved without swap, so the kernel only
+// commits the pages the guest touches; below LARGE_HEAP_START it is plain data, above it the
+// large heap that malloc falls back to once the small heap cannot serve a request
+struct LARGE_HEAP {
+    uint64_t used[LARGE_HEAP_BANK_NUM / 64];
+    uint32_t run_len[LARGE_HEAP_BANK_NUM];  // banks in the allocation starting here, 0 if none
+    uint32_t banks_used;
+    uint32_t peak_banks_used;
+};
+
+// back to all zeroes and an empty large heap, handing the touched pages back to the kernel
+void large_reset(struct VM *vm);
+
+// unmap the large space, the vm goes back to the small profile
+void large_release(struct VM *vm);
+
+// pointer to a fresh run of large heap banks, 0 if there is none
+uint32_t large_malloc(struct VM *vm, uint32_t num_bytes);
+
+// 0 if ptr does not start a large heap allocation
+int large_free(struct VM *vm, uint32_t ptr);
+
+void large_print_stats(struct VM *vm, FILE *out);
+
+// host byte behind a large profile address, NULL outside it and in the small profile
+static inline uint8_t *large_byte(struct VM *vm, uint32_t addr) {
+    if(addr - LARGE_START >= vm->large_span) {
+        return NULL;
+    }
+    return vm->large_mem + (addr - LARGE_START);
+}
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <setjmp.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+#include "interp.h"
+#include "blocks.h"
+#include "jit.h"
+#include "memory.h"
+#include "output.h"
+#include "lockstep.h"
+
+// one candidate step, or at most steps reference instructions; VM_OK while the program runs
+static int lockstep_step(struct VM *vm, enum ENGINE engine, uint64_t steps) {
+    int status = setjmp(vm->exit_jmp);
+    if(status != 0) {
+        return status;
+    }
+    switch(engine) {
+        case ENGINE_THREADED:
+            run_threaded_steps(vm, steps);
+            break;
+        case ENGINE_JIT:
+            jit_step(vm);
+            break;
+        default:
+            run_blocks(vm, 0);
+            break;
+    }
+    return VM_OK;
+}
+
+// FNV-1a over the pages either vm has stored to, plus instruction memory once it was rewritten
+static uint64_t memory_hash(struct VM *vm, uint64_t *dirty, int code_changed) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for(uint32_t index = 0 ; index < MEM_PAGES ; index++) {
+        if(!(dirty[index / 64] & (1ULL << (index % 64)))) {
+            continue;
+        }
+        uint8_t *bytes = (uint8_t *) vm + vm->pages[index].offset;
+        for(int i = 0 ; i < MEM_PAGE_SIZE ; i++) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+    }
+    for(int i = 0 ; code_changed && i < INST_MEM_SIZE ; i++) {
+        hash = (hash ^ vm->inst_mem[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+// dump_reg's format, on stderr so it cannot mix with the guest's output
+static void print_state(const char *role, const char *engine, struct VM *vm, int status, uint64_t hash) {
+    fprintf(stderr, "%s (%s): %s, memory hash 0x%016llx\n", role, engine, vm_status_name(status),
+        (unsigned long long) hash);
+    fprintf(stderr, "PC = 0x%08x;\n", vm->PC);
+    for(int i = 0 ; i < 32 ; i++) {
+        fprintf(stderr, "R[%d] = 0x%08x;\n", i, vm->registers[i]);
+    }
+}
+
+// first differing word of every dirty page the two vms disagree on
+static void print_memory_diff(struct VM *ref, struct VM *cand, uint64_t *dirty) {
+    for(uint32_t index = 0 ; index < MEM_PAGES ; index++) {
+        if(!(dirty[index / 64] & (1ULL << (index % 64)))) {
+            continue;
+        }
+        uint8_t *a = (uint8_t *) ref + ref->pages[index].offset;
+        uint8_t *b = (uint8_t *) cand + cand->pages[index].offset;
+        for(int i = 0 ; i < MEM_PAGE_SIZE ; i += 4) {
+            uint32_t va, vb;
+            memcpy(&va, a + i, 4);
+            memcpy(&vb, b + i, 4);
+            if(va != vb) {
+                fprintf(stderr, "M[0x%04x] = 0x%08x vs 0x%08x\n", (index << MEM_PAGE_BITS) + i, va, vb);
+                break;
+            }
+        }
+    }
+    if(memcmp(ref->inst_mem, cand->inst_mem, INST_MEM_SIZE) != 0) {
+        fprintf(stderr, "instruction memory differs\n");
+    }
+}
+
+// whole of stdin, both vms read the same input from their own copy
+static char *read_input(size_t *len) {
+    size_t cap = 4096;
+    char *buf = malloc(cap);
+    size_t got;
+    *len = 0;
+    while(buf != NULL && (got = fread(buf + *len, 1, cap - *len, stdin)) > 0) {
+        *len += got;
+        if(*len == cap) {
+            char *grown = realloc(buf, cap * 2);
+            if(grown == NULL) {
+                free(buf);
+            }
+            buf = grown;
+            cap *= 2;
+        }
+    }
+    return buf;
+}
+
+int run_lockstep(struct OPTIONS *opts) {
+    // an --input file is mapped by each vm on its own
+    size_t input_len = 0;
+    char *input = opts->input != NULL ? malloc(1) : read_input(&input_len);
+    struct VM *ref = vm_create();
+    struct VM *cand = vm_create();
+    FILE *ref_in = input != NULL ? fmemopen(input, input_len, "r") : NULL;
+    FILE *cand_in = input != NULL ? fmemopen(input, input_len, "r") : NULL;
+    if(input == NULL || ref == NULL || cand == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    if(vm_set_memory(ref, opts->memory) != 0 || vm_set_memory(cand, opts->memory) != 0) {
+        printf("Cannot reserve large memory\n");
+        exit(1);
+    }
+    // the candidate's output is the program's output, the reference's is dropped
+    vm_set_io(ref, input_len > 0 ? ref_in : NULL, -1, 0);
+    vm_set_io(cand, input_len > 0 ? cand_in : NULL, 1, 0);
+    if(opts->input != NULL && (vm_set_input(ref, opts->input) != 0 || vm_set_input(cand, opts->input) != 0)) {
+        printf("Cannot read input: %s\n", opts->input);
+        exit(1);
+    }
+
+    int ref_status = vm_load(ref, opts->filename);
+    int cand_status = ref_status == VM_OK ? vm_load(cand, opts->filename) : ref_status;
+    uint32_t ref_gen = ref->code_gen;
+    uint32_t cand_gen = cand->code_gen;
+    mem_track_dirty(ref, 1);
+    mem_track_dirty(cand, 1);
+
+    uint64_t steps = 0;
+    int diverged = 0;
+    // --max-insns checks just the start of a long run, the last step may go past it
+    uint64_t check_insns = opts->max_insns != 0 ? opts->max_insns : UINT64_MAX;
+    while(cand_status == VM_OK && vm_insn_count(cand) < check_insns) {
+        cand_status = lockstep_step(cand, opts->engine, 1);
+        uint64_t target = vm_insn_count(cand);
+        ref_status = lockstep_step(ref, ENGINE_THREADED, target - vm_insn_count(ref));
+        steps++;
+
+        uint64_t dirty[MEM_PAGES/64];
+        for(int i = 0 ; i < MEM_PAGES/64 ; i++) {
+            dirty[i] = ref->dirty[i] | cand->dirty[i];
+        }
+        int code_changed = ref->code_gen != ref_gen || cand->code_gen != cand_gen;
+        uint64_t ref_hash = memory_hash(ref, dirty, code_changed);
+        uint64_t cand_hash = memory_hash(cand, dirty, code_changed);
+        if(ref_status != cand_status || ref->PC != cand->PC || vm_insn_count(ref) != target
+                || memcmp(ref->registers, cand->registers, 32 * sizeof(uint32_t)) != 0
+                || ref_hash != cand_hash) {
+            fprintf(stderr, "lockstep: divergence after %llu instructions, step %llu\n",
+                (unsigned long long) target, (unsigned long long) steps);
+            print_state("reference", "threaded", ref, ref_status, ref_hash);
+            print_state("candidate", vm_engine_name(opts->engine), cand, cand_status, cand_hash);
+            print_memory_diff(ref, cand, dirty);
+            diverged = 1;
+            break;
+        }
+        if(cand->PC > 0x3ff) {
+            break;
+        }
+    }
+    out_flush(cand->out);
+    if(!diverged && cand_status != VM_LOAD_ERROR) {
+        fprintf(stderr, "lockstep: %llu instructions in %llu steps, no divergence\n",
+            (unsigned long long) vm_insn_count(cand), (unsigned long long) steps);
+    }
+    vm_destroy(ref);
+    vm_destroy(cand);
+    if(ref_in != NULL) {
+        fclose(ref_in);
+        fclose(cand_in);
+    }
+    free(input);
+    return !diverged && (cand_status == VM_OK || cand_status == VM_HALT) ? 0 : 1;
+}
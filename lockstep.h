@@ -0,0 +1,11 @@
+#ifndef LOCKSTEP_H_
+#define LOCKSTEP_H_
+#include "structs_enums.h"
+
+// LOCKSTEP RUNNER (lockstep.c)
+// runs the image on the threaded engine and on opts->engine side by side, comparing them
+// after every candidate block (every instruction for a threaded candidate); on the first
+// difference both states are dumped to stderr. 0 if they agreed and the program ended normally
+int run_lockstep(struct OPTIONS *opts);
+
+#endif
@@ -0,0 +1,112 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "structs_enums.h"
+#include "options.h"
+#include "heap.h"
+#include "riskxvii.h"
+#include "batch.h"
+#include "serve.h"
+#include "lockstep.h"
+#include "replay.h"
+#include "aot.h"
+
+int main(int argc, char *argv[]) {
+    struct OPTIONS opts;
+    if(parse_args(argc, argv, &opts) != 0) {
+        exit(1);
+    }
+    if(opts.batch != NULL) {
+        return run_batch(&opts);
+    }
+    if(opts.serve != NULL) {
+        return run_serve(&opts);
+    }
+    if(opts.lockstep) {
+        return run_lockstep(&opts);
+    }
+    if(opts.replay != NULL) {
+        return run_replay(&opts);
+    }
+    if(opts.aot) {
+        return run_aot(&opts);
+    }
+
+    struct VM *vm = vm_create();
+    if(vm == NULL) {
+        printf("Out of memory\n");
+        exit(1);
+    }
+    // guest output goes through the ring, drained to stdout by the writer thread
+    vm_set_io(vm, stdin, 1, 1);
+    vm_set_limits(vm, opts.max_insns, opts.timeout_ms);
+    if(vm_set_memory(vm, opts.memory) != 0) {
+        printf("Cannot reserve large memory\n");
+        vm_destroy(vm);
+        exit(1);
+    }
+    if(opts.input != NULL && vm_set_input(vm, opts.input) != 0) {
+        printf("Cannot read input: %s\n", opts.input);
+        vm_destroy(vm);
+        exit(1);
+    }
+
+    // --engine=traced or profiled on its own pays for the recording and keeps nothing
+    if(opts.engine == ENGINE_TRACED && opts.trace == NULL) {
+        opts.trace = "/dev/null";
+    }
+    // a profile runs on the profiled threaded variant whatever the engine
+    if((opts.profile != NULL || opts.engine == ENGINE_PROFILED) && vm_profile_start(vm) != 0) {
+        printf("Out of memory\n");
+        vm_destroy(vm);
+        exit(1);
+    }
+
+    // sampling runs on the blocks engine whatever the engine
+    if(opts.sample_profile != NULL && vm_sample_start(vm, opts.sample_hz) != 0) {
+        printf("Out of memory\n");
+        vm_destroy(vm);
+        exit(1);
+    }
+
+    if(opts.hwcounters && vm_hwcounters_start(vm) != 0) {
+        printf("Out of memory\n");
+        vm_destroy(vm);
+        exit(1);
+    }
+
+    int status = vm_load(vm, opts.filename);
+    if(status == VM_OK && opts.trace != NULL && vm_trace_start(vm, opts.trace) != 0) {
+        printf("Cannot write trace: %s\n", opts.trace);
+        status = VM_LOAD_ERROR;
+    }
+    if(status == VM_OK) {
+        status = vm_run(vm, opts.engine);
+        if(opts.trace != NULL) {
+            uint64_t recorded = vm_trace_stop(vm);
+            if(opts.stats) {
+                fprintf(stderr, "traced: %llu instructions\n", (unsigned long long) recorded);
+            }
+        }
+        if(opts.profile != NULL && vm_profile_write(vm, opts.profile) != 0) {
+            printf("Cannot write profile: %s\n", opts.profile);
+        }
+        if(opts.sample_profile != NULL && vm_sample_write(vm, opts.sample_profile) != 0) {
+            printf("Cannot write sample profile: %s\n", opts.sample_profile);
+        }
+        if(opts.stats) {
+            fprintf(stderr, "load time: %.1f us\n", vm->load_ns / 1e3);
+            fprintf(stderr, "run time: %.1f us\n", vm->run_ns / 1e3);
+            fprintf(stderr, "instructions: %llu\n", (unsigned long long) vm_insn_count(vm));
+            heap_print_stats(vm, stderr);
+        }
+        if(opts.hwcounters) {
+            vm_hwcounters_report(vm, stderr);
+        }
+    }
+    vm_destroy(vm);
+    if(status == VM_INSN_LIMIT || status == VM_TIMEOUT) {
+        return status == VM_INSN_LIMIT ? 2 : 3;
+    }
+    return status == VM_OK || status == VM_HALT ? 0 : 1;
+}
@@ -0,0 +1,218 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "structs_enums.h"
+#include "parse.h"
+#include "vir_routine.h"
+#include "heap.h"
+#include "decode.h"
+#include "memory.h"
+#include "profile.h"
+#include "hwcounters.h"
+#include "sampler.h"
+#include "largemem.h"
+#include "input.h"
+#include "riskxvii.h"
+
+static struct MEM_PAGE *page_of(struct VM *vm, uint32_t addr) {
+    if(addr >= MEM_SPACE) {
+        return NULL;
+    }
+    return &vm->pages[addr >> MEM_PAGE_BITS];
+}
+
+// the byte backing addr, NULL for routines and unmapped space
+static uint8_t *backing_byte(struct VM *vm, uint32_t addr) {
+    struct MEM_PAGE *page = page_of(vm, addr);
+    if(page == NULL) {
+        return large_byte(vm, addr);
+    }
+    if(page->flags & PAGE_LOAD_DIRECT) {
+        return (uint8_t *) vm + page->offset + (addr & (MEM_PAGE_SIZE-1));
+    }
+    return NULL;
+}
+
+// MMIO HANDLERS, thin wrappers giving every virtual routine the table signature
+static void mmio_w_char(struct VM *vm, uint32_t value, int num_bits) {
+    w_char(vm, value, num_bits);
+}
+
+static void mmio_w_int(struct VM *vm, uint32_t value, int num_bits) {
+    w_int(vm, value, num_bits);
+}
+
+static void mmio_w_uint(struct VM *vm, uint32_t value, int num_bits) {
+    w_uint(vm, value, num_bits);
+}
+
+static void mmio_halt(struct VM *vm, uint32_t value, int num_bits) {
+    halt(vm);
+}
+
+static void mmio_dump_pc(struct VM *vm, uint32_t value, int num_bits) {
+    dump_PC(vm);
+}
+
+static void mmio_dump_reg(struct VM *vm, uint32_t value, int num_bits) {
+    dump_reg(vm);
+}
+
+static void mmio_dump_mem(struct VM *vm, uint32_t value, int num_bits) {
+    // M[v] with v being the stored value, read from memory without running a routine at v
+    uint8_t *byte = backing_byte(vm, value);
+    dump_mem(vm, byte != NULL ? *byte : 0);
+}
+
+static void mmio_malloc(struct VM *vm, uint32_t value, int num_bits) {
+    heap_malloc(vm, value);
+}
+
+static void mmio_free(struct VM *vm, uint32_t value, int num_bits) {
+    heap_free(vm, value);
+}
+
+// a scheduled VM whose input has not arrived yet gives its thread up, the read runs again
+// once the scheduler sees the pipe readable
+static uint32_t mmio_r_char(struct VM *vm) {
+    if(vm->in->nonblock && !in_ready(vm->in, 0)) {
+        vm_suspend(vm, VM_BLOCKED);
+    }
+    return r_char(vm);
+}
+
+static uint32_t mmio_r_int(struct VM *vm) {
+    if(vm->in->nonblock && !in_ready(vm->in, 1)) {
+        vm_suspend(vm, VM_BLOCKED);
+    }
+    return r_int(vm);
+}
+
+mmio_load_fn mmio_loads[MMIO_SIZE] = {
+    [VIR_R_CHAR - MMIO_START] = mmio_r_char,
+    [VIR_R_INT - MMIO_START] = mmio_r_int
+};
+
+mmio_store_fn mmio_stores[MMIO_SIZE] = {
+    [VIR_W_CHAR - MMIO_START] = mmio_w_char,
+    [VIR_W_INT - MMIO_START] = mmio_w_int,
+    [VIR_W_UINT - MMIO_START] = mmio_w_uint,
+    [VIR_HALT - MMIO_START] = mmio_halt,
+    [VIR_DUMP_PC - MMIO_START] = mmio_dump_pc,
+    [VIR_DUMP_REG - MMIO_START] = mmio_dump_reg,
+    [VIR_DUMP_MEM - MMIO_START] = mmio_dump_mem,
+    [HEAP_MALLOC - MMIO_START] = mmio_malloc,
+    [HEAP_FREE - MMIO_START] = mmio_free
+};
+
+// PAGE TABLE (memory.h)
+static void map_pages(struct VM *vm, uint32_t start, uint32_t size, uint8_t region, uint8_t flags, size_t offset) {
+    for(uint32_t addr = start ; addr < start + size ; addr += MEM_PAGE_SIZE) {
+        struct MEM_PAGE *page = &vm->pages[addr >> MEM_PAGE_BITS];
+        page->region = region;
+        page->flags = flags;
+        page->offset = offset + (addr - start);
+    }
+}
+
+// map the guest address space onto the vm's backing arrays
+void mem_init(struct VM *vm) {
+    map_pages(vm, 0, MEM_SPACE, REGION_NONE, 0, 0);
+    // instruction stores have to re-decode, so only loads are direct
+    map_pages(vm, 0, INST_MEM_SIZE, REGION_INST, PAGE_LOAD_DIRECT, offsetof(struct VM, inst_mem));
+    map_pages(vm, DATA_MEM_START, DATA_MEM_SIZE, REGION_DATA, PAGE_LOAD_DIRECT | PAGE_STORE_DIRECT,
+        offsetof(struct VM, data_mem));
+    map_pages(vm, MMIO_START, MMIO_SIZE, REGION_MMIO, 0, 0);
+    map_pages(vm, HEAP_START, HEAP_SIZE, REGION_HEAP, PAGE_LOAD_DIRECT | PAGE_STORE_DIRECT,
+        offsetof(struct VM, heap));
+}
+
+// DIRTY TRACKING (memory.h)
+// data and heap pages take the slow path for their first store once armed
+void mem_track_page(struct VM *vm, uint32_t index, int on) {
+    struct MEM_PAGE *page = &vm->pages[index];
+    if(page->region != REGION_DATA && page->region != REGION_HEAP) {
+        return;
+    }
+    if(on) {
+        page->flags = (page->flags & ~PAGE_STORE_DIRECT) | PAGE_TRACK_DIRTY;
+    }
+    else {
+        page->flags = (page->flags & ~PAGE_TRACK_DIRTY) | PAGE_STORE_DIRECT;
+    }
+}
+
+void mem_track_dirty(struct VM *vm, int on) {
+    for(uint32_t i = 0 ; i < MEM_PAGES ; i++) {
+        mem_track_page(vm, i, on);
+    }
+    memset(vm->dirty, 0, sizeof(vm->dirty));
+}
+
+// accesses that are not a single direct page: virtual routines, unmapped space, page crossings
+uint32_t mem_load_slow(struct VM *vm, uint32_t addr, int num_bytes) {
+    struct MEM_PAGE *page = page_of(vm, addr);
+    if(page != NULL && page->region == REGION_MMIO) {
+        PROFILE_VR(vm, addr);
+        mmio_load_fn handler = mmio_loads[addr - MMIO_START];
+        HW_ROUTINE_BEGIN(vm);
+        SAMPLE_ROUTINE_BEGIN(vm, addr);
+        uint32_t value = handler != NULL ? handler(vm) : 0;
+        SAMPLE_ROUTINE_END(vm);
+        HW_ROUTINE_END(vm);
+        return value;
+    }
+
+    uint32_t value = 0;
+    for(int i = 0 ; i < num_bytes ; i++) {
+        uint8_t *byte = backing_byte(vm, addr + i);
+        if(byte != NULL) {
+            value = value | (*byte << (i*8));
+        }
+    }
+    return value;
+}
+
+void mem_store_slow(struct VM *vm, uint32_t addr, uint32_t value, int num_bytes) {
+    struct MEM_PAGE *page = page_of(vm, addr);
+    if(page != NULL && page->region == REGION_MMIO) {
+        PROFILE_VR(vm, addr);
+        mmio_store_fn handler = mmio_stores[addr - MMIO_START];
+        HW_ROUTINE_BEGIN(vm);
+        SAMPLE_ROUTINE_BEGIN(vm, addr);
+        if(handler != NULL) {
+            handler(vm, value, num_bytes*8);
+        }
+        SAMPLE_ROUTINE_END(vm);
+        HW_ROUTINE_END(vm);
+        return;
+    }
+
+    int code_touched = 0;
+    for(int i = 0 ; i < num_bytes ; i++) {
+        page = page_of(vm, addr + i);
+        if(page != NULL && (page->flags & PAGE_TRACK_DIRTY)) {
+            // first store since the snapshot, later ones go straight through
+            uint32_t index = (addr + i) >> MEM_PAGE_BITS;
+            vm->dirty[index / 64] |= 1ULL << (index % 64);
+            page->flags = (page->flags & ~PAGE_TRACK_DIRTY) | PAGE_STORE_DIRECT;
+        }
+        if(page == NULL && large_byte(vm, addr + i) != NULL) {
+            *large_byte(vm, addr + i) = extract_bits(value, (8*(i+1))-1, 8*i);
+            continue;
+        }
+        if(page == NULL || page->region == REGION_NONE || page->region == REGION_MMIO) {
+            continue;
+        }
+        uint8_t *byte = (uint8_t *) vm + page->offset + ((addr + i) & (MEM_PAGE_SIZE-1));
+        *byte = extract_bits(value, (8*(i+1))-1, 8*i);
+        if(page->region == REGION_INST) {
+            code_touched = 1;
+        }
+    }
+    // store into instruction memory, re-decode the lines it touched
+    if(code_touched) {
+        refresh_decoded(vm, addr, num_bytes);
+    }
+}
@@ -0,0 +1,93 @@
+#ifndef MEMORY_H_
+#define MEMORY_H_
+#include <stdint.h>
+#include <string.h>
+#include "structs_enums.h"
+
+// virtual routine handlers, indexed by address - MMIO_START
+typedef uint32_t (*mmio_load_fn)(struct VM *vm);
+typedef void (*mmio_store_fn)(struct VM *vm, uint32_t value, int num_bits);
+
+extern mmio_load_fn mmio_loads[MMIO_SIZE];
+extern mmio_store_fn mmio_stores[MMIO_SIZE];
+
+void mem_init(struct VM *vm);
+
+// arm (or disarm) dirty tracking of every data and heap page, clears vm->dirty
+void mem_track_dirty(struct VM *vm, int on);
+
+void mem_track_page(struct VM *vm, uint32_t index, int on);
+
+uint32_t mem_load_slow(struct VM *vm, uint32_t addr, int num_bytes);
+
+void mem_store_slow(struct VM *vm, uint32_t addr, uint32_t value, int num_bytes);
+
+// MEMORY ACCESS
+// little endian load of num_bytes into *value when it stays inside one direct page or inside
+// the large profile's space, 0 when it needs mem_load_slow
+static inline int mem_load_direct(struct VM *vm, uint32_t addr, int num_bytes, uint32_t *value) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if(addr < MEM_SPACE) {
+        struct MEM_PAGE *page = &vm->pages[addr >> MEM_PAGE_BITS];
+        uint32_t offset = addr & (MEM_PAGE_SIZE-1);
+        if((page->flags & PAGE_LOAD_DIRECT) && offset + num_bytes <= MEM_PAGE_SIZE) {
+            *value = 0;
+            memcpy(value, (uint8_t *) vm + page->offset + offset, num_bytes);
+            return 1;
+        }
+    }
+    else if((uint64_t) (addr - LARGE_START) + num_bytes <= vm->large_span) {
+        *value = 0;
+        memcpy(value, vm->large_mem + (addr - LARGE_START), num_bytes);
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+static inline uint32_t mem_load(struct VM *vm, uint32_t addr, int num_bytes) {
+    uint32_t value;
+    if(mem_load_direct(vm, addr, num_bytes, &value)) {
+        return value;
+    }
+    return mem_load_slow(vm, addr, num_bytes);
+}
+
+// mem_load for an engine that does not keep vm->PC current, pc is the load's own address and
+// is only written out when the load reaches a routine that may suspend or report it
+static inline uint32_t mem_load_at(struct VM *vm, uint32_t addr, int num_bytes, uint32_t pc) {
+    uint32_t value;
+    if(mem_load_direct(vm, addr, num_bytes, &value)) {
+        return value;
+    }
+    vm->PC = pc;
+    return mem_load_slow(vm, addr, num_bytes);
+}
+
+// little endian store of num_bytes under the same conditions as mem_load_direct, 0 when it
+// needs mem_store_slow
+static inline int mem_store_direct(struct VM *vm, uint32_t addr, uint32_t value, int num_bytes) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if(addr < MEM_SPACE) {
+        struct MEM_PAGE *page = &vm->pages[addr >> MEM_PAGE_BITS];
+        uint32_t offset = addr & (MEM_PAGE_SIZE-1);
+        if((page->flags & PAGE_STORE_DIRECT) && offset + num_bytes <= MEM_PAGE_SIZE) {
+            memcpy((uint8_t *) vm + page->offset + offset, &value, num_bytes);
+            return 1;
+        }
+    }
+    else if((uint64_t) (addr - LARGE_START) + num_bytes <= vm->large_span) {
+        memcpy(vm->large_mem + (addr - LARGE_START), &value, num_bytes);
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+static inline void mem_store(struct VM *vm, uint32_t addr, uint32_t value, int num_bytes) {
+    if(!mem_store_direct(vm, addr, value, num_bytes)) {
+        mem_store_slow(vm, addr, value, num_bytes);
+    }
+}
+
+#endif
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "structs_enums.h"
+#include "options.h"
+#include "riskxvii.h"
+
+// COMMAND LINE (options.h)
+// usage: vm_riskxvii [--engine=blocks|threaded|jit|checked|traced|profiled] [--stats] [--profile <report>]
+//                    [--hwcounters] [--trace <file>] [--input <file>] [--max-insns=N] [--timeout=MS]
+//                    [--memory=small|large] [--sample-profile <report>] [--sample-hz=N] <image>
+//        vm_riskxvii [--engine=blocks|threaded|jit] [--input <file>] [--max-insns=N] --lockstep <image>
+//        vm_riskxvii [--at=N] --replay <trace>
+//        vm_riskxvii [--engine=...] [--jobs=N] [--lanes=N] [--max-insns=N] [--timeout=MS] [--memory=...]
+//                    --batch <manifest>
+//        vm_riskxvii [--jobs=N] [--max-insns=N] [--timeout=MS] [--memory=...] --serve <socket>
+//        vm_riskxvii --aot <image> -o <file.c>
+// returns 0 on success, prints the problem and returns 1 otherwise
+int parse_args(int argc, char *argv[], struct OPTIONS *opts) {
+    opts->filename = NULL;
+    opts->engine = ENGINE_BLOCKS;
+    opts->stats = 0;
+    opts->hwcounters = 0;
+    opts->memory = VM_MEMORY_SMALL;
+    opts->batch = NULL;
+    opts->serve = NULL;
+    opts->jobs = 0;
+    opts->lanes = 1;
+    opts->profile = NULL;
+    opts->sample_profile = NULL;
+    opts->sample_hz = 997;
+    opts->sample_hz_set = 0;
+    opts->lockstep = 0;
+    opts->trace = NULL;
+    opts->replay = NULL;
+    opts->replay_at = UINT64_MAX;
+    opts->input = NULL;
+    opts->max_insns = 0;
+    opts->timeout_ms = 0;
+    opts->aot = 0;
+    opts->aot_out = NULL;
+
+    for(int i = 1 ; i < argc ; i++) {
+        if(strncmp(argv[i], "--engine=", 9) == 0) {
+            char *name = argv[i] + 9;
+            int engine = vm_engine_by_name(name);
+            if(engine < 0) {
+                printf("Unknown engine: %s\n", name);
+                return 1;
+            }
+            opts->engine = engine;
+        }
+        else if(strncmp(argv[i], "--memory=", 9) == 0) {
+            char *name = argv[i] + 9;
+            if(strcmp(name, "small") == 0) {
+                opts->memory = VM_MEMORY_SMALL;
+            }
+            else if(strcmp(name, "large") == 0) {
+                opts->memory = VM_MEMORY_LARGE;
+            }
+            else {
+                printf("Unknown memory profile: %s\n", name);
+                return 1;
+            }
+        }
+        else if(strcmp(argv[i], "--stats") == 0) {
+            opts->stats = 1;
+        }
+        else if(strcmp(argv[i], "--hwcounters") == 0) {
+            opts->hwcounters = 1;
+        }
+        else if(strcmp(argv[i], "--lockstep") == 0) {
+            opts->lockstep = 1;
+        }
+        else if(strcmp(argv[i], "--aot") == 0) {
+            opts->aot = 1;
+        }
+        else if(strcmp(argv[i], "-o") == 0 && i+1 < argc && opts->aot_out == NULL) {
+            opts->aot_out = argv[++i];
+        }
+        else if(strcmp(argv[i], "--batch") == 0 && i+1 < argc && opts->batch == NULL) {
+            opts->batch = argv[++i];
+        }
+        else if(strcmp(argv[i], "--serve") == 0 && i+1 < argc && opts->serve == NULL) {
+            opts->serve = argv[++i];
+        }
+        else if(strcmp(argv[i], "--profile") == 0 && i+1 < argc && opts->profile == NULL) {
+            opts->profile = argv[++i];
+        }
+        else if(strcmp(argv[i], "--sample-profile") == 0 && i+1 < argc && opts->sample_profile == NULL) {
+            opts->sample_profile = argv[++i];
+        }
+        else if(strncmp(argv[i], "--sample-hz=", 12) == 0) {
+            char *end;
+            unsigned long hz = strtoul(argv[i] + 12, &end, 10);
+            if(*end != '\0' || hz == 0 || hz > 100000) {
+                printf("Bad sample rate: %s\n", argv[i] + 12);
+                return 1;
+            }
+            opts->sample_hz = hz;
+            opts->sample_hz_set = 1;
+        }
+        else if(strcmp(argv[i], "--trace") == 0 && i+1 < argc && opts->trace == NULL) {
+            opts->trace = argv[++i];
+        }
+        else if(strcmp(argv[i], "--input") == 0 && i+1 < argc && opts->input == NULL) {
+            opts->input = argv[++i];
+        }
+        else if(strcmp(argv[i], "--replay") == 0 && i+1 < argc && opts->replay == NULL) {
+            opts->replay = argv[++i];
+        }
+        else if(strncmp(argv[i], "--at=", 5) == 0) {
+            char *end;
+            opts->replay_at = strtoull(argv[i] + 5, &end, 10);
+            if(*end != '\0' || end == argv[i] + 5) {
+                printf("Bad instruction index: %s\n", argv[i] + 5);
+                return 1;
+            }
+        }
+        else if(strncmp(argv[i], "--max-insns=", 12) == 0) {
+            char *end;
+            opts->max_insns = strtoull(argv[i] + 12, &end, 10);
+            if(*end != '\0' || opts->max_insns == 0) {
+                printf("Bad instruction limit: %s\n", argv[i] + 12);
+                return 1;
+            }
+        }
+        else if(strncmp(argv[i], "--timeout=", 10) == 0) {
+            char *end;
+            opts->timeout_ms = strtoull(argv[i] + 10, &end, 10);
+            if(*end != '\0' || opts->timeout_ms == 0) {
+                printf("Bad timeout: %s\n", argv[i] + 10);
+                return 1;
+            }
+        }
+        else if(strncmp(argv[i], "--jobs=", 7) == 0) {
+            opts->jobs = atoi(argv[i] + 7);
+            if(opts->jobs <= 0) {
+                printf("Bad job count: %s\n", argv[i] + 7);
+                return 1;
+            }
+        }
+        else if(strncmp(argv[i], "--lanes=", 8) == 0) {
+            opts->lanes = atoi(argv[i] + 8);
+            if(opts->lanes <= 0 || opts->lanes > LANES_MAX) {
+                printf("Bad lane count: %s\n", argv[i] + 8);
+                return 1;
+            }
+        }
+        else if(opts->filename == NULL && strncmp(argv[i], "--", 2) != 0) {
+            opts->filename = argv[i];
+        }
+        else {
+            printf("Wrong number of arguments\n");
+            return 1;
+        }
+    }
+
+    // exactly one of an image, a batch manifest, a socket and a trace to replay
+    if((opts->filename != NULL) + (opts->batch != NULL) + (opts->serve != NULL)
+            + (opts->replay != NULL) != 1) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    if((opts->profile != NULL || opts->lockstep || opts->trace != NULL || opts->input != NULL
+            || opts->hwcounters) && opts->filename == NULL) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    if((opts->max_insns != 0 || opts->timeout_ms != 0 || opts->hwcounters) && opts->replay != NULL) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    // lockstep reads --max-insns as how much of the run to check
+    if((opts->timeout_ms != 0 || opts->hwcounters) && opts->lockstep) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    // sampling keeps its own shadow stack on the blocks engine, the recording ones need the threaded
+    if((opts->sample_profile != NULL || opts->sample_hz_set) && (opts->sample_profile == NULL
+            || opts->filename == NULL || opts->profile != NULL || opts->trace != NULL || opts->lockstep
+            || opts->engine == ENGINE_TRACED || opts->engine == ENGINE_PROFILED)) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    // lockstep steps the candidate itself, the threaded variants only differ in their hooks
+    if(opts->lockstep && opts->engine > ENGINE_JIT) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    if(opts->memory != VM_MEMORY_SMALL && opts->replay != NULL) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    // a translation is written, not run, so none of the run options mean anything to it
+    if(opts->aot != (opts->aot_out != NULL) || (opts->aot && (opts->filename == NULL
+            || opts->engine != ENGINE_BLOCKS || opts->stats || opts->hwcounters || opts->profile != NULL
+            || opts->sample_profile != NULL || opts->lockstep || opts->trace != NULL || opts->input != NULL || opts->max_insns != 0
+            || opts->timeout_ms != 0 || opts->memory != VM_MEMORY_SMALL || opts->jobs != 0))) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    // gangs are made of batch jobs, the lanes of a single run would all be the same
+    if(opts->lanes != 1 && opts->batch == NULL) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    if(opts->replay_at != UINT64_MAX && opts->replay == NULL) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,7 @@
+#ifndef OPTIONS_H_
+#define OPTIONS_H_
+#include "structs_enums.h"
+
+int parse_args(int argc, char *argv[], struct OPTIONS *opts);
+
+#endif
@@ -0,0 +1,198 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "output.h"
+
+// FORMATTING (output.h)
+// decimal digits of value into buf, returns the length
+size_t fmt_dec(char *buf, int32_t value) {
+    char digits[10];
+    size_t len = 0;
+    size_t num = 0;
+    uint32_t mag = (uint32_t) value;
+    if(value < 0) {
+        buf[len++] = '-';
+        mag = 0u - mag;
+    }
+    do {
+        digits[num++] = '0' + (mag % 10);
+        mag /= 10;
+    } while(mag != 0);
+    while(num > 0) {
+        buf[len++] = digits[--num];
+    }
+    return len;
+}
+
+// lowercase hex digits, zero padded to min_digits
+size_t fmt_hex(char *buf, uint32_t value, int min_digits) {
+    static const char hex[] = "0123456789abcdef";
+    int num = 8;
+    while(num > 1 && num > min_digits && (value >> ((num-1)*4)) == 0) {
+        num--;
+    }
+    for(int i = 0 ; i < num ; i++) {
+        buf[i] = hex[(value >> ((num-1-i)*4)) & 0xf];
+    }
+    return num;
+}
+
+// WRITER
+// write ring bytes [tail, head) to fd, at most two iovecs when the range wraps
+static void drain(struct OUT_STREAM *out, size_t tail, size_t head) {
+    while(tail != head) {
+        size_t start = tail & (OUT_RING_SIZE-1);
+        size_t len = head - tail;
+        struct iovec iov[2];
+        int num_iov = 1;
+        iov[0].iov_base = &out->ring[start];
+        iov[0].iov_len = len;
+        if(start + len > OUT_RING_SIZE) {
+            iov[0].iov_len = OUT_RING_SIZE - start;
+            iov[1].iov_base = &out->ring[0];
+            iov[1].iov_len = len - iov[0].iov_len;
+            num_iov = 2;
+        }
+        // fd -1 drops the output
+        ssize_t written = out->fd < 0 ? (ssize_t) len : writev(out->fd, iov, num_iov);
+        if(written < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            // output is gone (closed pipe...), drop the rest so the guest can finish
+            written = len;
+        }
+        tail += written;
+        atomic_store(&out->tail, tail);
+    }
+}
+
+static void wake(struct OUT_STREAM *out, _Atomic int *waiting, pthread_cond_t *cond) {
+    if(atomic_load(waiting)) {
+        pthread_mutex_lock(&out->lock);
+        pthread_cond_broadcast(cond);
+        pthread_mutex_unlock(&out->lock);
+    }
+}
+
+static void *writer_main(void *arg) {
+    struct OUT_STREAM *out = arg;
+    for(;;) {
+        size_t tail = atomic_load(&out->tail);
+        size_t head = atomic_load(&out->head);
+        if(head != tail) {
+            drain(out, tail, head);
+            wake(out, &out->producer_waiting, &out->wake_producer);
+            continue;
+        }
+        if(atomic_load(&out->stop)) {
+            return NULL;
+        }
+        // waiting is published before head is re-read, so a producer either sees it or we see its bytes
+        pthread_mutex_lock(&out->lock);
+        atomic_store(&out->writer_waiting, 1);
+        while(atomic_load(&out->head) == tail && !atomic_load(&out->stop)) {
+            pthread_cond_wait(&out->wake_writer, &out->lock);
+        }
+        atomic_store(&out->writer_waiting, 0);
+        pthread_mutex_unlock(&out->lock);
+    }
+}
+
+// block the producer until the writer has written everything up to target
+static void wait_for_tail(struct OUT_STREAM *out, size_t target) {
+    if(!out->threaded) {
+        drain(out, atomic_load(&out->tail), atomic_load(&out->head));
+        return;
+    }
+    if(atomic_load(&out->tail) >= target) {
+        return;
+    }
+    pthread_mutex_lock(&out->lock);
+    atomic_store(&out->producer_waiting, 1);
+    while(atomic_load(&out->tail) < target) {
+        pthread_cond_wait(&out->wake_producer, &out->lock);
+    }
+    atomic_store(&out->producer_waiting, 0);
+    pthread_mutex_unlock(&out->lock);
+}
+
+// OUTPUT STREAM (output.h)
+void out_open(struct OUT_STREAM *out, int fd, int threaded) {
+    // anything already sitting in stdio has to come out first
+    fflush(stdout);
+    atomic_init(&out->head, 0);
+    atomic_init(&out->tail, 0);
+    atomic_init(&out->writer_waiting, 0);
+    atomic_init(&out->producer_waiting, 0);
+    atomic_init(&out->stop, 0);
+    out->fd = fd;
+    out->threaded = 0;
+    if(threaded) {
+        pthread_mutex_init(&out->lock, NULL);
+        pthread_cond_init(&out->wake_writer, NULL);
+        pthread_cond_init(&out->wake_producer, NULL);
+        out->threaded = pthread_create(&out->writer, NULL, writer_main, out) == 0;
+    }
+}
+
+void out_write(struct OUT_STREAM *out, const char *buf, size_t len) {
+    size_t head = atomic_load_explicit(&out->head, memory_order_relaxed);
+    while(len > 0) {
+        size_t space = OUT_RING_SIZE - (head - atomic_load(&out->tail));
+        if(space == 0) {
+            wait_for_tail(out, head - OUT_RING_SIZE + 1);
+            continue;
+        }
+        size_t start = head & (OUT_RING_SIZE-1);
+        size_t chunk = len < space ? len : space;
+        if(chunk > OUT_RING_SIZE - start) {
+            chunk = OUT_RING_SIZE - start;
+        }
+        memcpy(&out->ring[start], buf, chunk);
+        buf += chunk;
+        len -= chunk;
+        head += chunk;
+        atomic_store(&out->head, head);
+    }
+    if(out->threaded) {
+        wake(out, &out->writer_waiting, &out->wake_writer);
+    }
+}
+
+void out_putc(struct OUT_STREAM *out, char c) {
+    out_write(out, &c, 1);
+}
+
+void out_dec(struct OUT_STREAM *out, int32_t value) {
+    char buf[12];
+    out_write(out, buf, fmt_dec(buf, value));
+}
+
+void out_hex(struct OUT_STREAM *out, uint32_t value, int min_digits) {
+    char buf[8];
+    out_write(out, buf, fmt_hex(buf, value, min_digits));
+}
+
+// returns once every byte written so far has reached the fd
+void out_flush(struct OUT_STREAM *out) {
+    wait_for_tail(out, atomic_load(&out->head));
+}
+
+void out_close(struct OUT_STREAM *out) {
+    out_flush(out);
+    if(out->threaded) {
+        pthread_mutex_lock(&out->lock);
+        atomic_store(&out->stop, 1);
+        pthread_cond_broadcast(&out->wake_writer);
+        pthread_mutex_unlock(&out->lock);
+        pthread_join(out->writer, NULL);
+        pthread_mutex_destroy(&out->lock);
+        pthread_cond_destroy(&out->wake_writer);
+        pthread_cond_destroy(&out->wake_producer);
+        out->threaded = 0;
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef OUTPUT_H_
+#define OUTPUT_H_
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define OUT_RING_SIZE (1 << 16)     // power of two
+
+// single producer (the executing vm) / single consumer (the writer thread) byte ring
+struct OUT_STREAM {
+    char ring[OUT_RING_SIZE];
+    _Atomic size_t head;            // bytes ever produced
+    _Atomic size_t tail;            // bytes ever written to fd
+    int fd;
+    int threaded;                   // 0: the producer writes the ring out itself
+    pthread_t writer;
+    pthread_mutex_t lock;           // only taken to sleep or wake, never to move bytes
+    pthread_cond_t wake_writer;
+    pthread_cond_t wake_producer;
+    _Atomic int writer_waiting;
+    _Atomic int producer_waiting;
+    _Atomic int stop;
+};
+
+void out_open(struct OUT_STREAM *out, int fd, int threaded);
+
+void out_write(struct OUT_STREAM *out, const char *buf, size_t len);
+
+void out_putc(struct OUT_STREAM *out, char c);
+
+void out_dec(struct OUT_STREAM *out, int32_t value);
+
+void out_hex(struct OUT_STREAM *out, uint32_t value, int min_digits);
+
+void out_flush(struct OUT_STREAM *out);
+
+void out_close(struct OUT_STREAM *out);
+
+size_t fmt_dec(char *buf, int32_t value);
+
+size_t fmt_hex(char *buf, uint32_t value, int min_digits);
+
+#endif
@@ -6,7 +6,7 @@ uint32_t extract_bits(uint32_t instruction, int start_index, int end_index);
 
 uint8_t extract_opcode(uint32_t instruction);
 
-uint8_t extract_opcode(uint32_t instruction);
+uint8_t extract_rd(uint32_t instruction);
 
 uint8_t extract_func3(uint32_t instruction);
 
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "structs_enums.h"
+#include "decode.h"
+#include "riskxvii.h"
+#include "profile.h"
+
+const char *vr_names[MMIO_SIZE] = {
+    [0x00] = "write char", [0x04] = "write int",  [0x08] = "write uint", [0x0c] = "halt",
+    [0x12] = "read char",  [0x16] = "read int",   [0x20] = "dump pc",    [0x24] = "dump registers",
+    [0x28] = "dump memory", [0x30] = "malloc",    [0x34] = "free"
+};
+
+void profile_jump(struct VM *vm, struct DECODED *inst) {
+    struct PROFILE *prof = vm->profile;
+    struct PROFILE_NODE *node = &prof->nodes[prof->cur];
+    if(inst->op == OP_JALR && inst->rd == REG_SINK && inst->rs1 == 1) {
+        if(prof->cur != 0) {
+            prof->cur = node->parent;
+        }
+        return;
+    }
+    if(inst->rd != 1) {
+        return;
+    }
+    // runs before the handler, so rs1 still holds its old value
+    uint32_t target = inst->op == OP_JAL ? vm->PC + inst->imm : (vm->registers[inst->rs1] + inst->imm) & ~1u;
+    target &= 0xffff;
+    uint32_t child = node->child;
+    while(child != 0 && prof->nodes[child].func != target) {
+        child = prof->nodes[child].sibling;
+    }
+    if(child == 0) {
+        if(prof->num_nodes == PROFILE_NODES) {
+            return;
+        }
+        child = prof->num_nodes++;
+        prof->nodes[child] = (struct PROFILE_NODE) {
+            .func = target, .parent = prof->cur, .sibling = node->child
+        };
+        node->child = child;
+    }
+    prof->cur = child;
+}
+
+// PROFILE API (riskxvii.h)
+int vm_profile_start(struct VM *vm) {
+    if(vm->profile == NULL) {
+        vm->profile = calloc(1, sizeof(struct PROFILE));
+        if(vm->profile == NULL) {
+            return 1;
+        }
+    }
+    memset(vm->profile, 0, sizeof(struct PROFILE));
+    vm->profile->num_nodes = 1;
+    return 0;
+}
+
+static int by_count_desc(const void *a, const void *b, void *counts) {
+    uint64_t ca = ((uint64_t *) counts)[*(const int *) a];
+    uint64_t cb = ((uint64_t *) counts)[*(const int *) b];
+    return (ca < cb) - (ca > cb);
+}
+
+// caller;callee frames from the root down, flamegraph.pl and friends read "frames count" lines
+static void write_stack(FILE *out, struct PROFILE *prof, uint32_t index) {
+    uint32_t path[PROFILE_NODES];
+    int depth = 0;
+    for(uint32_t i = index ; ; i = prof->nodes[i].parent) {
+        path[depth++] = i;
+        if(i == 0) {
+            break;
+        }
+    }
+    while(depth-- > 0) {
+        fprintf(out, "0x%04x%s", prof->nodes[path[depth]].func, depth > 0 ? ";" : "");
+    }
+    fprintf(out, " %llu\n", (unsigned long long) prof->nodes[index].count);
+}
+
+static void write_folded(FILE *out, struct PROFILE *prof, uint32_t index) {
+    struct PROFILE_NODE *node = &prof->nodes[index];
+    if(node->count > 0) {
+        write_stack(out, prof, index);
+    }
+    for(uint32_t child = node->child ; child != 0 ; child = prof->nodes[child].sibling) {
+        write_folded(out, prof, child);
+    }
+}
+
+int vm_profile_write(struct VM *vm, const char *path) {
+    struct PROFILE *prof = vm->profile;
+    if(prof == NULL) {
+        return 1;
+    }
+    FILE *out = fopen(path, "w");
+    if(out == NULL) {
+        return 1;
+    }
+    uint64_t total = 0;
+    int order[INST_MEM_SIZE/4];
+    int num_pcs = 0;
+    for(int i = 0 ; i < INST_MEM_SIZE/4 ; i++) {
+        total += prof->pc_count[i];
+        if(prof->pc_count[i] > 0) {
+            order[num_pcs++] = i;
+        }
+    }
+    qsort_r(order, num_pcs, sizeof(int), by_count_desc, prof->pc_count);
+
+    double scale = total > 0 ? 100.0 / total : 0;
+    fprintf(out, "# %llu instructions\n", (unsigned long long) total);
+    fprintf(out, "\n# hot spots\n%12s %7s %6s %10s  %s\n", "count", "%", "pc", "line", "instruction");
+    for(int i = 0 ; i < num_pcs ; i++) {
+        char text[64];
+        uint32_t pc = order[i] * 4;
+        struct DECODED inst;
+        decode_line(inst_line(vm, order[i]), &inst);
+        disassemble(&inst, pc, text, sizeof(text));
+        fprintf(out, "%12llu %6.2f%% 0x%04x 0x%08x  %s\n", (unsigned long long) prof->pc_count[order[i]],
+            prof->pc_count[order[i]] * scale, pc, inst_line(vm, order[i]), text);
+    }
+
+    int ops[OP_NUM];
+    int num_ops = 0;
+    for(int i = 0 ; i < OP_NUM ; i++) {
+        if(prof->op_count[i] > 0) {
+            ops[num_ops++] = i;
+        }
+    }
+    qsort_r(ops, num_ops, sizeof(int), by_count_desc, prof->op_count);
+    fprintf(out, "\n# operations\n");
+    for(int i = 0 ; i < num_ops ; i++) {
+        fprintf(out, "%12llu %6.2f%% %s\n", (unsigned long long) prof->op_count[ops[i]],
+            prof->op_count[ops[i]] * scale, op_names[ops[i]]);
+    }
+
+    fprintf(out, "\n# virtual routines\n");
+    for(int i = 0 ; i < MMIO_SIZE ; i++) {
+        if(prof->vr_count[i] > 0) {
+            fprintf(out, "%12llu 0x%04x %s\n", (unsigned long long) prof->vr_count[i], MMIO_START + i,
+                vr_names[i] != NULL ? vr_names[i] : "unused");
+        }
+    }
+    int failed = fclose(out) != 0;
+
+    char folded[4096];
+    snprintf(folded, sizeof(folded), "%s.folded", path);
+    out = fopen(folded, "w");
+    if(out == NULL) {
+        return 1;
+    }
+    write_folded(out, prof, 0);
+    return fclose(out) != 0 || failed;
+}
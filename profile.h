@@ -0,0 +1,54 @@
+#ifndef PROFILE_H_
+#define PROFILE_H_
+#include <stdint.h>
+#include "structs_enums.h"
+
+// EXECUTION PROFILE (profile.c)
+// exact counts taken at every dispatch of the profiled threaded variant (interp.c), the
+// other engines and variants carry no profiling code at all
+
+// virtual routine names for the reports, by address - MMIO_START
+extern const char *vr_names[MMIO_SIZE];
+
+#define PROFILE_NODES 4096      // shadow call stack nodes, deeper calls count in the deepest one
+
+// one function on one call path, children are linked through sibling
+struct PROFILE_NODE {
+    uint32_t func;      // entry pc
+    uint32_t parent;
+    uint32_t child;     // 0 for none, node 0 is the root
+    uint32_t sibling;
+    uint64_t count;     // instructions run with this node on top
+};
+
+struct PROFILE {
+    uint64_t pc_count[INST_MEM_SIZE/4];
+    uint64_t op_count[OP_NUM];
+    uint64_t vr_count[MMIO_SIZE];   // virtual routine accesses by address - MMIO_START
+    uint32_t cur;       // node of the function being run
+    uint32_t num_nodes;
+    struct PROFILE_NODE nodes[PROFILE_NODES];
+};
+
+// jal/jalr that link through ra push a node, jalr x0, 0(ra) pops one
+void profile_jump(struct VM *vm, struct DECODED *inst);
+
+static inline void profile_insn(struct VM *vm, struct DECODED *inst) {
+    struct PROFILE *prof = vm->profile;
+    prof->pc_count[vm->PC / 4]++;
+    // a loop head idiom.c marked counts as what it is
+    prof->op_count[inst->op == OP_IDIOM ? vm->idioms[vm->PC / 4].op : inst->op]++;
+    prof->nodes[prof->cur].count++;
+    if(inst->op == OP_JAL || inst->op == OP_JALR) {
+        profile_jump(vm, inst);
+    }
+}
+
+// on the virtual routine path only, off the hot loop
+#define PROFILE_VR(vm, addr) do { \
+        if((vm)->profile != NULL) { \
+            (vm)->profile->vr_count[(addr) - MMIO_START]++; \
+        } \
+    } while(0)
+
+#endif
@@ -3,8 +3,6 @@
 
 #include "structs_enums.h"
 
-void read_file_into_mem(struct VM *vm, char *filename);
+int read_image(struct VM *vm, const char *filename);
 
-void get_inst_lines(struct VM *vm, char *filename);
-
-#endif
\ No newline at end of file
+#endif
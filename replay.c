@@ -0,0 +1,88 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "structs_enums.h"
+#include "trace.h"
+#include "replay.h"
+
+// guest memory rebuilt from the image and the recorded stores
+struct REPLAY_MEM {
+    uint8_t bytes[MEM_SPACE];
+    uint8_t initial[MEM_SPACE];
+};
+
+static void apply_store(struct REPLAY_MEM *mem, struct TRACE_READER *reader) {
+    uint32_t addr = reader->store_addr;
+    int num_bytes = 1 << ((reader->flags >> TRACE_SIZE_SHIFT) & 3);
+    // virtual routines have no memory behind them
+    if(addr >= MMIO_START && addr < MMIO_START + MMIO_SIZE) {
+        return;
+    }
+    for(int i = 0 ; i < num_bytes && addr + i < MEM_SPACE ; i++) {
+        mem->bytes[addr + i] = reader->store_value >> (8 * i);
+    }
+}
+
+static void print_changed(struct REPLAY_MEM *mem, uint32_t start, uint32_t end) {
+    for(uint32_t addr = start ; addr < end ; addr += 4) {
+        uint32_t now, was;
+        memcpy(&now, &mem->bytes[addr], 4);
+        memcpy(&was, &mem->initial[addr], 4);
+        if(now != was) {
+            printf("M[0x%04x] = 0x%08x; (was 0x%08x)\n", addr, now, was);
+        }
+    }
+}
+
+int run_replay(struct OPTIONS *opts) {
+    struct TRACE_READER reader;
+    if(trace_open(&reader, opts->replay) != 0) {
+        printf("Not a trace: %s\n", opts->replay);
+        return 1;
+    }
+    struct REPLAY_MEM *mem = calloc(1, sizeof(struct REPLAY_MEM));
+    if(mem == NULL) {
+        printf("Out of memory\n");
+        trace_close(&reader);
+        return 1;
+    }
+    memcpy(mem->bytes, reader.image, IMAGE_SIZE);
+    memcpy(mem->initial, reader.image, IMAGE_SIZE);
+
+    // up to the requested instruction with effects, the rest only counted
+    uint32_t pc = 0;
+    uint32_t regs[32];
+    int inputs = 0;
+    while(reader.count < opts->replay_at && trace_next(&reader)) {
+        pc = reader.pc;
+        if(reader.flags & TRACE_STORE) {
+            apply_store(mem, &reader);
+        }
+        if(reader.flags & TRACE_INPUT) {
+            printf("input %d at instruction %llu: %d\n", ++inputs,
+                    (unsigned long long) reader.count, reader.input);
+        }
+    }
+    uint64_t at = reader.count;
+    memcpy(regs, reader.regs, sizeof(regs));
+    while(trace_next(&reader)) {
+    }
+    trace_close(&reader);
+
+    if(opts->replay_at != UINT64_MAX && opts->replay_at > at) {
+        printf("Trace has only %llu instructions\n", (unsigned long long) at);
+        free(mem);
+        return 1;
+    }
+    printf("instruction %llu of %llu\n", (unsigned long long) at, (unsigned long long) reader.count);
+    printf("PC = 0x%08x;\n", pc);
+    for(int i = 0 ; i < 32 ; i++) {
+        printf("R[%d] = 0x%08x;\n", i, regs[i]);
+    }
+    print_changed(mem, 0, MMIO_START);
+    print_changed(mem, HEAP_START, HEAP_START + HEAP_SIZE);
+    free(mem);
+    return 0;
+}
@@ -0,0 +1,11 @@
+#ifndef REPLAY_H_
+#define REPLAY_H_
+#include "structs_enums.h"
+
+// TRACE REPLAY (replay.c)
+// rebuilds the state after opts->replay_at instructions of the trace in opts->replay (the whole
+// trace by default) from the recorded effects alone and prints the pc of the last instruction,
+// the registers, the memory words that differ from the image and the input read so far
+int run_replay(struct OPTIONS *opts);
+
+#endif
@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+
+// RESET BENCHMARK
+// usage: reset_bench [iterations]
+// runs a guest that dirties a few pages and one that dirties all of data memory and the heap,
+// timing vm_restore against a full vm_reset between runs
+
+// just the encodings the two guests need
+static uint32_t op_i(uint32_t rd, uint32_t rs1, int32_t imm) {   // addi
+    return ((uint32_t) imm & 0xfff) << 20 | rs1 << 15 | rd << 7 | 0x13;
+}
+
+static uint32_t op_lui(uint32_t rd, uint32_t imm) {
+    return imm << 12 | rd << 7 | 0x37;
+}
+
+static uint32_t op_add(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return rs2 << 20 | rs1 << 15 | rd << 7 | 0x33;
+}
+
+static uint32_t op_sw(uint32_t rs2, uint32_t rs1) {     // sw rs2, 0(rs1)
+    return rs2 << 20 | rs1 << 15 | 2 << 12 | 0x23;
+}
+
+static uint32_t op_blt(uint32_t rs1, uint32_t rs2, int32_t imm) {
+    uint32_t u = (uint32_t) imm;
+    return ((u >> 12) & 1) << 31 | ((u >> 5) & 0x3f) << 25 | rs2 << 20 | rs1 << 15 | 4 << 12
+        | ((u >> 1) & 0xf) << 8 | ((u >> 11) & 1) << 7 | 0x63;
+}
+
+enum { ZERO = 0, T0 = 5, T1 = 6, A0 = 10, T3 = 28, T4 = 29 };
+
+static void put(uint8_t *image, int *pc, uint32_t word) {
+    memcpy(image + *pc, &word, 4);
+    *pc += 4;
+}
+
+static void halt_at(uint8_t *image, int *pc) {
+    put(image, pc, op_lui(T1, 1));
+    put(image, pc, op_i(T1, T1, -0x7f4));      // 0x80c
+    put(image, pc, op_sw(ZERO, T1));
+}
+
+// one word of data memory
+static void small_guest(uint8_t *image) {
+    int pc = 0;
+    put(image, &pc, op_i(T0, ZERO, 0x400));
+    put(image, &pc, op_sw(T0, T0));
+    halt_at(image, &pc);
+}
+
+// every word of data memory, then the whole heap in one allocation
+static void large_guest(uint8_t *image) {
+    int pc = 0;
+    put(image, &pc, op_i(T0, ZERO, 0x400));
+    put(image, &pc, op_lui(T3, 1));
+    put(image, &pc, op_i(T3, T3, -0x800));     // 0x800
+    put(image, &pc, op_sw(T0, T0));
+    put(image, &pc, op_i(T0, T0, 4));
+    put(image, &pc, op_blt(T0, T3, -8));
+    put(image, &pc, op_lui(T1, 1));
+    put(image, &pc, op_i(T1, T1, -0x7d0));     // 0x830, malloc
+    put(image, &pc, op_lui(A0, HEAP_SIZE >> 12));
+    put(image, &pc, op_sw(A0, T1));            // R28 = heap pointer
+    put(image, &pc, op_add(T0, T3, ZERO));
+    put(image, &pc, op_add(T4, T3, A0));
+    put(image, &pc, op_sw(T0, T0));
+    put(image, &pc, op_i(T0, T0, 4));
+    put(image, &pc, op_blt(T0, T4, -8));
+    halt_at(image, &pc);
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int dirty_pages(struct VM *vm) {
+    int count = 0;
+    for(int i = 0 ; i < MEM_PAGES/64 ; i++) {
+        count += __builtin_popcountll(vm->dirty[i]);
+    }
+    return count;
+}
+
+// 0 if the run halted, otherwise says which run it was and how it ended
+static int check_halt(const char *name, const char *after, long iteration, int status) {
+    if(status == VM_HALT) {
+        return 0;
+    }
+    printf("%s: run %ld after %s ended with %s instead of halting\n", name, iteration, after, vm_status_name(status));
+    return 1;
+}
+
+// average ns per reset, reset_ns includes nothing but the reset itself
+static int bench(const char *name, uint8_t *image, long iterations) {
+    struct VM *vm = vm_create();
+    if(vm == NULL) {
+        return 1;
+    }
+    vm_set_io(vm, NULL, -1, 0);
+    if(vm_load_image(vm, image, IMAGE_SIZE) != VM_OK || vm_snapshot(vm) != VM_OK) {
+        vm_destroy(vm);
+        return 1;
+    }
+    if(check_halt(name, "vm_load_image", 0, vm_run(vm, ENGINE_BLOCKS)) != 0) {
+        vm_destroy(vm);
+        return 1;
+    }
+    int pages = dirty_pages(vm);
+    uint64_t restore_ns = 0;
+    uint64_t reset_ns = 0;
+    for(long i = 0 ; i < iterations ; i++) {
+        uint64_t start = now_ns();
+        vm_restore(vm);
+        restore_ns += now_ns() - start;
+        if(check_halt(name, "vm_restore", i, vm_run(vm, ENGINE_BLOCKS)) != 0) {
+            vm_destroy(vm);
+            return 1;
+        }
+    }
+    for(long i = 0 ; i < iterations ; i++) {
+        uint64_t start = now_ns();
+        vm_reset(vm);
+        reset_ns += now_ns() - start;
+        if(check_halt(name, "vm_reset", i, vm_run(vm, ENGINE_BLOCKS)) != 0) {
+            vm_destroy(vm);
+            return 1;
+        }
+    }
+    vm_destroy(vm);
+    double restore = (double) restore_ns / iterations;
+    double reset = (double) reset_ns / iterations;
+    printf("%s dirty set: %d pages, vm_restore %.0f ns (%.0f resets/s), vm_reset %.0f ns (%.0f resets/s)\n",
+        name, pages, restore, 1e9 / restore, reset, 1e9 / reset);
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    long iterations = argc > 1 ? atol(argv[1]) : 100000;
+    if(iterations <= 0) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    static uint8_t small[IMAGE_SIZE];
+    static uint8_t large[IMAGE_SIZE];
+    small_guest(small);
+    large_guest(large);
+    return bench("small", small, iterations) != 0 || bench("large", large, iterations) != 0;
+}
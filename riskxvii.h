@@ -0,0 +1,135 @@
+#ifndef RISKXVII_H_
+#define RISKXVII_H_
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "structs_enums.h"
+
+// LIBRARY API (libriskxvii.a)
+// every call works on its own vm, so separate vms can run on separate threads
+
+// a vm with an empty image, console on stdin/stdout (unthreaded), NULL if out of memory
+struct VM *vm_create(void);
+
+// R_CHAR/R_INT read from in (NULL reads as 0), output goes to out_fd (-1 drops it); in is read
+// through its file descriptor when it has one, so it should not have been read through stdio
+void vm_set_io(struct VM *vm, FILE *in, int out_fd, int threaded_out);
+
+// R_CHAR/R_INT read path instead, mapped when it is a regular file, 0 or 1 if it cannot be opened
+int vm_set_input(struct VM *vm, const char *path);
+
+// load an IMAGE_SIZE byte memory image ("-" for stdin) and reset, VM_OK or VM_LOAD_ERROR
+// after writing the reason to the vm's output
+int vm_load(struct VM *vm, const char *filename);
+
+// same from memory
+int vm_load_image(struct VM *vm, const uint8_t *image, size_t size);
+
+void vm_reset(struct VM *vm);
+
+// remember the current state, the first store to each 64 byte data or heap page after it
+// marks that page dirty, VM_OK or VM_LOAD_ERROR if out of memory or in the large profile
+int vm_snapshot(struct VM *vm);
+
+// back to the last snapshot, copying only the dirty pages, VM_LOAD_ERROR if there is none
+int vm_restore(struct VM *vm);
+
+// every later vm_run ends with VM_INSN_LIMIT once max_insns instructions have run since the
+// last load or reset, or with VM_TIMEOUT after timeout_ms of wall clock time, 0 for no limit;
+// both are checked at taken jumps and block entries, so a run stops within one block of the
+// limit (exactly at it on the threaded variants), printing the registers with PC at the
+// instruction that would have run next
+void vm_set_limits(struct VM *vm, uint64_t max_insns, uint64_t timeout_ms);
+
+// VM_MEMORY_LARGE adds LARGE_START..LARGE_END (data, then a heap malloc falls back to), host
+// memory is only committed where the guest touches it; takes effect for the next load or
+// reset, 0 or 1 if the space cannot be reserved
+int vm_set_memory(struct VM *vm, enum VM_MEMORY memory);
+
+// run from the current state until the program ends or is suspended (VM_BLOCKED, VM_YIELD,
+// only under the scheduler), returns enum VM_STATUS; a trace or a
+// profile picks the threaded variant that records it, sampling the blocks engine, and threaded
+// with a limit set runs checked
+int vm_run(struct VM *vm, enum ENGINE engine);
+
+// vm_run with code, a translation of the loaded image from vm_riskxvii --aot, running first;
+// whatever it leaves at vm->PC (a store into instruction memory, a jalr it has no label for)
+// the blocks engine finishes, and so does everything when limits, a trace, a profile or sampling are set
+int vm_run_compiled(struct VM *vm, void (*code)(struct VM *vm));
+
+// run num vms, each loaded or reset and not run since, to the end; vms with the same
+// instruction memory and limits go in gangs of up to LANES_MAX that share one pass over the
+// code, their registers side by side in vectors (lanes.c); a vm with no match runs on engine,
+// as does the rest of a lane that stores into instruction memory or nears its instruction
+// limit; status[i] gets vms[i]'s enum VM_STATUS, returns how many ran in gangs or -1 if out
+// of memory
+int vm_run_lanes(struct VM **vms, int num, enum ENGINE engine, int *status);
+
+// ENGINE_* for an --engine= name, -1 if there is none
+int vm_engine_by_name(const char *name);
+
+const char *vm_engine_name(enum ENGINE engine);
+
+// instructions run since the last load or reset
+uint64_t vm_insn_count(struct VM *vm);
+
+void vm_destroy(struct VM *vm);
+
+const char *vm_status_name(int status);
+
+// count instructions by pc and operation, virtual routine accesses and guest call stacks on
+// every later run, which then uses the profiled threaded variant; 0 or 1 if out of memory
+int vm_profile_start(struct VM *vm);
+
+// sorted hot spot report with disassembly to path, folded stacks to path.folded, 0 or 1
+int vm_profile_write(struct VM *vm, const char *path);
+
+// sample the guest pc, virtual routine and call stack hz times a second of cpu time on every
+// later run, which then uses the blocks engine; 0 or 1 if out of memory
+int vm_sample_start(struct VM *vm, uint32_t hz);
+
+// hot block and virtual routine report to path, folded stacks to path.folded, 0 or 1
+int vm_sample_write(struct VM *vm, const char *path);
+
+// record every later run's instructions, register writes, stores and input to path, meant to
+// start right after vm_load or vm_reset, 0 or 1 if path cannot be created
+int vm_trace_start(struct VM *vm, const char *path);
+
+// write out what is buffered and close the trace, returns the number of instructions recorded
+uint64_t vm_trace_stop(struct VM *vm);
+
+// sample host cycles, instructions, branch misses and L1 data misses (perf_event_open) around
+// every later run and every virtual routine call, or only the clock where perf events are not
+// allowed; 0 or 1 if out of memory
+int vm_hwcounters_start(struct VM *vm);
+
+// totals split into routines and plain execution, and their cost per guest instruction and
+// per routine call
+void vm_hwcounters_report(struct VM *vm, FILE *out);
+
+// M:N SCHEDULER (sched.c)
+struct SCHED;
+
+// many vms on num_threads worker threads with their own run queues, idle workers steal from
+// busy ones; a vm gives its worker up when quantum instructions have run (0 for never) or when
+// R_CHAR/R_INT has no input yet, and is queued again once its input pipe is readable; the
+// instruction limit covers the whole run, the timeout each slice; NULL if out of memory
+struct SCHED *vm_sched_create(int num_threads, uint64_t quantum);
+
+// run vm, loaded and with its output set, from its current state on the scheduler; its input
+// becomes a new pipe whose write end is returned, closing it ends the input; done is called
+// on a worker thread with the final status once the program ends, -1 if no pipe
+int vm_sched_spawn(struct SCHED *sched, struct VM *vm, enum ENGINE engine,
+    void (*done)(struct VM *vm, int status, void *arg), void *arg);
+
+// wait for every spawned vm to end, then stop the workers; prints slices, waits for input and
+// steals to stats unless it is NULL
+void vm_sched_destroy(struct SCHED *sched, FILE *stats);
+
+// used by the virtual routines to end vm_run
+_Noreturn void vm_exit(struct VM *vm, int status);
+
+// used by the input routines to suspend vm_run at the instruction they were called from
+_Noreturn void vm_suspend(struct VM *vm, int status);
+
+#endif
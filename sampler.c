@@ -0,0 +1,235 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "structs_enums.h"
+#include "decode.h"
+#include "riskxvii.h"
+#include "profile.h"
+#include "sampler.h"
+
+// the vm this thread is running, the timer only ever signals the thread that armed it
+static _Thread_local struct VM *sampling;
+
+// SIGNAL HANDLER, touches nothing but the sampler and what it reads of the vm
+static void on_sigprof(int sig, siginfo_t *info, void *context) {
+    struct VM *vm = sampling;
+    if(vm == NULL || vm->sampler == NULL) {
+        return;
+    }
+    struct SAMPLER *s = vm->sampler;
+    uint32_t routine = s->routine;
+    struct BLOCK *block = vm->cur_block;
+    uint32_t pc = routine != 0 || block == NULL ? vm->PC : block->start_pc;
+    uint32_t depth = s->depth;
+    uint32_t kept = depth < SAMPLE_STACK ? depth : SAMPLE_STACK;
+    size_t used = atomic_load_explicit(&s->used, memory_order_relaxed);
+    if(used + 2 + kept > SAMPLE_WORDS) {
+        s->dropped++;
+        return;
+    }
+    s->buf[used] = (pc & 0xffff) | kept << 16;
+    s->buf[used + 1] = routine | s->last_routine << 16;
+    memcpy(&s->buf[used + 2], s->stack, kept * sizeof(uint32_t));
+    atomic_store_explicit(&s->used, used + 2 + kept, memory_order_release);
+}
+
+static uint64_t thread_cpu_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
+}
+
+// TIMER (sampler.h)
+void sample_arm(struct VM *vm) {
+    struct SAMPLER *s = vm->sampler;
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_sigaction = on_sigprof;
+    action.sa_flags = SA_SIGINFO | SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGPROF, &action, NULL);
+
+    sampling = vm;
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGPROF;
+    event._sigev_un._tid = syscall(SYS_gettid);
+    s->armed = timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &s->timer) == 0;
+    if(s->armed) {
+        struct itimerspec every = {
+            .it_interval = { s->interval_ns / 1000000000, s->interval_ns % 1000000000 },
+            .it_value = { s->interval_ns / 1000000000, s->interval_ns % 1000000000 }
+        };
+        timer_settime(s->timer, 0, &every, NULL);
+    }
+    s->armed_at = thread_cpu_ns();
+}
+
+void sample_disarm(struct VM *vm) {
+    struct SAMPLER *s = vm->sampler;
+    s->cpu_ns += thread_cpu_ns() - s->armed_at;
+    if(s->armed) {
+        timer_delete(s->timer);
+        s->armed = 0;
+    }
+    sampling = NULL;
+    // a routine that ended the run never got to SAMPLE_ROUTINE_END
+    s->routine = 0;
+}
+
+void sample_release(struct VM *vm) {
+    free(vm->sampler);
+    vm->sampler = NULL;
+}
+
+// SAMPLING API (riskxvii.h)
+int vm_sample_start(struct VM *vm, uint32_t hz) {
+    if(vm->sampler == NULL) {
+        vm->sampler = malloc(sizeof(struct SAMPLER));
+        if(vm->sampler == NULL) {
+            return 1;
+        }
+    }
+    struct SAMPLER *s = vm->sampler;
+    s->depth = 0;
+    s->routine = 0;
+    s->last_routine = 0;
+    s->interval_ns = 1000000000ull / (hz != 0 ? hz : 1);
+    s->cpu_ns = 0;
+    s->armed = 0;
+    s->dropped = 0;
+    atomic_init(&s->used, 0);
+    return 0;
+}
+
+static int by_count_desc(const void *a, const void *b, void *counts) {
+    uint64_t ca = ((uint64_t *) counts)[*(const int *) a];
+    uint64_t cb = ((uint64_t *) counts)[*(const int *) b];
+    return (ca < cb) - (ca > cb);
+}
+
+// samples with the same frames and routine next to each other
+static int by_stack(const void *a, const void *b) {
+    const uint32_t *ra = *(const uint32_t **) a;
+    const uint32_t *rb = *(const uint32_t **) b;
+    uint32_t ka = ra[0] >> 16;
+    uint32_t kb = rb[0] >> 16;
+    uint32_t common = ka < kb ? ka : kb;
+    for(uint32_t i = 0 ; i < common ; i++) {
+        if(ra[2 + i] != rb[2 + i]) {
+            return ra[2 + i] < rb[2 + i] ? -1 : 1;
+        }
+    }
+    if(ka != kb) {
+        return ka < kb ? -1 : 1;
+    }
+    uint32_t va = ra[1] & 0xffff;
+    uint32_t vb = rb[1] & 0xffff;
+    return (va > vb) - (va < vb);
+}
+
+// frames from the entry point down like --profile's, a sample inside a routine ends in it
+static void write_stack(FILE *out, const uint32_t *record, uint64_t count) {
+    fprintf(out, "0x0000");
+    for(uint32_t i = 0 ; i < record[0] >> 16 ; i++) {
+        fprintf(out, ";0x%04x", record[2 + i]);
+    }
+    uint32_t routine = record[1] & 0xffff;
+    if(routine != 0) {
+        const char *name = vr_names[routine - MMIO_START];
+        fprintf(out, ";[%s]", name != NULL ? name : "unused");
+    }
+    fprintf(out, " %llu\n", (unsigned long long) count);
+}
+
+int vm_sample_write(struct VM *vm, const char *path) {
+    struct SAMPLER *s = vm->sampler;
+    if(s == NULL) {
+        return 1;
+    }
+    size_t used = atomic_load_explicit(&s->used, memory_order_acquire);
+    uint64_t num = 0;
+    uint64_t pc_count[INST_MEM_SIZE/4] = {0};
+    uint64_t in_routine[MMIO_SIZE] = {0};
+    uint64_t after_routine[MMIO_SIZE] = {0};
+    for(size_t at = 0 ; at < used ; at += 2 + (s->buf[at] >> 16)) {
+        uint32_t pc = s->buf[at] & 0xffff;
+        uint32_t routine = s->buf[at + 1] & 0xffff;
+        uint32_t last = s->buf[at + 1] >> 16;
+        if(pc < INST_MEM_SIZE) {
+            pc_count[pc / 4]++;
+        }
+        if(routine != 0) {
+            in_routine[routine - MMIO_START]++;
+        }
+        else if(last != 0) {
+            after_routine[last - MMIO_START]++;
+        }
+        num++;
+    }
+    const uint32_t **records = malloc((num != 0 ? num : 1) * sizeof(uint32_t *));
+    FILE *out = records != NULL ? fopen(path, "w") : NULL;
+    if(out == NULL) {
+        free(records);
+        return 1;
+    }
+
+    int order[INST_MEM_SIZE/4];
+    int num_pcs = 0;
+    for(int i = 0 ; i < INST_MEM_SIZE/4 ; i++) {
+        if(pc_count[i] > 0) {
+            order[num_pcs++] = i;
+        }
+    }
+    qsort_r(order, num_pcs, sizeof(int), by_count_desc, pc_count);
+    double scale = num > 0 ? 100.0 / num : 0;
+    fprintf(out, "# %llu samples in %.1f ms of cpu time, one every %.0f us asked for, %llu dropped\n",
+        (unsigned long long) num, s->cpu_ns / 1e6, s->interval_ns / 1e3, (unsigned long long) s->dropped);
+    fprintf(out, "\n# hot blocks\n%12s %7s %6s  %s\n", "samples", "%", "pc", "first instruction");
+    for(int i = 0 ; i < num_pcs ; i++) {
+        char text[64];
+        struct DECODED inst;
+        decode_line(inst_line(vm, order[i]), &inst);
+        disassemble(&inst, order[i] * 4, text, sizeof(text));
+        fprintf(out, "%12llu %6.2f%% 0x%04x  %s\n", (unsigned long long) pc_count[order[i]],
+            pc_count[order[i]] * scale, order[i] * 4, text);
+    }
+    // after: running guest code with this as the last routine called
+    fprintf(out, "\n# virtual routines\n%12s %12s %6s  %s\n", "in", "after", "addr", "routine");
+    for(int i = 0 ; i < MMIO_SIZE ; i++) {
+        if(in_routine[i] > 0 || after_routine[i] > 0) {
+            fprintf(out, "%12llu %12llu 0x%04x  %s\n", (unsigned long long) in_routine[i],
+                (unsigned long long) after_routine[i], MMIO_START + i, vr_names[i] != NULL ? vr_names[i] : "unused");
+        }
+    }
+    int failed = fclose(out) != 0;
+
+    char folded[4096];
+    snprintf(folded, sizeof(folded), "%s.folded", path);
+    out = fopen(folded, "w");
+    if(out == NULL) {
+        free(records);
+        return 1;
+    }
+    size_t n = 0;
+    for(size_t at = 0 ; at < used ; at += 2 + (s->buf[at] >> 16)) {
+        records[n++] = &s->buf[at];
+    }
+    qsort(records, n, sizeof(uint32_t *), by_stack);
+    for(size_t i = 0 ; i < n ; ) {
+        size_t same = i + 1;
+        while(same < n && by_stack(&records[i], &records[same]) == 0) {
+            same++;
+        }
+        write_stack(out, records[i], same - i);
+        i = same;
+    }
+    free(records);
+    return fclose(out) != 0 || failed;
+}
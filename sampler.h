@@ -0,0 +1,78 @@
+#ifndef SAMPLER_H_
+#define SAMPLER_H_
+#include <stdint.h>
+#include <stdatomic.h>
+#include <time.h>
+#include "structs_enums.h"
+
+// SAMPLING PROFILE (sampler.c)
+// a SIGPROF timer on the CPU clock of the thread running vm_run samples the guest pc, the
+// virtual routine being run and a shadow call stack into a buffer only the signal handler
+// writes; sampling runs on the blocks engine, whose jal/jalr keep the shadow stack, and the pc
+// of a sample is the start of the block being run (the exact pc inside a routine)
+
+#define SAMPLE_STACK 128        // shadow stack frames kept, deeper calls are only counted
+#define SAMPLE_WORDS (1 << 20)  // sample buffer, samples that no longer fit are dropped
+
+struct SAMPLER {
+    uint32_t stack[SAMPLE_STACK];   // entry pc of every active function, outermost first
+    volatile uint32_t depth;        // can be more than SAMPLE_STACK
+    volatile uint32_t routine;      // MMIO address of the routine being run, 0 outside one
+    uint32_t last_routine;
+    uint64_t interval_ns;
+    uint64_t cpu_ns;                // thread cpu time of the sampled runs, the kernel tick caps the rate
+    uint64_t armed_at;
+    timer_t timer;
+    int armed;
+    uint64_t dropped;
+    // records of a pc | frames << 16 word, a routine | last_routine << 16 word, then the frames
+    atomic_size_t used;
+    uint32_t buf[SAMPLE_WORDS];
+};
+
+// start and stop the timer around vm_run, on the thread that runs it
+void sample_arm(struct VM *vm);
+void sample_disarm(struct VM *vm);
+
+void sample_release(struct VM *vm);
+
+// the handler may run between any two stores, a frame is written before it is counted
+static inline void sample_jump(struct SAMPLER *s, struct DECODED *inst, uint32_t target) {
+    if(inst->op == OP_JALR && inst->rd == REG_SINK && inst->rs1 == 1) {
+        if(s->depth > 0) {
+            s->depth--;
+        }
+        return;
+    }
+    if(inst->rd != 1) {
+        return;
+    }
+    uint32_t depth = s->depth;
+    if(depth < SAMPLE_STACK) {
+        s->stack[depth] = target;
+    }
+    atomic_signal_fence(memory_order_release);
+    s->depth = depth + 1;
+}
+
+// at jal/jalr of the blocks engine, target being where it goes
+#define SAMPLE_HOOK_JUMP(vm, inst, target) do { \
+        if((vm)->sampler != NULL) { \
+            sample_jump((vm)->sampler, (inst), (target)); \
+        } \
+    } while(0)
+
+// around the MMIO handlers in memory.c
+#define SAMPLE_ROUTINE_BEGIN(vm, addr) do { \
+        if((vm)->sampler != NULL) { \
+            (vm)->sampler->routine = (addr); \
+            (vm)->sampler->last_routine = (addr); \
+        } \
+    } while(0)
+#define SAMPLE_ROUTINE_END(vm) do { \
+        if((vm)->sampler != NULL) { \
+            (vm)->sampler->routine = 0; \
+        } \
+    } while(0)
+
+#endif
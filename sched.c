@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+#include "input.h"
+
+// a spawned vm, on exactly one run queue, waiting in the epoll set or being run
+struct SCHED_TASK {
+    struct VM *vm;
+    enum ENGINE engine;
+    void (*done)(struct VM *vm, int status, void *arg);
+    void *arg;
+    int in_fd;                      // read end of its input pipe, owned by vm->in
+    int armed;                      // in_fd has been added to the epoll set
+    struct SCHED_WORKER *worker;    // the one it last ran on, woken tasks go back there
+    struct SCHED_TASK *next;
+};
+
+struct SCHED_WORKER {
+    pthread_t thread;
+    struct SCHED *sched;
+    pthread_mutex_t lock;           // guards the queue, the owner and thieves both take from head
+    struct SCHED_TASK *head;
+    struct SCHED_TASK *tail;
+    int len;
+    uint64_t slices;
+    uint64_t yields;                // quantum expired
+    uint64_t blocked;               // input not there yet
+    uint64_t steals;                // tasks taken from other workers
+};
+
+struct SCHED {
+    struct SCHED_WORKER *workers;
+    int num_workers;
+    uint64_t quantum;
+    int epoll_fd;
+    int stop_fd;                    // eventfd in the epoll set that ends the poller
+    pthread_t poller;
+    atomic_long queued;             // tasks on all run queues, stolen ones included
+    atomic_int idle;                // workers asleep on work or about to be
+    pthread_mutex_t lock;           // guards live, next_worker and stopping
+    pthread_cond_t work;
+    pthread_cond_t all_done;
+    long live;
+    int next_worker;
+    int stopping;
+};
+
+// RUN QUEUES
+static void queue_push(struct SCHED_WORKER *worker, struct SCHED_TASK *first, struct SCHED_TASK *last, int num) {
+    last->next = NULL;
+    pthread_mutex_lock(&worker->lock);
+    if(worker->tail != NULL) {
+        worker->tail->next = first;
+    }
+    else {
+        worker->head = first;
+    }
+    worker->tail = last;
+    worker->len += num;
+    pthread_mutex_unlock(&worker->lock);
+}
+
+// the head task, or the first half of the queue for a thief, chained; NULL if there are none
+static struct SCHED_TASK *queue_take(struct SCHED_WORKER *worker, int half, struct SCHED_TASK **last, int *taken) {
+    pthread_mutex_lock(&worker->lock);
+    struct SCHED_TASK *first = worker->head;
+    int num = half ? (worker->len + 1) / 2 : 1;
+    *taken = 0;
+    *last = NULL;
+    for(struct SCHED_TASK *task = first ; task != NULL && *taken < num ; task = task->next) {
+        *last = task;
+        (*taken)++;
+    }
+    if(first != NULL) {
+        worker->head = (*last)->next;
+        if(worker->head == NULL) {
+            worker->tail = NULL;
+        }
+        worker->len -= *taken;
+    }
+    pthread_mutex_unlock(&worker->lock);
+    return first;
+}
+
+// a sleeping worker is only woken when it might have missed the task, both sides check the
+// other's counter after changing their own
+static void enqueue(struct SCHED *sched, struct SCHED_WORKER *worker, struct SCHED_TASK *task) {
+    queue_push(worker, task, task, 1);
+    atomic_fetch_add(&sched->queued, 1);
+    if(atomic_load(&sched->idle) > 0) {
+        pthread_mutex_lock(&sched->lock);
+        pthread_cond_signal(&sched->work);
+        pthread_mutex_unlock(&sched->lock);
+    }
+}
+
+// half of the first other queue that has any, the rest of them go on worker's own queue
+static struct SCHED_TASK *steal(struct SCHED_WORKER *worker) {
+    struct SCHED *sched = worker->sched;
+    int self = worker - sched->workers;
+    for(int i = 1 ; i < sched->num_workers ; i++) {
+        struct SCHED_WORKER *victim = &sched->workers[(self + i) % sched->num_workers];
+        struct SCHED_TASK *last;
+        int taken;
+        struct SCHED_TASK *first = queue_take(victim, 1, &last, &taken);
+        if(first == NULL) {
+            continue;
+        }
+        worker->steals += taken;
+        if(first != last) {
+            queue_push(worker, first->next, last, taken - 1);
+        }
+        return first;
+    }
+    return NULL;
+}
+
+// SLICES
+static void arm_input(struct SCHED *sched, struct SCHED_TASK *task) {
+    struct epoll_event event = { .events = EPOLLIN | EPOLLONESHOT, .data.ptr = task };
+    if(task->armed) {
+        epoll_ctl(sched->epoll_fd, EPOLL_CTL_MOD, task->in_fd, &event);
+        return;
+    }
+    task->armed = 1;
+    epoll_ctl(sched->epoll_fd, EPOLL_CTL_ADD, task->in_fd, &event);
+}
+
+// run task until it ends or gives the worker up; once it is queued or armed again another
+// thread may already be running it
+static void run_slice(struct SCHED_WORKER *worker, struct SCHED_TASK *task) {
+    struct SCHED *sched = worker->sched;
+    struct VM *vm = task->vm;
+    task->worker = worker;
+    vm->yield_at = sched->quantum != 0 ? vm_insn_count(vm) + sched->quantum : UINT64_MAX;
+    int status = vm_run(vm, task->engine);
+    worker->slices++;
+    if(status == VM_YIELD) {
+        worker->yields++;
+        enqueue(sched, worker, task);
+        return;
+    }
+    if(status == VM_BLOCKED) {
+        worker->blocked++;
+        arm_input(sched, task);
+        return;
+    }
+    if(task->armed) {
+        epoll_ctl(sched->epoll_fd, EPOLL_CTL_DEL, task->in_fd, NULL);
+    }
+    vm->yield_at = UINT64_MAX;
+    task->done(vm, status, task->arg);
+    free(task);
+    pthread_mutex_lock(&sched->lock);
+    if(--sched->live == 0) {
+        pthread_cond_broadcast(&sched->all_done);
+    }
+    pthread_mutex_unlock(&sched->lock);
+}
+
+static void *worker_main(void *arg) {
+    struct SCHED_WORKER *worker = arg;
+    struct SCHED *sched = worker->sched;
+    for(;;) {
+        struct SCHED_TASK *last;
+        int taken;
+        struct SCHED_TASK *task = queue_take(worker, 0, &last, &taken);
+        if(task == NULL) {
+            task = steal(worker);
+        }
+        if(task != NULL) {
+            atomic_fetch_sub(&sched->queued, 1);
+            run_slice(worker, task);
+            continue;
+        }
+        pthread_mutex_lock(&sched->lock);
+        atomic_fetch_add(&sched->idle, 1);
+        while(atomic_load(&sched->queued) == 0 && !sched->stopping) {
+            pthread_cond_wait(&sched->work, &sched->lock);
+        }
+        atomic_fetch_sub(&sched->idle, 1);
+        int stop = sched->stopping && atomic_load(&sched->queued) == 0;
+        pthread_mutex_unlock(&sched->lock);
+        if(stop) {
+            return NULL;
+        }
+    }
+}
+
+// turns readable (or closed) input pipes back into queued tasks
+static void *poller_main(void *arg) {
+    struct SCHED *sched = arg;
+    struct epoll_event events[64];
+    for(;;) {
+        int num = epoll_wait(sched->epoll_fd, events, 64, -1);
+        for(int i = 0 ; i < num ; i++) {
+            struct SCHED_TASK *task = events[i].data.ptr;
+            if(task == NULL) {
+                return NULL;
+            }
+            enqueue(sched, task->worker, task);
+        }
+    }
+}
+
+// LIBRARY API (riskxvii.h)
+struct SCHED *vm_sched_create(int num_threads, uint64_t quantum) {
+    struct SCHED *sched = calloc(1, sizeof(struct SCHED));
+    if(sched == NULL || num_threads < 1) {
+        free(sched);
+        return NULL;
+    }
+    sched->workers = calloc(num_threads, sizeof(struct SCHED_WORKER));
+    sched->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    sched->stop_fd = eventfd(0, EFD_CLOEXEC);
+    struct epoll_event stop = { .events = EPOLLIN, .data.ptr = NULL };
+    if(sched->workers == NULL || sched->epoll_fd < 0 || sched->stop_fd < 0
+            || epoll_ctl(sched->epoll_fd, EPOLL_CTL_ADD, sched->stop_fd, &stop) != 0) {
+        if(sched->epoll_fd >= 0) {
+            close(sched->epoll_fd);
+        }
+        if(sched->stop_fd >= 0) {
+            close(sched->stop_fd);
+        }
+        free(sched->workers);
+        free(sched);
+        return NULL;
+    }
+    sched->num_workers = num_threads;
+    sched->quantum = quantum;
+    atomic_init(&sched->queued, 0);
+    atomic_init(&sched->idle, 0);
+    pthread_mutex_init(&sched->lock, NULL);
+    pthread_cond_init(&sched->work, NULL);
+    pthread_cond_init(&sched->all_done, NULL);
+    for(int i = 0 ; i < num_threads ; i++) {
+        struct SCHED_WORKER *worker = &sched->workers[i];
+        worker->sched = sched;
+        pthread_mutex_init(&worker->lock, NULL);
+        pthread_create(&worker->thread, NULL, worker_main, worker);
+    }
+    pthread_create(&sched->poller, NULL, poller_main, sched);
+    return sched;
+}
+
+int vm_sched_spawn(struct SCHED *sched, struct VM *vm, enum ENGINE engine,
+        void (*done)(struct VM *vm, int status, void *arg), void *arg) {
+    struct SCHED_TASK *task = calloc(1, sizeof(struct SCHED_TASK));
+    int fds[2];
+    if(task == NULL || pipe2(fds, O_CLOEXEC) != 0) {
+        free(task);
+        return -1;
+    }
+    in_close(vm->in);
+    in_open_pipe(vm->in, fds[0], vm->out);
+    task->vm = vm;
+    task->engine = engine;
+    task->done = done;
+    task->arg = arg;
+    task->in_fd = fds[0];
+    pthread_mutex_lock(&sched->lock);
+    sched->live++;
+    task->worker = &sched->workers[sched->next_worker];
+    sched->next_worker = (sched->next_worker + 1) % sched->num_workers;
+    pthread_mutex_unlock(&sched->lock);
+    enqueue(sched, task->worker, task);
+    return fds[1];
+}
+
+void vm_sched_destroy(struct SCHED *sched, FILE *stats) {
+    pthread_mutex_lock(&sched->lock);
+    while(sched->live > 0) {
+        pthread_cond_wait(&sched->all_done, &sched->lock);
+    }
+    sched->stopping = 1;
+    pthread_cond_broadcast(&sched->work);
+    pthread_mutex_unlock(&sched->lock);
+    eventfd_write(sched->stop_fd, 1);
+    pthread_join(sched->poller, NULL);
+
+    struct SCHED_WORKER total = {0};
+    for(int i = 0 ; i < sched->num_workers ; i++) {
+        struct SCHED_WORKER *worker = &sched->workers[i];
+        pthread_join(worker->thread, NULL);
+        pthread_mutex_destroy(&worker->lock);
+        if(stats != NULL) {
+            fprintf(stats, "worker %d: %llu slices, %llu quantum expiries, %llu input waits, %llu steals\n", i,
+                (unsigned long long) worker->slices, (unsigned long long) worker->yields,
+                (unsigned long long) worker->blocked, (unsigned long long) worker->steals);
+        }
+        total.slices += worker->slices;
+        total.yields += worker->yields;
+        total.blocked += worker->blocked;
+        total.steals += worker->steals;
+    }
+    if(stats != NULL) {
+        fprintf(stats, "scheduler: %llu slices, %llu quantum expiries, %llu input waits, %llu steals\n",
+            (unsigned long long) total.slices, (unsigned long long) total.yields,
+            (unsigned long long) total.blocked, (unsigned long long) total.steals);
+    }
+    close(sched->epoll_fd);
+    close(sched->stop_fd);
+    pthread_mutex_destroy(&sched->lock);
+    pthread_cond_destroy(&sched->work);
+    pthread_cond_destroy(&sched->all_done);
+    free(sched->workers);
+    free(sched);
+}
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+
+// SCHEDULER BENCHMARK
+// usage: sched_bench [--vms=M] [--threads=N] [--quantum=Q] [--rounds=R] [--spin=S] [--engine=E]
+// M interactive guests on N worker threads: each reads R numbers, one per round, spinning S
+// iterations and printing a line per number, until a 0; the bench writes every guest its
+// next number a round at a time, so guests keep waiting for input
+
+// just the encodings the guest needs
+static uint32_t op_i(uint32_t rd, uint32_t rs1, int32_t imm) {   // addi
+    return ((uint32_t) imm & 0xfff) << 20 | rs1 << 15 | rd << 7 | 0x13;
+}
+
+static uint32_t op_lui(uint32_t rd, uint32_t imm) {
+    return imm << 12 | rd << 7 | 0x37;
+}
+
+static uint32_t op_add(uint32_t rd, uint32_t rs1, uint32_t rs2) {
+    return rs2 << 20 | rs1 << 15 | rd << 7 | 0x33;
+}
+
+static uint32_t op_lw(uint32_t rd, uint32_t rs1, int32_t imm) {
+    return ((uint32_t) imm & 0xfff) << 20 | rs1 << 15 | 2 << 12 | rd << 7 | 0x03;
+}
+
+static uint32_t op_sw(uint32_t rs2, uint32_t rs1, int32_t imm) {
+    uint32_t u = (uint32_t) imm;
+    return ((u >> 5) & 0x7f) << 25 | rs2 << 20 | rs1 << 15 | 2 << 12 | (u & 0x1f) << 7 | 0x23;
+}
+
+static uint32_t op_branch(uint32_t funct3, uint32_t rs1, uint32_t rs2, int32_t imm) {
+    uint32_t u = (uint32_t) imm;
+    return ((u >> 12) & 1) << 31 | ((u >> 5) & 0x3f) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12
+        | ((u >> 1) & 0xf) << 8 | ((u >> 11) & 1) << 7 | 0x63;
+}
+
+enum { ZERO = 0, T0 = 5, T1 = 6, S0 = 8, A0 = 10, A1 = 11 };
+enum { BEQ = 0, BNE = 1 };
+
+static void put(uint8_t *image, int *pc, uint32_t word) {
+    memcpy(image + *pc, &word, 4);
+    *pc += 4;
+}
+
+// s0 = sum of what was read, t1 = 0x800 for the routines
+static void session_guest(uint8_t *image, int spin) {
+    int pc = 0;
+    put(image, &pc, op_lui(T1, 1));
+    put(image, &pc, op_i(T1, T1, -0x800));
+    int loop = pc;
+    put(image, &pc, op_lw(A0, T1, VIR_R_INT - MMIO_START));
+    put(image, &pc, op_branch(BEQ, A0, ZERO, 9*4));
+    put(image, &pc, op_add(S0, S0, A0));
+    put(image, &pc, op_i(T0, ZERO, spin));
+    put(image, &pc, op_i(T0, T0, -1));
+    put(image, &pc, op_branch(BNE, T0, ZERO, -4));
+    put(image, &pc, op_sw(A0, T1, VIR_W_INT - MMIO_START));
+    put(image, &pc, op_i(A1, ZERO, '\n'));
+    put(image, &pc, op_sw(A1, T1, VIR_W_CHAR - MMIO_START));
+    put(image, &pc, op_branch(BEQ, ZERO, ZERO, loop - pc));
+    put(image, &pc, op_sw(ZERO, T1, VIR_HALT - MMIO_START));
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static atomic_int failures;
+
+// every guest should have halted with the sum of 1..rounds
+static void session_done(struct VM *vm, int status, void *arg) {
+    uint32_t expected = *(uint32_t *) arg;
+    if(status != VM_HALT || vm->registers[S0] != expected) {
+        atomic_fetch_add(&failures, 1);
+    }
+}
+
+static long option(const char *arg, const char *name, long value) {
+    size_t len = strlen(name);
+    return strncmp(arg, name, len) == 0 ? atol(arg + len) : value;
+}
+
+int main(int argc, char *argv[]) {
+    long num_vms = 1000;
+    long threads = 2;
+    long quantum = 100000;
+    long rounds = 20;
+    long spin = 200;
+    enum ENGINE engine = ENGINE_BLOCKS;
+    for(int i = 1 ; i < argc ; i++) {
+        num_vms = option(argv[i], "--vms=", num_vms);
+        threads = option(argv[i], "--threads=", threads);
+        quantum = option(argv[i], "--quantum=", quantum);
+        rounds = option(argv[i], "--rounds=", rounds);
+        spin = option(argv[i], "--spin=", spin);
+        if(strncmp(argv[i], "--engine=", 9) == 0) {
+            int found = vm_engine_by_name(argv[i] + 9);
+            if(found < 0) {
+                printf("Unknown engine %s\n", argv[i] + 9);
+                return 1;
+            }
+            engine = found;
+        }
+    }
+    if(num_vms <= 0 || threads <= 0 || quantum < 0 || rounds <= 0 || spin <= 0 || spin > 2047) {
+        printf("Wrong number of arguments\n");
+        return 1;
+    }
+    // an input pipe per guest, both ends
+    struct rlimit files;
+    if(getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < files.rlim_max) {
+        files.rlim_cur = files.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &files);
+    }
+
+    static uint8_t image[IMAGE_SIZE];
+    session_guest(image, spin);
+    uint32_t expected = rounds * (rounds + 1) / 2;
+    struct VM **vms = calloc(num_vms, sizeof(struct VM *));
+    int *pipes = calloc(num_vms, sizeof(int));
+    struct SCHED *sched = vm_sched_create(threads, quantum);
+    if(vms == NULL || pipes == NULL || sched == NULL) {
+        printf("Out of memory\n");
+        return 1;
+    }
+    uint64_t start = now_ns();
+    for(long i = 0 ; i < num_vms ; i++) {
+        vms[i] = vm_create();
+        if(vms[i] == NULL) {
+            printf("Out of memory\n");
+            return 1;
+        }
+        vm_set_io(vms[i], NULL, -1, 0);
+        vm_load_image(vms[i], image, IMAGE_SIZE);
+        pipes[i] = vm_sched_spawn(sched, vms[i], engine, session_done, &expected);
+        if(pipes[i] < 0) {
+            printf("Could not open an input pipe\n");
+            return 1;
+        }
+    }
+    uint64_t spawned = now_ns();
+    char line[32];
+    for(long round = 1 ; round <= rounds + 1 ; round++) {
+        int len = snprintf(line, sizeof(line), "%ld\n", round <= rounds ? round : 0);
+        for(long i = 0 ; i < num_vms ; i++) {
+            if(write(pipes[i], line, len) != len) {
+                atomic_fetch_add(&failures, 1);
+            }
+        }
+    }
+    for(long i = 0 ; i < num_vms ; i++) {
+        close(pipes[i]);
+    }
+    vm_sched_destroy(sched, stderr);
+    uint64_t end = now_ns();
+
+    uint64_t insns = 0;
+    for(long i = 0 ; i < num_vms ; i++) {
+        insns += vm_insn_count(vms[i]);
+        vm_destroy(vms[i]);
+    }
+    free(vms);
+    free(pipes);
+    printf("%ld vms on %ld threads, %s engine: spawn %.1f ms, run %.1f ms, %.0f reads/s, %.1f M guest insns/s\n",
+        num_vms, threads, vm_engine_name(engine), (spawned - start) / 1e6, (end - spawned) / 1e6,
+        (double) num_vms * (rounds + 1) * 1e9 / (end - spawned), (double) insns * 1e3 / (end - spawned));
+    if(atomic_load(&failures) != 0) {
+        printf("%d guests did not read and sum their input\n", atomic_load(&failures));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+#include "serve.h"
+
+// a client that stalls in the middle of a request loses its connection after this long
+#define SERVE_RECV_TIMEOUT_MS 5000
+
+// accepted connections waiting for a worker
+struct SERVE_QUEUE {
+    int fds[64];
+    int head;
+    int count;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+};
+
+// one warm vm per worker, created before the socket starts accepting
+struct SERVE_WORKER {
+    pthread_t thread;
+    struct VM *vm;
+    int out_fd;     // memfd collecting the console output of one request
+    struct SERVE_QUEUE *queue;
+    int epoll_fd;   // idle connections wait here between requests, not on a worker
+};
+
+static void queue_push(struct SERVE_QUEUE *queue, int fd) {
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == 64) {
+        pthread_cond_wait(&queue->not_full, &queue->lock);
+    }
+    queue->fds[(queue->head + queue->count) % 64] = fd;
+    queue->count++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+static int queue_pop(struct SERVE_QUEUE *queue) {
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == 0) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    int fd = queue->fds[queue->head];
+    queue->head = (queue->head + 1) % 64;
+    queue->count--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return fd;
+}
+
+// REQUESTS
+// run one request on the worker's vm and send the reply, -1 once the connection is done
+static int serve_request(struct SERVE_WORKER *worker, int fd, uint8_t **input, size_t *input_cap) {
+    struct SERVE_REQUEST req;
+    uint8_t image[SERVE_MAX_PATH + 1];
+    if(read_full(fd, &req, sizeof(req)) != 0 || req.magic != SERVE_REQUEST_MAGIC) {
+        return -1;
+    }
+    size_t max_image = (req.flags & SERVE_INLINE_IMAGE) ? IMAGE_SIZE : SERVE_MAX_PATH;
+    if(req.image_len > max_image || req.input_len > SERVE_MAX_INPUT) {
+        return -1;
+    }
+    if(req.input_len > *input_cap) {
+        uint8_t *grown = realloc(*input, req.input_len);
+        if(grown == NULL) {
+            return -1;
+        }
+        *input = grown;
+        *input_cap = req.input_len;
+    }
+    if(read_full(fd, image, req.image_len) != 0 || read_full(fd, *input, req.input_len) != 0) {
+        return -1;
+    }
+    image[req.image_len] = '\0';
+
+    struct VM *vm = worker->vm;
+    FILE *in = req.input_len > 0 ? fmemopen(*input, req.input_len, "r") : NULL;
+    ftruncate(worker->out_fd, 0);
+    lseek(worker->out_fd, 0, SEEK_SET);
+    vm_set_io(vm, in, worker->out_fd, 0);
+
+    int status;
+    if(req.flags & SERVE_INLINE_IMAGE) {
+        status = vm_load_image(vm, image, req.image_len);
+    }
+    else {
+        status = vm_load(vm, (char *) image);
+    }
+    if(status == VM_OK) {
+        status = vm_run(vm, req.engine < ENGINE_NUM ? req.engine : ENGINE_BLOCKS);
+    }
+    vm_set_io(vm, NULL, -1, 0);
+    if(in != NULL) {
+        fclose(in);
+    }
+
+    struct SERVE_REPLY reply;
+    memset(&reply, 0, sizeof(reply));
+    reply.magic = SERVE_REPLY_MAGIC;
+    reply.status = status;
+    reply.insn_count = status == VM_LOAD_ERROR ? 0 : vm_insn_count(vm);
+    reply.output_len = lseek(worker->out_fd, 0, SEEK_CUR);
+    if(write_full(fd, &reply, sizeof(reply)) != 0) {
+        return -1;
+    }
+    off_t offset = 0;
+    while(offset < reply.output_len) {
+        if(sendfile(fd, worker->out_fd, &offset, reply.output_len - offset) <= 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// a connection can carry any number of requests, one after the other; between them it goes
+// back to the epoll set so a keep-alive client does not hold a worker. A connection is only
+// ever in the set or with one worker, never both, so nothing else can close it mid request
+static void *worker_main(void *arg) {
+    struct SERVE_WORKER *worker = arg;
+    uint8_t *input = NULL;
+    size_t input_cap = 0;
+    for(;;) {
+        int fd = queue_pop(worker->queue);
+        struct epoll_event event = { .events = EPOLLIN | EPOLLONESHOT, .data.fd = fd };
+        if(serve_request(worker, fd, &input, &input_cap) != 0
+                || epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+        }
+    }
+    return NULL;
+}
+
+// DAEMON (serve.h)
+int run_serve(struct OPTIONS *opts) {
+    int num_workers = opts->jobs > 0 ? opts->jobs : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if(num_workers < 1) {
+        num_workers = 1;
+    }
+    // a client hanging up mid reply must not take the daemon down
+    signal(SIGPIPE, SIG_IGN);
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if(strlen(opts->serve) >= sizeof(addr.sun_path)) {
+        printf("Socket path too long\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, opts->serve);
+
+    struct SERVE_QUEUE queue;
+    queue.head = 0;
+    queue.count = 0;
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.not_empty, NULL);
+    pthread_cond_init(&queue.not_full, NULL);
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if(epoll_fd < 0) {
+        printf("Cannot create epoll set\n");
+        return 1;
+    }
+    struct SERVE_WORKER *workers = calloc(num_workers, sizeof(struct SERVE_WORKER));
+    for(int i = 0 ; i < num_workers ; i++) {
+        workers[i].vm = vm_create();
+        workers[i].out_fd = memfd_create("riskxvii-out", 0);
+        workers[i].queue = &queue;
+        workers[i].epoll_fd = epoll_fd;
+        if(workers[i].vm == NULL || workers[i].out_fd < 0
+                || vm_set_memory(workers[i].vm, opts->memory) != 0) {
+            printf("Cannot create vm pool\n");
+            return 1;
+        }
+        vm_set_limits(workers[i].vm, opts->max_insns, opts->timeout_ms);
+    }
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    unlink(opts->serve);
+    if(listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &addr, sizeof(addr)) != 0
+        || listen(listen_fd, 128) != 0) {
+        printf("Cannot listen on %s\n", opts->serve);
+        return 1;
+    }
+    for(int i = 0 ; i < num_workers ; i++) {
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    fprintf(stderr, "serving on %s with %d vms\n", opts->serve, num_workers);
+
+    // new connections and idle ones that became readable (or hung up) go to the workers
+    struct epoll_event listen_event = { .events = EPOLLIN, .data.fd = listen_fd };
+    if(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &listen_event) != 0) {
+        printf("Cannot listen on %s\n", opts->serve);
+        return 1;
+    }
+    struct timeval timeout = { SERVE_RECV_TIMEOUT_MS / 1000, (SERVE_RECV_TIMEOUT_MS % 1000) * 1000 };
+    struct epoll_event events[64];
+    for(;;) {
+        int num = epoll_wait(epoll_fd, events, 64, -1);
+        for(int i = 0 ; i < num ; i++) {
+            int fd = events[i].data.fd;
+            if(fd != listen_fd) {
+                // out of the set before a worker owns it, the worker adds it back when done
+                epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+                queue_push(&queue, fd);
+                continue;
+            }
+            fd = accept4(listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if(fd < 0) {
+                continue;
+            }
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            queue_push(&queue, fd);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,71 @@
+#ifndef SERVE_H_
+#define SERVE_H_
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <unistd.h>
+#include "structs_enums.h"
+
+// WIRE FORMAT, host byte order since the socket is local
+#define SERVE_REQUEST_MAGIC 0x51565852  // "RXVQ"
+#define SERVE_REPLY_MAGIC   0x52565852  // "RXVR"
+#define SERVE_INLINE_IMAGE  0x1         // the request carries the image itself instead of its path
+#define SERVE_MAX_PATH 4096
+#define SERVE_MAX_INPUT (16 << 20)
+
+// followed by image_len bytes of path (or image), then input_len bytes for R_CHAR/R_INT
+struct SERVE_REQUEST {
+    uint32_t magic;
+    uint32_t flags;
+    uint32_t engine;        // enum ENGINE
+    uint32_t image_len;
+    uint32_t input_len;
+};
+
+// followed by output_len bytes of console output
+struct SERVE_REPLY {
+    uint32_t magic;
+    int32_t status;         // enum VM_STATUS
+    uint64_t insn_count;
+    uint32_t output_len;
+    uint32_t reserved;
+};
+
+// whole buffer or nothing, returns 0 on success and -1 on error or end of stream
+static inline int read_full(int fd, void *buf, size_t len) {
+    uint8_t *pos = buf;
+    while(len > 0) {
+        ssize_t got = read(fd, pos, len);
+        if(got < 0 && errno == EINTR) {
+            continue;
+        }
+        if(got <= 0) {
+            return -1;
+        }
+        pos += got;
+        len -= got;
+    }
+    return 0;
+}
+
+static inline int write_full(int fd, const void *buf, size_t len) {
+    const uint8_t *pos = buf;
+    while(len > 0) {
+        ssize_t put = write(fd, pos, len);
+        if(put < 0 && errno == EINTR) {
+            continue;
+        }
+        if(put <= 0) {
+            return -1;
+        }
+        pos += put;
+        len -= put;
+    }
+    return 0;
+}
+
+// DAEMON (serve.c)
+// serve load-and-run requests on the unix socket opts->serve until killed
+int run_serve(struct OPTIONS *opts);
+
+#endif
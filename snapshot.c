@@ -0,0 +1,94 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+#include "memory.h"
+#include "decode.h"
+#include "blocks.h"
+#include "snapshot.h"
+
+// SNAPSHOT (riskxvii.h)
+// a full copy is taken once, vm->dirty says which pages a restore has to copy back
+struct VM_SNAPSHOT {
+    uint8_t inst_mem[INST_MEM_SIZE];
+    uint8_t data_mem[DATA_MEM_SIZE];
+    uint8_t heap[HEAP_SIZE];
+    struct HEAP_ALLOC heap_alloc;
+    uint32_t registers[33];
+    uint32_t PC;
+    uint64_t insn_count;
+    uint32_t code_gen;  // inst_mem only needs restoring if this moved on
+    int valid;
+};
+
+// where a data or heap page's saved bytes live
+static uint8_t *snap_page(struct VM_SNAPSHOT *snap, uint32_t addr) {
+    if(addr >= HEAP_START) {
+        return snap->heap + (addr - HEAP_START);
+    }
+    return snap->data_mem + (addr - DATA_MEM_START);
+}
+
+int vm_snapshot(struct VM *vm) {
+    // dirty tracking only covers the small map's pages
+    if(vm->large_mem != NULL) {
+        return VM_LOAD_ERROR;
+    }
+    if(vm->snap == NULL) {
+        vm->snap = malloc(sizeof(struct VM_SNAPSHOT));
+        if(vm->snap == NULL) {
+            return VM_LOAD_ERROR;
+        }
+    }
+    struct VM_SNAPSHOT *snap = vm->snap;
+    memcpy(snap->inst_mem, vm->inst_mem, INST_MEM_SIZE);
+    memcpy(snap->data_mem, vm->data_mem, DATA_MEM_SIZE);
+    memcpy(snap->heap, vm->heap, HEAP_SIZE);
+    snap->heap_alloc = vm->heap_alloc;
+    memcpy(snap->registers, vm->registers, sizeof(vm->registers));
+    snap->PC = vm->PC;
+    snap->insn_count = vm_insn_count(vm);
+    snap->code_gen = vm->code_gen;
+    snap->valid = 1;
+    mem_track_dirty(vm, 1);
+    return VM_OK;
+}
+
+int vm_restore(struct VM *vm) {
+    struct VM_SNAPSHOT *snap = vm->snap;
+    if(snap == NULL || !snap->valid) {
+        return VM_LOAD_ERROR;
+    }
+    for(uint32_t word = 0 ; word < MEM_PAGES/64 ; word++) {
+        uint64_t bits = vm->dirty[word];
+        while(bits) {
+            uint32_t index = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            memcpy((uint8_t *) vm + vm->pages[index].offset,
+                snap_page(snap, index << MEM_PAGE_BITS), MEM_PAGE_SIZE);
+            mem_track_page(vm, index, 1);
+        }
+        vm->dirty[word] = 0;
+    }
+    if(vm->code_gen != snap->code_gen) {
+        // self-modified code, the block cache notices the new code_gen and flushes
+        memcpy(vm->inst_mem, snap->inst_mem, INST_MEM_SIZE);
+        decode_all(vm);
+        snap->code_gen = vm->code_gen;
+    }
+    vm->heap_alloc = snap->heap_alloc;
+    memcpy(vm->registers, snap->registers, sizeof(vm->registers));
+    vm->PC = snap->PC;
+    // warm blocks keep their exec counts, so only the difference is set here
+    vm->insn_count = snap->insn_count - blocks_insn_count(vm);
+    vm->cur_block = NULL;
+    return VM_OK;
+}
+
+void snapshot_drop(struct VM *vm) {
+    if(vm->snap != NULL && vm->snap->valid) {
+        vm->snap->valid = 0;
+        mem_track_dirty(vm, 0);
+    }
+}
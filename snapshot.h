@@ -0,0 +1,8 @@
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+#include "structs_enums.h"
+
+// forget the snapshot and stop dirty tracking, for when the vm is reset or reloaded
+void snapshot_drop(struct VM *vm);
+
+#endif
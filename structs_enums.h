@@ -1,25 +1,180 @@
 #ifndef STRUCTS_ENUMS_H_
 #define STRUCTS_ENUMS_H_
 #include <stdint.h>
+#include <stdio.h>
+#include <setjmp.h>
 
 #define INST_MEM_SIZE 1024
 #define DATA_MEM_SIZE 1024
+#define IMAGE_SIZE (INST_MEM_SIZE + DATA_MEM_SIZE)
 #define HEAP_BANK_NUM 128
 #define HEAP_BANK_SIZE 64
+#define REG_SINK 32         // decoded writes to x0 land here so x0 always reads 0
+#define BLOCK_CODE_SIZE 1024    // decoded slots shared by all basic blocks
+#define LANES_MAX 16            // vms one vm_run_lanes gang runs together
 
-struct HEAP_BANK{
-    uint8_t heap_data[64];
-    int bytes_allocated;
+// guest address map
+#define DATA_MEM_START 0x0400
+#define MMIO_START 0x0800       // virtual routines
+#define MMIO_SIZE 0x0100
+#define HEAP_START 0xb700
+#define MEM_SPACE 0x10000       // addresses at or above this map to nothing
+#define MEM_PAGE_BITS 6         // one page per heap bank
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_BITS)
+#define MEM_PAGES (MEM_SPACE >> MEM_PAGE_BITS)
+
+#define HEAP_SIZE (HEAP_BANK_NUM * HEAP_BANK_SIZE)
+#define HEAP_BITMAP_WORDS ((HEAP_BANK_NUM + 63) / 64)
+
+// large memory profile (largemem.h): the small map above, then reserved space that only
+// takes host memory where the guest touches it
+#define LARGE_START 0x00010000          // MEM_SPACE, the first address the small map lacks
+#define LARGE_HEAP_START 0x04000000     // large data below, large heap from here
+#define LARGE_END 0x08000000
+#define LARGE_HEAP_BANK_SIZE 4096
+#define LARGE_HEAP_BANK_NUM ((LARGE_END - LARGE_HEAP_START) / LARGE_HEAP_BANK_SIZE)
+
+struct HEAP_STATS {
+    uint64_t mallocs;
+    uint64_t frees;
+    uint64_t failed_mallocs;
+    uint32_t banks_used;
+    uint32_t peak_banks_used;
+};
+
+// heap bank bookkeeping, kept apart from the bank data so allocations are contiguous
+struct HEAP_ALLOC {
+    uint64_t used[HEAP_BITMAP_WORDS];   // bit per bank, set while allocated
+    uint8_t run_len[HEAP_BANK_NUM];     // banks in the allocation starting here, 0 if none does
+    struct HEAP_STATS stats;
+};
+
+// pre-decoded instruction, one per instruction word of inst_mem
+struct DECODED {
+    uint8_t op;     // enum OP
+    uint8_t rd;
+    uint8_t rs1;
+    uint8_t rs2;
+    int32_t imm;    // sign-extended (zero-extended for sltiu)
+};
+
+// copy, fill or string scan loop found at load time (idiom.h), run as one host call
+enum IDIOM_KIND {
+    IDIOM_NONE,
+    IDIOM_COPY,     // load rv, ls(src); store rv, sd(dst); src += size; dst += size; loop on cmp vs end
+    IDIOM_FILL,     // store rv, sd(dst); dst += size; loop on dst vs end
+    IDIOM_STRLEN    // load byte rv, ls(src); src += 1; loop while rv != 0
+};
+
+struct IDIOM {
+    uint8_t kind;       // enum IDIOM_KIND, IDIOM_NONE unless the word heads a loop
+    uint8_t op;         // the head instruction's own operation
+    uint8_t len;        // instructions in the loop
+    uint8_t size;       // bytes moved per iteration
+    uint8_t rv, src, dst, end, cmp;     // registers as above, cmp is src or dst
+    uint8_t branch;     // OP_BNE or OP_BLTU
+    int32_t src_off;    // offsets from the pointers' values at the head, increments before
+    int32_t dst_off;    // the access already folded in
+};
+
+// straight-line run of instructions ending in a branch/jump or at the next leader
+struct BLOCK {
+    struct DECODED *code;       // copied instructions then a block end sentinel
+    struct BLOCK *taken;        // successor if the final branch/jump is taken
+    struct BLOCK *fallthrough;  // successor at the next sequential PC
+    void *native;               // jit translation, NULL until the block is hot
+    uint64_t exec_count;
+    uint64_t counted;           // exec_count already folded into vm->insn_count
+    uint32_t start_pc;
+    uint32_t taken_pc;
+    uint32_t fall_pc;
+    uint16_t len;
+    uint8_t built;
+    uint8_t no_jit;     // jit cannot translate this block, keep interpreting it
+};
+
+struct BLOCK_CACHE {
+    struct BLOCK blocks[INST_MEM_SIZE/4];    // indexed by start PC/4
+    uint8_t leader[INST_MEM_SIZE/4];
+    uint16_t built_list[INST_MEM_SIZE/4];    // indices of the built blocks, so counting skips the rest
+    uint32_t num_built;
+    struct DECODED code[BLOCK_CODE_SIZE];
+    uint32_t code_used;
+    uint32_t code_gen;  // vm->code_gen the blocks were built from
+    uint32_t flush_count;   // bumped each time every block is dropped
+};
+
+enum REGION {
+    REGION_NONE,
+    REGION_INST,
+    REGION_DATA,
+    REGION_MMIO,
+    REGION_HEAP
 };
 
+// page flags: accesses that can go straight to host memory
+#define PAGE_LOAD_DIRECT  0x1
+#define PAGE_STORE_DIRECT 0x2
+#define PAGE_TRACK_DIRTY  0x4   // next store marks the page dirty, then the page goes direct
+
+// one entry per MEM_PAGE_SIZE bytes of guest address space
+struct MEM_PAGE {
+    uint32_t offset;    // byte offset of the page's backing store from the start of struct VM
+    uint8_t region;     // enum REGION
+    uint8_t flags;
+};
+
+// jit translation buffer, translations are valid while flush_count matches the block cache's
+struct JIT {
+    uint8_t *buf;
+    size_t used;
+    uint32_t flush_count;   // vm->blocks.flush_count the translations belong to
+};
+
+struct OUT_STREAM;
+struct IN_STREAM;
+struct VM_SNAPSHOT;
+struct PROFILE;
+struct TRACE;
+struct HWCOUNTERS;
+struct LARGE_HEAP;
+struct SAMPLER;
+
 struct VM {
     uint8_t inst_mem[INST_MEM_SIZE];     // 1024/4 to as 4 bytes (32 bits) read in at once
-    uint32_t inst_lines[INST_MEM_SIZE/4];   // saves full lines of instruction
+    struct DECODED decoded[INST_MEM_SIZE/4];    // inst_mem decoded once at load time
+    struct IDIOM idioms[INST_MEM_SIZE/4];       // by head word, for decoded ops that are OP_IDIOM
     uint8_t data_mem[DATA_MEM_SIZE];
-    struct HEAP_BANK heap[HEAP_BANK_NUM];
-    uint32_t registers[32];
+    uint8_t heap[HEAP_SIZE];    // banks back to back
+    struct HEAP_ALLOC heap_alloc;
+    uint32_t registers[33];     // x0-x31 and the x0 write sink
     uint16_t PC;    
-    uint16_t PC_lines;  // PC for inst_lines
+    uint32_t code_gen;  // bumped whenever the guest stores into instruction memory
+    uint64_t insn_count;    // instructions run since the last reset, less what block exec counts still hold (vm_insn_count)
+    uint32_t limit_countdown;   // jumps/block entries left before limit_check runs
+    uint64_t insn_limit;        // vm_run stops once vm_insn_count reaches it, UINT64_MAX for no limit
+    uint64_t yield_at;          // vm_run suspends once vm_insn_count reaches it, UINT64_MAX for never
+    uint64_t timeout_ns;        // per vm_run, 0 for no limit
+    uint64_t deadline_ns;       // CLOCK_MONOTONIC time the running vm_run times out at, 0 for never
+    struct BLOCK *cur_block;    // block being run by a block engine, NULL for the threaded engine
+    struct MEM_PAGE pages[MEM_PAGES];
+    uint8_t *large_mem;     // LARGE_START..LARGE_END in the large profile, NULL in the small one
+    uint32_t large_span;    // its size, 0 in the small profile
+    struct LARGE_HEAP *large_heap;  // bank allocator for the large heap (largemem.h)
+    uint64_t dirty[MEM_PAGES/64];   // pages stored to since the last snapshot
+    struct VM_SNAPSHOT *snap;   // vm_snapshot's copy, NULL until the first one
+    struct PROFILE *profile;    // counters for --profile, NULL when not profiling (profile.h)
+    struct TRACE *trace;        // recording for --trace, NULL when not tracing (trace.h)
+    struct SAMPLER *sampler;    // --sample-profile's timer and samples, NULL when not sampling (sampler.h)
+    struct HWCOUNTERS *hw;      // host perf counters for --hwcounters, NULL when off (hwcounters.h)
+    struct OUT_STREAM *out;     // console output (output.h)
+    struct IN_STREAM *in;   // console input for R_CHAR/R_INT (input.h)
+    struct BLOCK_CACHE blocks;
+    struct JIT jit;     // translation buffer, mapped on the first jit run
+    uint8_t image[IMAGE_SIZE];  // memory image as loaded, vm_reset goes back to it
+    uint64_t load_ns;   // time the last vm_load/vm_load_image took
+    uint64_t run_ns;    // time the last vm_run took
+    jmp_buf exit_jmp;   // vm_run's frame, routines that end the program jump back here
 
 };
 
@@ -98,54 +253,102 @@ enum HEAP {
 
 };
 
-struct INST {
-    uint32_t line;
-    uint8_t opcode;
-    enum TYPE type;
-    char *name;
-    union {
-        struct INST_R {
-            uint8_t rd;
-            uint8_t func3;
-            uint8_t rs1;
-            uint8_t rs2;
-            uint8_t func7;
-        }R;
-        struct INST_I {
-            uint8_t rd;
-            uint8_t func3;
-            uint8_t rs1;
-            uint32_t imm; 
-            int32_t imm_signed;
-        }I;
-        struct INST_S {
-            uint32_t imm1;
-            uint8_t func3;
-            uint8_t rs1;
-            uint8_t rs2;
-            uint32_t imm2;
-            uint32_t imm;
-            int32_t imm_signed;
-        }S;
-        struct INST_SB {
-            uint32_t imm1;
-            uint8_t func3;
-            uint8_t rs1;
-            uint8_t rs2;
-            uint32_t imm2;
-            uint32_t imm;
-            int32_t imm_signed;
-        }SB;
-        struct INST_U {
-            uint8_t rd;
-            uint32_t imm;
-            int32_t imm_signed;
-        }U;
-        struct INST_UJ {
-            uint8_t rd;
-            uint32_t imm;
-            int32_t imm_signed;
-        }UJ;
-    }type_info;
+// what vm_run (and vm_load) return
+enum VM_STATUS {
+    VM_OK,                  // ran past the end of instruction memory
+    VM_HALT,                // HALT virtual routine
+    VM_NOT_IMPLEMENTED,     // instruction that does not decode
+    VM_ILLEGAL_OPERATION,
+    VM_LOAD_ERROR,
+    VM_INSN_LIMIT,          // ran its instruction budget (vm_set_limits)
+    VM_TIMEOUT,             // ran past its wall clock limit
+    VM_BLOCKED,             // suspended at an R_CHAR/R_INT with no input yet, vm_run resumes it
+    VM_YIELD                // suspended once vm_insn_count reached yield_at, vm_run resumes it
+};
+
+enum VM_MEMORY {
+    VM_MEMORY_SMALL,    // 1 KiB data, 8 KiB heap, nothing mapped at or above MEM_SPACE (default)
+    VM_MEMORY_LARGE     // plus the lazily committed LARGE_START..LARGE_END
 };
+
+// X(id, --engine= name); a serve request carries the position, so new engines go at the end
+#define ENGINE_LIST(X) \
+    X(BLOCKS, "blocks")         /* basic block interpreter (default) */ \
+    X(THREADED, "threaded")     /* one instruction per dispatch, no hooks at all */ \
+    X(JIT, "jit")               /* blocks, hot ones translated to x86-64 */ \
+    X(CHECKED, "checked")       /* threaded, stops exactly at --max-insns and polls --timeout */ \
+    X(TRACED, "traced")         /* checked, recording every instruction into vm->trace */ \
+    X(PROFILED, "profiled")     /* checked, counting every instruction into vm->profile */
+
+enum ENGINE {
+#define ENGINE_ENUM(id, name) ENGINE_##id,
+    ENGINE_LIST(ENGINE_ENUM)
+#undef ENGINE_ENUM
+    ENGINE_NUM
+};
+
+struct OPTIONS {
+    char *filename;
+    enum ENGINE engine;
+    int stats;          // print vm statistics to stderr at exit
+    int hwcounters;     // print host perf counters for the run to stderr at exit
+    enum VM_MEMORY memory;
+    char *batch;        // manifest of images to run instead of filename
+    char *serve;        // unix socket to serve requests on instead
+    int jobs;           // batch/serve worker threads, 0 for one per cpu
+    int lanes;          // batch images run together by the lane engine, 1 for none
+    char *profile;  // report path for --profile
+    char *sample_profile;   // report path for --sample-profile
+    uint32_t sample_hz;     // samples per second of cpu time
+    int sample_hz_set;      // --sample-hz was given
+    int lockstep;   // run opts->engine against the threaded engine
+    char *trace;    // record the run to this file
+    char *replay;   // trace to rebuild the state from instead of running an image
+    uint64_t replay_at;     // instructions to replay, UINT64_MAX for all of them
+    char *input;    // R_CHAR/R_INT read this file instead of stdin
+    uint64_t max_insns;     // instruction budget per run, 0 for none
+    uint64_t timeout_ms;    // wall clock limit per run, 0 for none
+    int aot;        // translate the image to C instead of running it
+    char *aot_out;  // path of the C file for --aot
+};
+
+enum OP {
+    OP_ADD,
+    OP_ADDI,
+    OP_SUB,
+    OP_LUI,
+    OP_XOR,
+    OP_XORI,
+    OP_OR,
+    OP_ORI,
+    OP_AND,
+    OP_ANDI,
+    OP_SLL,
+    OP_SRL,
+    OP_SRA,
+    OP_LB,
+    OP_LH,
+    OP_LW,
+    OP_LBU,
+    OP_LHU,
+    OP_SB,
+    OP_SH,
+    OP_SW,
+    OP_SLT,
+    OP_SLTI,
+    OP_SLTU,
+    OP_SLTIU,
+    OP_BEQ,
+    OP_BNE,
+    OP_BLT,
+    OP_BLTU,
+    OP_BGE,
+    OP_BGEU,
+    OP_JAL,
+    OP_JALR,
+    OP_IDIOM,   // first instruction of a loop idiom.c recognized, vm->idioms holds its real op
+    OP_INVALID
+};
+
+#define OP_NUM (OP_INVALID + 1)
 #endif
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "structs_enums.h"
+#include "riskxvii.h"
+#include "trace.h"
+
+// everything but stores, branches and invalid instructions writes rd
+const uint8_t trace_rd_mask[OP_NUM] = {
+    [OP_ADD] = 0x1f, [OP_ADDI] = 0x1f, [OP_SUB] = 0x1f, [OP_LUI] = 0x1f, [OP_XOR] = 0x1f,
+    [OP_XORI] = 0x1f, [OP_OR] = 0x1f, [OP_ORI] = 0x1f, [OP_AND] = 0x1f, [OP_ANDI] = 0x1f,
+    [OP_SLL] = 0x1f, [OP_SRL] = 0x1f, [OP_SRA] = 0x1f, [OP_LB] = 0x1f, [OP_LH] = 0x1f,
+    [OP_LW] = 0x1f, [OP_LBU] = 0x1f, [OP_LHU] = 0x1f, [OP_SLT] = 0x1f, [OP_SLTI] = 0x1f,
+    [OP_SLTU] = 0x1f, [OP_SLTIU] = 0x1f, [OP_JAL] = 0x1f, [OP_JALR] = 0x1f,
+    [OP_IDIOM] = 0x1f   // loads, or stores with rd set to REG_SINK by idiom.c
+};
+
+// a failed write drops the rest of the trace rather than the run
+void trace_flush(struct TRACE *trace) {
+    size_t done = 0;
+    while(done < trace->len && trace->fd >= 0) {
+        ssize_t written = write(trace->fd, trace->buf + done, trace->len - done);
+        if(written < 0 && errno == EINTR) {
+            continue;
+        }
+        if(written <= 0) {
+            close(trace->fd);
+            trace->fd = -1;
+            break;
+        }
+        done += written;
+    }
+    trace->len = 0;
+}
+
+uint8_t *trace_record_rare(struct TRACE *trace, struct VM *vm, uint8_t *p, uint32_t header) {
+    if(header & TRACE_R28) {
+        p = trace_varint(p, trace_zigzag(vm->registers[28] - trace->regs[28]));
+        trace->regs[28] = vm->registers[28];
+    }
+    if(header & TRACE_INPUT) {
+        p = trace_varint(p, trace_zigzag(trace->input));
+    }
+    return p;
+}
+
+void trace_end_run(struct VM *vm) {
+    // every instruction counts itself at dispatch, the one a routine left from is not recorded yet
+    struct TRACE *trace = vm->trace;
+    if(vm->insn_count - trace->start_count > trace->count) {
+        trace_record(vm, &vm->decoded[vm->PC / 4], 0);
+    }
+}
+
+// TRACE API (riskxvii.h)
+int vm_trace_start(struct VM *vm, const char *path) {
+    struct TRACE *trace = calloc(1, sizeof(struct TRACE));
+    if(trace == NULL) {
+        return 1;
+    }
+    trace->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(trace->fd < 0) {
+        free(trace);
+        return 1;
+    }
+    // the reader starts from the image with zeroed registers at pc 0, as vm_reset leaves the vm
+    trace->start_count = vm->insn_count;
+    uint32_t version = TRACE_VERSION;
+    memcpy(trace->buf, TRACE_MAGIC, 4);
+    memcpy(trace->buf + 4, &version, 4);
+    memcpy(trace->buf + 8, vm->image, IMAGE_SIZE);
+    trace->len = 8 + IMAGE_SIZE;
+    vm->trace = trace;
+    return 0;
+}
+
+uint64_t vm_trace_stop(struct VM *vm) {
+    struct TRACE *trace = vm->trace;
+    if(trace == NULL) {
+        return 0;
+    }
+    trace_end_run(vm);
+    trace_flush(trace);
+    if(trace->fd >= 0) {
+        close(trace->fd);
+    }
+    uint64_t count = trace->count;
+    free(trace);
+    vm->trace = NULL;
+    return count;
+}
+
+// TRACE READER (trace.h)
+static int read_varint(FILE *file, uint32_t *value) {
+    uint32_t result = 0;
+    for(int shift = 0 ; shift < 35 ; shift += 7) {
+        int byte = getc_unlocked(file);
+        if(byte == EOF) {
+            return 0;
+        }
+        result |= (uint32_t) (byte & 0x7f) << shift;
+        if(!(byte & 0x80)) {
+            *value = result;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int32_t unzigzag(uint32_t value) {
+    return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+int trace_open(struct TRACE_READER *reader, const char *path) {
+    memset(reader, 0, sizeof(*reader));
+    reader->file = fopen(path, "rb");
+    if(reader->file == NULL) {
+        return 1;
+    }
+    setvbuf(reader->file, NULL, _IOFBF, 1 << 20);
+    char magic[4];
+    uint32_t version;
+    if(fread(magic, 1, 4, reader->file) != 4 || memcmp(magic, TRACE_MAGIC, 4) != 0
+            || fread(&version, 4, 1, reader->file) != 1 || version != TRACE_VERSION
+            || fread(reader->image, 1, IMAGE_SIZE, reader->file) != IMAGE_SIZE) {
+        fclose(reader->file);
+        reader->file = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+int trace_next(struct TRACE_READER *reader) {
+    uint32_t header, value;
+    if(!read_varint(reader->file, &header)) {
+        return 0;
+    }
+    reader->pc = reader->next_pc;
+    reader->next_pc = reader->pc + 4;
+    if(header & TRACE_PC_JUMP) {
+        if(!read_varint(reader->file, &value)) {
+            return 0;
+        }
+        reader->next_pc += unzigzag(value);
+    }
+    uint32_t rd = header & 0x1f;
+    if(rd != 0) {
+        if(!read_varint(reader->file, &value)) {
+            return 0;
+        }
+        reader->regs[rd] += unzigzag(value);
+    }
+    if(header & TRACE_STORE) {
+        uint32_t delta;
+        if(!read_varint(reader->file, &delta) || !read_varint(reader->file, &reader->store_value)) {
+            return 0;
+        }
+        reader->store_addr = reader->prev_store + unzigzag(delta);
+        reader->prev_store = reader->store_addr;
+    }
+    if(header & TRACE_R28) {
+        if(!read_varint(reader->file, &value)) {
+            return 0;
+        }
+        reader->regs[28] += unzigzag(value);
+    }
+    if(header & TRACE_INPUT) {
+        if(!read_varint(reader->file, &value)) {
+            return 0;
+        }
+        reader->input = unzigzag(value);
+    }
+    reader->flags = header;
+    reader->count++;
+    return 1;
+}
+
+void trace_close(struct TRACE_READER *reader) {
+    if(reader->file != NULL) {
+        fclose(reader->file);
+        reader->file = NULL;
+    }
+}
@@ -0,0 +1,153 @@
+#ifndef TRACE_H_
+#define TRACE_H_
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "structs_enums.h"
+
+// EXECUTION TRACE (trace.c)
+// file: "RXVT", version (u32 little endian), the IMAGE_SIZE byte image, then one record per
+// instruction in the order they ran, the first at pc 0. A record is a varint header rd | flags,
+// followed by the fields its flags ask for, in this order, each a varint and signed ones
+// zigzag encoded:
+//   TRACE_PC_JUMP   next pc - (pc + 4), without it the next instruction is at pc + 4
+//   rd != 0         new R[rd] - old R[rd]
+//   TRACE_STORE     address - previous store address, then the stored value
+//   TRACE_R28       new R[28] - old R[28], set by malloc
+//   TRACE_INPUT     value R_CHAR/R_INT read
+#define TRACE_MAGIC "RXVT"
+#define TRACE_VERSION 1
+
+#define TRACE_PC_JUMP   (1 << 5)
+#define TRACE_STORE     (1 << 6)
+#define TRACE_SIZE_SHIFT 7      // 2 bits, store of 1 << size bytes
+#define TRACE_R28       (1 << 9)
+#define TRACE_INPUT     (1 << 10)
+
+#define TRACE_BUFFER_SIZE (1 << 20)     // encoded records written out at a time
+#define TRACE_RECORD_MAX 48     // longest record plus trace_varint's slack
+
+struct TRACE {
+    int fd;     // -1 once a write failed
+    uint8_t buf[TRACE_BUFFER_SIZE];
+    size_t len;
+    uint32_t regs[32];      // registers as a reader will have them, deltas are against these
+    uint32_t prev_store;
+    uint64_t count;         // records written
+    uint64_t start_count;   // vm->insn_count when tracing started
+    // what the running instruction did besides writing rd, set by the hooks below
+    uint32_t flags;
+    uint32_t store_addr;
+    uint32_t store_value;
+    int32_t input;
+};
+
+// 0x1f for operations that write rd, 0 for the rest, so rd & mask is what a record carries
+extern const uint8_t trace_rd_mask[OP_NUM];
+
+void trace_flush(struct TRACE *trace);
+
+// after a run: record the instruction a virtual routine or error ended the run in
+void trace_end_run(struct VM *vm);
+
+// the fields after the register write, rare enough to stay out of line
+uint8_t *trace_record_rare(struct TRACE *trace, struct VM *vm, uint8_t *p, uint32_t header);
+
+// up to 5 bytes assembled in a register and stored at once, the buffer keeps 8 bytes of slack
+static inline uint8_t *trace_varint(uint8_t *p, uint32_t value) {
+    uint64_t bytes = 0;
+    int n = 0;
+    while(value >= 0x80) {
+        bytes |= (uint64_t) ((value & 0x7f) | 0x80) << (8 * n++);
+        value >>= 7;
+    }
+    bytes |= (uint64_t) value << (8 * n);
+    memcpy(p, &bytes, 8);
+    return p + n + 1;
+}
+
+static inline uint32_t trace_zigzag(int32_t value) {
+    return ((uint32_t) value << 1) ^ (uint32_t) (value >> 31);
+}
+
+// at the end of each instruction, jump is the next pc - (pc + 4)
+static inline void trace_record(struct VM *vm, struct DECODED *inst, uint32_t jump) {
+    struct TRACE *trace = vm->trace;
+    // everything is read before the first byte goes out, byte stores may alias any of it
+    uint32_t rd = inst->rd & trace_rd_mask[inst->op];     // REG_SINK & 0x1f is 0
+    uint32_t header = rd | trace->flags;
+    uint32_t value = vm->registers[rd];
+    uint32_t delta = value - trace->regs[rd];
+    uint8_t *p = trace->buf + trace->len;
+    if(jump != 0) {
+        header |= TRACE_PC_JUMP;
+    }
+    // regs[0] stays 0 as x0 does
+    trace->regs[rd] = value;
+    trace->count++;
+    p = trace_varint(p, header);
+    if(jump != 0) {
+        p = trace_varint(p, trace_zigzag(jump));
+    }
+    if(rd != 0) {
+        p = trace_varint(p, trace_zigzag(delta));
+    }
+    if(header & TRACE_STORE) {
+        p = trace_varint(p, trace_zigzag(trace->store_addr - trace->prev_store));
+        p = trace_varint(p, trace->store_value);
+        trace->prev_store = trace->store_addr;
+        trace->flags = 0;
+    }
+    if(header & (TRACE_R28 | TRACE_INPUT)) {
+        p = trace_record_rare(trace, vm, p, header);
+        trace->flags = 0;
+    }
+    trace->len = p - trace->buf;
+    if(trace->len > TRACE_BUFFER_SIZE - TRACE_RECORD_MAX) {
+        trace_flush(trace);
+    }
+}
+
+static inline void trace_store(struct VM *vm, struct DECODED *inst, int num_bytes) {
+    struct TRACE *trace = vm->trace;
+    uint32_t value = vm->registers[inst->rs2];
+    trace->store_addr = vm->registers[inst->rs1] + inst->imm;
+    trace->store_value = num_bytes == 4 ? value : value & ((1u << (num_bytes * 8)) - 1);
+    trace->flags |= TRACE_STORE | (num_bytes >> 1) << TRACE_SIZE_SHIFT;
+    if(trace->store_addr == HEAP_MALLOC) {
+        trace->flags |= TRACE_R28;      // malloc answers in R28
+    }
+}
+
+static inline void trace_input(struct VM *vm, int32_t value) {
+    if(vm->trace != NULL) {
+        vm->trace->flags |= TRACE_INPUT;
+        vm->trace->input = value;
+    }
+}
+
+// TRACE READER
+struct TRACE_READER {
+    FILE *file;
+    uint8_t image[IMAGE_SIZE];
+    uint32_t regs[32];
+    uint32_t pc;        // of the last record read
+    uint32_t next_pc;
+    uint32_t prev_store;
+    uint64_t count;     // records read
+    // effects of the last record
+    uint32_t flags;
+    uint32_t store_addr;
+    uint32_t store_value;
+    int32_t input;
+};
+
+// 0 if path is a trace, the image is in reader->image
+int trace_open(struct TRACE_READER *reader, const char *path);
+
+// next instruction's record applied to reader->regs, 0 at the end of the trace
+int trace_next(struct TRACE_READER *reader);
+
+void trace_close(struct TRACE_READER *reader);
+
+#endif
@@ -1,7 +1,13 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "structs_enums.h"
 #include "readfile.h"
@@ -9,38 +15,86 @@
 #include "store_load_helper.h"
 #include "vir_routine.h"
 #include "heap.h"
+#include "decode.h"
+#include "interp.h"
+#include "blocks.h"
+#include "jit.h"
+#include "memory.h"
+#include "output.h"
+#include "input.h"
+#include "riskxvii.h"
+#include "exec_helpers.h"
+#include "snapshot.h"
+#include "profile.h"
+#include "sampler.h"
+#include "hwcounters.h"
+#include "largemem.h"
+#include "trace.h"
 
 
 // FILE HANDLING FUNCTIONS (readfile.h)
-void read_file_into_mem(struct VM *vm, char *filename) {
-    FILE *file = fopen(filename, "rb");
-    if(file == NULL) {
-        printf("File does not exist\n");
-    }
-    // read instruction mem byte by byte
-    int read_num = fread(vm->inst_mem, 1, INST_MEM_SIZE, file);
-
-    int read_num2 = fread(vm->data_mem, 1, DATA_MEM_SIZE, file);
-
-    if(read_num != DATA_MEM_SIZE || read_num2 != DATA_MEM_SIZE) {
-        printf("fread error\n");
+// read until len bytes or end of input, returns the number of bytes read
+static size_t read_upto(int fd, uint8_t *buf, size_t len) {
+    size_t total = 0;
+    while(total < len) {
+        ssize_t got = read(fd, buf + total, len - total);
+        if(got < 0 && errno == EINTR) {
+            continue;
+        }
+        if(got <= 0) {
+            break;
+        }
+        total += got;
     }
-    fclose(file);
+    return total;
 }
 
+// the reason goes out on the vm's own console, so a batch job's output or a daemon reply
+// carries it instead of the process stdout
+static int load_error(struct VM *vm, const char *format, ...) {
+    char message[128];
+    va_list args;
+    va_start(args, format);
+    int len = vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    out_write(vm->out, message, len < (int) sizeof(message) ? len : (int) sizeof(message) - 1);
+    out_flush(vm->out);
+    return VM_LOAD_ERROR;
+}
 
-// get full instruction lines
-void get_inst_lines(struct VM *vm, char *filename) {
-    FILE *file = fopen(filename, "rb");
-    if(file == NULL) {
-        printf("File does not exist\n");
+// the whole image into vm->image from one open, "-" reads it from stdin;
+// returns VM_OK, or VM_LOAD_ERROR after writing the problem to the vm's output
+int read_image(struct VM *vm, const char *filename) {
+    size_t size;
+    if(strcmp(filename, "-") == 0) {
+        // read past stdio, whatever follows the image is left on the descriptor for R_CHAR/R_INT
+        size = read_upto(STDIN_FILENO, vm->image, IMAGE_SIZE);
     }
-    int read_num = fread(vm->inst_lines, 4, INST_MEM_SIZE/4, file);
-
-    if(read_num != INST_MEM_SIZE/4) {
-        printf("fread error\n");
+    else {
+        int fd = open(filename, O_RDONLY);
+        if(fd < 0) {
+            return load_error(vm, "File does not exist\n");
+        }
+        struct stat st;
+        if(fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size != IMAGE_SIZE) {
+            close(fd);
+            return load_error(vm, "Invalid image size: %lld bytes\n", (long long) st.st_size);
+        }
+        // one extra byte tells an oversized pipe apart from an exact one
+        uint8_t extra;
+        size = read_upto(fd, vm->image, IMAGE_SIZE);
+        if(size == IMAGE_SIZE && read_upto(fd, &extra, 1) != 0) {
+            size++;
+        }
+        close(fd);
+    }
+    if(size > IMAGE_SIZE) {
+        return load_error(vm, "Invalid image size: more than %d bytes\n", IMAGE_SIZE);
     }
-    fclose(file);
+    if(size < IMAGE_SIZE) {
+        return load_error(vm, "Invalid image size: %zu bytes\n", size);
+    }
+    return VM_OK;
 }
 
 
@@ -143,764 +197,395 @@ enum TYPE inst_type(uint8_t opcode) {
 }
 
 
-// ARITHMETIC AND LOGIC OPERATIONS
-void add(struct VM *vm, uint8_t rd, uint8_t rs1, uint8_t rs2) {
-    vm->registers[rd] = vm->registers[rs1] + vm->registers[rs2];
+// STORE AND LOAD HELPERS (store_load_helper.h)
+int32_t sext(uint32_t val, int num_bits) {
+    // >> is logical shift
+    int32_t sign_ext = (int32_t) (val << (32-num_bits)) >> (32-num_bits);
+    return sign_ext;
 }
 
-void addi(struct VM *vm, uint8_t rd, uint8_t rs1, uint32_t imm) {
-    vm->registers[rd] = vm->registers[rs1] + imm;
+// VIRTUAL ROUTINE FUNCTIONS (vir_routine.h)
+void w_char(struct VM *vm, uint32_t value, int num_bits) {
+    out_putc(vm->out, extract_bits(value, num_bits-1, 0));
 }
 
-void sub(struct VM *vm, uint8_t rd, uint8_t rs1, uint8_t rs2) {
-    vm->registers[rd] = vm->registers[rs1] - vm->registers[rs2];
+void w_int(struct VM *vm, uint32_t value, int num_bits) {
+    out_dec(vm->out, extract_bits(value, num_bits-1, 0));
 }
 
-void lui(struct VM *vm, uint8_t rd, uint32_t imm) {
-    vm->registers[rd] = imm;
+void w_uint(struct VM *vm, uint32_t value, int num_bits) {
+    out_hex(vm->out, extract_bits(value, num_bits-1, 0), 1);
 }
 
-void xor(struct VM *vm, uint8_t rd, uint8_t rs1, uint8_t rs2) {
-    vm->registers[rd] = vm->registers[rs1] ^ vm->registers[rs2];
+void halt(struct VM *vm) {
+    out_write(vm->out, "CPU Halt Requested\n", 19);
+    vm_exit(vm, VM_HALT);
 }
 
-void xori(struct VM *vm, uint8_t rd, uint8_t rs1, uint32_t imm) {
-    vm->registers[rd] = vm->registers[rs1] ^ imm;
+void dump_PC(struct VM *vm) {
+    out_write(vm->out, "0x", 2);
+    out_hex(vm->out, vm->PC, 4);
 }
 
-void or(struct VM *vm, uint8_t rd, uint8_t rs1, uint8_t rs2) {
-    vm->registers[rd] = vm->registers[rs1] | vm->registers[rs2];
+void dump_reg(struct VM *vm) {
+    // 33 lines formatted into one buffer, one write
+    char buf[33 * 24];
+    size_t len = 0;
+    memcpy(&buf[len], "PC = 0x", 7);
+    len += 7;
+    len += fmt_hex(&buf[len], vm->PC, 8);
+    memcpy(&buf[len], ";\n", 2);
+    len += 2;
+    for(int i = 0 ; i < 32 ; i++) {
+        memcpy(&buf[len], "R[", 2);
+        len += 2;
+        len += fmt_dec(&buf[len], i);
+        memcpy(&buf[len], "] = 0x", 6);
+        len += 6;
+        len += fmt_hex(&buf[len], vm->registers[i], 8);
+        memcpy(&buf[len], ";\n", 2);
+        len += 2;
+    }
+    out_write(vm->out, buf, len);
 }
 
-void ori(struct VM *vm, uint8_t rd, uint8_t rs1, uint32_t imm) {
-    vm->registers[rd] = vm->registers[rs1] | imm;
+void dump_mem(struct VM *vm, uint32_t value) {
+    out_hex(vm->out, value, 8);
 }
 
-void and(struct VM *vm, uint8_t rd, uint8_t rs1, uint8_t rs2) {
-    vm->registers[rd] = vm->registers[rs1] & vm->registers[rs2];
+// guest hit an instruction that does not decode
+void inst_not_implemented(struct VM *vm) {
+    out_write(vm->out, "Instruction Not Implemented: 0x", 31);
+    out_hex(vm->out, inst_line(vm, vm->PC / 4), 8);
+    out_putc(vm->out, '\n');
+    dump_reg(vm);
+    vm_exit(vm, VM_NOT_IMPLEMENTED);
 }
 
-void andi(struct VM *vm, uint8_t rd, uint8_t rs1, uint32_t imm) {
-    vm->registers[rd] = vm->registers[rs1] & imm;
+// guest did something the spec forbids, e.g. freeing memory it does not own
+void illegal_operation(struct VM *vm) {
+    out_write(vm->out, "Illegal Operation: 0x", 21);
+    out_hex(vm->out, inst_line(vm, vm->PC / 4), 8);
+    out_putc(vm->out, '\n');
+    dump_reg(vm);
+    vm_exit(vm, VM_ILLEGAL_OPERATION);
 }
 
-// STORE AND LOAD HELPERS (store_load_helper.h)
-// store mem bytes
-void store_mem_bytes(struct VM *vm, uint8_t rs1, int imm, uint32_t val, int num_bytes) {
-    uint32_t addr = vm->registers[rs1] + imm - 0x0400;
-    uint32_t heap_addr = ((addr+0x0400)-0xb700)/64;
-    int32_t val2 = (int32_t) val;
-    for(int i = 0 ; i < num_bytes ; i++) {
-        if (addr <= 0x0400) {
-            vm->data_mem[addr+i] = extract_bits(val2, (8*(i+1))-1, 8*i);
-        }
-        else {
-            // store in bank
-            vm->heap[heap_addr].heap_data[i] = extract_bits(val2, (8*(i+1))-1, 8*i);
-        }
-    }
+// input routines parse vm->in's buffer, it flushes output before a read that would block so
+// prompts are visible; no input reads as 0
+uint32_t r_char(struct VM *vm) {
+    uint32_t char_code = in_char(vm->in);
+    trace_input(vm, char_code);
+    return char_code;
 }
 
-int32_t sext(uint32_t val, int num_bits) {
-    // >> is logical shift
-    int32_t sign_ext = (int32_t) (val << (32-num_bits)) >> (32-num_bits);
-    return sign_ext;
+int32_t r_int(struct VM *vm) {
+    int32_t scanned_int = in_int(vm->in);
+    trace_input(vm, scanned_int);
+    return scanned_int;
 }
 
-// get register value (load instructions)
-uint32_t get_rs_val(struct VM *vm, uint8_t rs1, int imm) {
-    uint32_t addr = vm->registers[rs1] + imm;
-    if(addr >= 0x0400 && addr <= 0x7ff) {
-        return vm->data_mem[addr - 0x0400];
-    }
-    else if (addr <= 0x3ff) {
-        return vm->inst_mem[addr];
-    }
-    else if(addr >= 0xb700) {
-        uint32_t starting_index = ((addr-0xb700)-((addr-0xb700)%64))/64;
-        return vm->heap[starting_index].heap_data[(addr-0xb700)%64];
-    }
-    return 0;
+// LIMITS (exec_helpers.h)
+static uint64_t monotonic_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000000000ull + now.tv_nsec;
 }
 
-
-// get memory data according to number of bytes
-uint32_t get_mem_bytes(struct VM *vm, uint8_t rs1, int imm, int num_bytes) {
-    uint32_t full_data = 0;
-    for(int i = 0 ; i < num_bytes ; i++) {
-        // shift each byte to get correct value
-        // uint32_t new_byte = get_rs_val(vm, rs1, (imm+i)) << ((num_bytes-i-1)*8);
-        uint32_t new_byte = get_rs_val(vm, rs1, (imm+i)) << (i*8);
-        full_data = full_data | new_byte;
-    }
-    return full_data;
+// vm->PC is the instruction that would have run next
+static _Noreturn void limit_exceeded(struct VM *vm, int status, const char *message, size_t len) {
+    out_write(vm->out, message, len);
+    dump_reg(vm);
+    vm_exit(vm, status);
 }
 
-
-// VIRTUAL ROUTINE FUNCTIONS (vir_routine.h)
-// check if store command vr
-uint32_t is_store_vr(char *inst_name, uint8_t rs1, int imm, struct VM *vm) {
-    if(strcmp(inst_name, "sb") == 0 || strcmp(inst_name, "sh") == 0 || strcmp(inst_name, "sw") == 0) {
-        uint32_t addr = vm->registers[rs1] + imm;
-        // printf("index in func: %x\n", addr);
-        // check if address is virtual routine
-        if(addr == VIR_W_CHAR || addr == VIR_W_INT || addr == VIR_W_UINT || 
-        addr == VIR_HALT || addr == VIR_DUMP_PC || addr == VIR_DUMP_REG || addr == VIR_DUMP_MEM) {
-            return addr;
-        }
+void limit_check(struct VM *vm) {
+    uint64_t count = vm_insn_count(vm);
+    if(count >= vm->insn_limit) {
+        limit_exceeded(vm, VM_INSN_LIMIT, "Instruction Limit Exceeded\n", 27);
     }
-    return 0;
-}
-
-// check if load command vr
-uint32_t is_load_vr(char *inst_name, uint8_t rs1, int imm, struct VM *vm) {
-    if(strcmp(inst_name, "lb") == 0 || strcmp(inst_name, "lh") == 0 || strcmp(inst_name, "lw") == 0 || strcmp(inst_name, "lbu") == 0 || strcmp(inst_name, "lhu") == 0) {
-        uint32_t addr = vm->registers[rs1] + imm;
-        if(addr == VIR_R_CHAR || addr == VIR_R_INT) {
-            return addr;
+    if(count >= vm->yield_at) {
+        // nothing at PC has run or been counted yet, so vm_run can simply start there again
+        out_flush(vm->out);
+        longjmp(vm->exit_jmp, VM_YIELD);
+    }
+    uint64_t ticks = UINT32_MAX;
+    if(vm->deadline_ns != 0) {
+        // the clock is read once per LIMIT_POLL_TICKS jumps and block entries
+        if(monotonic_ns() >= vm->deadline_ns) {
+            limit_exceeded(vm, VM_TIMEOUT, "Time Limit Exceeded\n", 20);
         }
+        ticks = LIMIT_POLL_TICKS;
     }
-    return 0;
+    // a tick runs at most all of instruction memory before the next one, so this many cannot
+    // overrun the budget or the quantum by more than that
+    uint64_t stop = vm->insn_limit < vm->yield_at ? vm->insn_limit : vm->yield_at;
+    uint64_t safe = (stop - count) / (INST_MEM_SIZE / 4);
+    vm->limit_countdown = safe == 0 ? 1 : safe < ticks ? safe : ticks;
 }
 
+// LIBRARY API (riskxvii.h)
+// leave vm_run from inside a virtual routine with status
+_Noreturn void vm_exit(struct VM *vm, int status) {
+    // the instruction at PC was the last one to run
+    uncount_rest(vm, vm->PC + 4);
+    out_flush(vm->out);
+    longjmp(vm->exit_jmp, status);
+}
 
-int get_num_bits(char *inst_name) {
-    if(strcmp("sb", inst_name)==0 || strcmp("lb", inst_name)==0 || strcmp("lbu", inst_name)==0) {
-        return 8;
-    }
-    if(strcmp("sh", inst_name)==0 || strcmp("lh", inst_name)==0 || strcmp("lhu", inst_name)==0) {
-        return 16;
+// leave vm_run from inside a virtual routine as if the instruction at PC had not run yet
+_Noreturn void vm_suspend(struct VM *vm, int status) {
+    // a block engine counted it with the rest of its block, the threaded one at dispatch
+    if(vm->cur_block != NULL) {
+        uncount_rest(vm, vm->PC);
     }
-    if(strcmp("sw", inst_name)==0 || strcmp("lw", inst_name)==0 || strcmp("lwu", inst_name)==0) {
-        return 32;
+    else {
+        vm->insn_count--;
     }
-    return 0;
+    out_flush(vm->out);
+    longjmp(vm->exit_jmp, status);
 }
 
-void w_char(uint32_t value, char *inst_name) {
-    int num_bits = get_num_bits(inst_name);
-    printf("%c", extract_bits(value, num_bits-1, 0));
+struct VM *vm_create(void) {
+    struct VM *vm = calloc(1, sizeof(struct VM));
+    if(vm == NULL) {
+        return NULL;
+    }
+    vm->out = malloc(sizeof(struct OUT_STREAM));
+    vm->in = malloc(sizeof(struct IN_STREAM));
+    if(vm->out == NULL || vm->in == NULL) {
+        free(vm->out);
+        free(vm->in);
+        free(vm);
+        return NULL;
+    }
+    mem_init(vm);
+    vm->insn_limit = UINT64_MAX;
+    vm->yield_at = UINT64_MAX;
+    vm->limit_countdown = UINT32_MAX;
+    in_open_file(vm->in, stdin, vm->out);
+    out_open(vm->out, 1, 0);
+    vm_reset(vm);
+    return vm;
 }
 
-void w_int(uint32_t value, char *inst_name) {
-    int num_bits = get_num_bits(inst_name);
-    printf("%d", extract_bits(value, num_bits-1, 0));
+// output is flushed and its stream reopened, the caller keeps ownership of in and out_fd
+void vm_set_io(struct VM *vm, FILE *in, int out_fd, int threaded_out) {
+    out_close(vm->out);
+    in_close(vm->in);
+    in_open_file(vm->in, in, vm->out);
+    out_open(vm->out, out_fd, threaded_out);
 }
 
-void w_uint(uint32_t value, char *inst_name) {
-    int num_bits = get_num_bits(inst_name);
-    printf("%x", extract_bits(value, num_bits-1, 0));
+void vm_set_limits(struct VM *vm, uint64_t max_insns, uint64_t timeout_ms) {
+    vm->insn_limit = max_insns != 0 ? max_insns : UINT64_MAX;
+    vm->timeout_ns = timeout_ms * 1000000ull;
 }
 
-void halt() {
-    printf("CPU Halt Requested\n");
-    exit(0);
+int vm_set_input(struct VM *vm, const char *path) {
+    in_close(vm->in);
+    return in_open_path(vm->in, path, vm->out);
 }
 
-void dump_PC(uint16_t PC) {
-    printf("0x%04x", PC);
+static uint64_t elapsed_ns(struct timespec *start) {
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) * 1000000000ull + end.tv_nsec - start->tv_nsec;
 }
 
-void dump_reg(struct VM *vm) {
-    printf("PC = 0x%08x;\n", vm->PC);
-    for(int i = 0 ; i < 32 ; i++) {
-        printf("R[%d] = 0x%08x;\n", i, vm->registers[i]);
+int vm_load(struct VM *vm, const char *filename) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int status = read_image(vm, filename);
+    if(status == VM_OK) {
+        vm_reset(vm);
     }
+    vm->load_ns = elapsed_ns(&start);
+    return status;
 }
 
-void dump_mem(uint32_t value) {
-    printf("%08x", value);
-}
-
-uint32_t r_char() {
-    uint32_t char_code;
-    scanf("%lc", &char_code);
-    return char_code;
-}
-
-int32_t r_int() {
-    int32_t scanned_int;
-    scanf("%d", &scanned_int);
-    return scanned_int;
-} 
-
-int exe_store_vr(struct INST *inst, struct VM *vm) {
-    if(inst->type == TYPE_S && is_store_vr(inst->name, inst->type_info.S.rs1, inst->type_info.S.imm_signed, vm) != 0) {
-        uint32_t addr = is_store_vr(inst->name, inst->type_info.S.rs1, inst->type_info.S.imm_signed, vm);
-        switch(addr) {
-            case VIR_HALT:
-                halt();
-                break;
-            case VIR_W_CHAR:
-                w_char(vm->registers[inst->type_info.S.rs2], inst->name);
-                break;
-            case VIR_W_INT:
-                w_int(vm->registers[inst->type_info.S.rs2], inst->name);
-                break;
-            case VIR_W_UINT:
-                w_uint(vm->registers[inst->type_info.S.rs2], inst->name);
-                break;
-            case VIR_DUMP_MEM:
-                // get M[v] with v being R[rs2] then offset index
-                dump_mem(vm->data_mem[vm->registers[inst->type_info.S.rs2] - 0x0400]);
-                break;
-            case VIR_DUMP_PC:
-                dump_PC(vm->PC);
-                break;
-            case VIR_DUMP_REG:
-                dump_reg(vm);
-                break;
-
-        }
-        return 1;
-    } 
-    else {
-        return 0;
+int vm_load_image(struct VM *vm, const uint8_t *image, size_t size) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if(size != IMAGE_SIZE) {
+        return load_error(vm, "Invalid image size: %zu bytes\n", size);
     }
+    memcpy(vm->image, image, IMAGE_SIZE);
+    vm_reset(vm);
+    vm->load_ns = elapsed_ns(&start);
+    return VM_OK;
 }
 
-// HEAP BANK FUNCTIONS
-uint32_t is_heap(char *inst_name, uint8_t rs1, int imm, struct VM *vm) {
-    if(strcmp(inst_name, "sb") == 0 || strcmp(inst_name, "sh") == 0 || strcmp(inst_name, "sw") == 0) {
-        uint32_t addr = vm->registers[rs1] + imm;
-        // check if address is virtual routine
-        if(addr == HEAP_MALLOC || addr == HEAP_FREE) {
-            return addr;
-        }
+// back to the state right after vm_load: image memory, empty heap, zeroed registers
+void vm_reset(struct VM *vm) {
+    snapshot_drop(vm);
+    if(vm->profile != NULL) {
+        vm->profile->cur = 0;
     }
-    return 0;
-}
-
-uint32_t malloc_heap(struct VM *vm, uint32_t num_bytes) {
-    // invalid index 65
-    uint32_t start_index = 65;
-    int num_banks = ((num_bytes-(num_bytes%64))/64 )+1;
-    for(int i = 0 ; i < HEAP_BANK_NUM-num_banks ; i++) {
-        for(int j = 0; j < num_banks ; j++) {
-            if(vm->heap[i+j].bytes_allocated != 0) {
-                break;
-            }
-            else if(j == (num_banks-1)) {
-                start_index = i;
-            }
-        }
-        if(start_index != 65) {
-            // allocate the banks
-            for(int k = start_index ; k < (num_banks+start_index) ; k++) {
-                if((num_bytes%64 !=0) && (k == (num_banks+start_index-1))) {
-                    vm->heap[k].bytes_allocated = num_bytes%64;
-                }
-                vm->heap[k].bytes_allocated = 64;
-            }
-            break;
-        }
+    if(vm->sampler != NULL) {
+        vm->sampler->depth = 0;
     }
-    return start_index;
+    // vm->image is the only copy of the file, both memory regions come from it
+    memcpy(vm->inst_mem, vm->image, INST_MEM_SIZE);
+    memcpy(vm->data_mem, vm->image + INST_MEM_SIZE, DATA_MEM_SIZE);
+    memset(vm->heap, 0, HEAP_SIZE);
+    heap_init(vm);
+    large_reset(vm);
+    memset(vm->registers, 0, sizeof(vm->registers));
+    vm->insn_count = 0;
+    vm->cur_block = NULL;
+    vm->PC = 0x0000;
+    decode_all(vm);
+    blocks_init(vm);
 }
 
-int exe_heap(struct INST *inst, struct VM *vm) {
-    uint32_t addr = is_heap(inst->name, inst->type_info.S.rs1, inst->type_info.S.imm_signed, vm);
-    if(addr == 0) {
-        return 0;
-    } 
-    if(addr == HEAP_MALLOC){
-        uint32_t start_index = malloc_heap(vm, vm->registers[inst->type_info.S.rs2]);
-        if(start_index == 65) {
-            vm->registers[28] = 0;
-        }
-        // get mapped address
-        uint32_t ptr = 0xb700 + (start_index*64);
-        // store mapped addr
-        vm->registers[28] = ptr;
-        return 1;
-        
+static int is_limited(struct VM *vm) {
+    return vm->insn_limit != UINT64_MAX || vm->timeout_ns != 0 || vm->yield_at != UINT64_MAX;
+}
+
+// tracing and profiling need every instruction, only the threaded variants see them one by one;
+// the plain threaded variant has no limit checks, and the recording ones have nothing to record
+// into without a trace or profile; sampling keeps its shadow stack in the blocks engine
+static enum ENGINE pick_variant(struct VM *vm, enum ENGINE engine) {
+    if(vm->trace != NULL) {
+        return ENGINE_TRACED;
+    }
+    if(vm->profile != NULL) {
+        return ENGINE_PROFILED;
+    }
+    if(vm->sampler != NULL) {
+        return ENGINE_BLOCKS;
+    }
+    if((engine == ENGINE_THREADED && is_limited(vm)) || engine == ENGINE_TRACED || engine == ENGINE_PROFILED) {
+        return ENGINE_CHECKED;
     }
-    return 0;
+    return engine;
 }
 
-int main(int argc, char *argv[]) {
-    // char *filename;
-    // // get filename
-    // // too many or too few arguments
-    if(argc != 2) {
-        printf("Wrong number of arguments\n");
-        exit(1);
+// returns how the program ended, enum VM_STATUS; code, when there is some, runs first
+static int run(struct VM *vm, enum ENGINE engine, void (*code)(struct VM *vm)) {
+    // not written after setjmp, so it is intact when a routine jumps back
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    vm->deadline_ns = vm->timeout_ns != 0
+            ? start.tv_sec * 1000000000ull + start.tv_nsec + vm->timeout_ns : 0;
+    if(vm->hw != NULL) {
+        hw_run_start(vm->hw);
     }
-
-    struct VM vm;
-    read_file_into_mem(&vm, argv[1]);
-    get_inst_lines(&vm, argv[1]);
-
-
-    //initialise PC
-    vm.PC = 0x0000;
-    vm.PC_lines = 0x0000;
-
-    // initialise all registers to 0
-    for(int i = 0 ; i < 32 ; i++) {
-        vm.registers[i] = 0;
-    }
-
-    while(vm.PC <= 0x3ff) {
-        // initialise register 0
-        vm.registers[0] = 0;
-
-        // initialise an INST to capture all info 
-        struct INST inst;
-
-        // get index
-        vm.PC_lines = vm.PC / 4;
-
-        inst.line = vm.inst_lines[vm.PC_lines];
-        inst.opcode = extract_opcode(inst.line);
-        inst.type = inst_type(inst.opcode);
-
-
-        // differentiate by type
-        // assign values for each attribute
-        switch(inst.type) {
-            // type R
-            case TYPE_R:
-                inst.type_info.R.rd = extract_rd(inst.line);
-                inst.type_info.R.func3 = extract_func3(inst.line);
-                inst.type_info.R.rs1 = extract_rs1(inst.line);
-                inst.type_info.R.rs2 = extract_rs2(inst.line);
-                inst.type_info.R.func7 = extract_func7(inst.line);
-
-                // find specific function
-                // TODO check for func7 (if incorrect error handle)
-                switch(inst.type_info.R.func3) {
-                    case ADD_FUNC3:
-                        if((inst.type_info.R.func7 ^ ADD_FUNC7) == 0) {
-                            inst.name = "add";
-                        }
-                        else if((inst.type_info.R.func7 ^ SUB_FUNC7) == 0) {
-                            inst.name = "sub";
-                        }
-                        break;
-                    case XOR_FUNC3:
-                        inst.name = "xor";
-                        break;
-                    case OR_FUNC3:
-                        inst.name = "or";
-                        break;
-                    case AND_FUNC3:
-                        inst.name = "add";
-                        break;
-                    case SLL_FUNC3:
-                        inst.name = "sll";
-                        break;
-                    case SRL_FUNC3:
-                        if((inst.type_info.R.func7 ^ SRL_FUNC7) == 0){
-                            inst.name = "srl";
-                        }
-                        else if((inst.type_info.R.func7 ^ SRA_FUNC7) == 0) {
-                            inst.name = "sra";
-                        }
-                        break;
-                    case SLT_FUNC3:
-                        inst.name = "slt";
-                        break;
-                    case SLTU_FUNC3:
-                        inst.name = "sltu";
-                        break;
-                }
-                break;
-            // type I
-            case TYPE_I_JMP:
-                inst.type_info.I.rd = extract_rd(inst.line);
-                inst.type_info.I.func3 = extract_func3(inst.line);
-                inst.type_info.I.rs1 = extract_rs1(inst.line);
-                inst.type_info.I.imm = extract_bits(inst.line, 31, 20);
-                inst.type_info.I.imm_signed = sext(inst.type_info.I.imm, 12);
-
-                switch(inst.type_info.I.func3) {
-                    case JALR_FUNC3:
-                        inst.name = "jalr";
-                        break;
-                }
-                break;
-            case TYPE_I_LOAD:
-                inst.type_info.I.rd = extract_rd(inst.line);
-                inst.type_info.I.func3 = extract_func3(inst.line);
-                inst.type_info.I.rs1 = extract_rs1(inst.line);
-                inst.type_info.I.imm = extract_bits(inst.line, 31, 20);
-                inst.type_info.I.imm_signed = sext(inst.type_info.I.imm, 12);
-
-                switch(inst.type_info.I.func3) {
-                    case LB_FUNC3:
-                        inst.name = "lb";
-                        break;
-                    case LH_FUNC3:
-                        inst.name = "lh";
-                        break;
-                    case LW_FUNC3:
-                        inst.name = "lw";
-                        break;
-                    case LBU_FUNC3:
-                        inst.name = "lbu";
-                        break;
-                    case LHU_FUNC3:
-                        inst.name = "lhu";
-                        break;
-                }
+    if(vm->sampler != NULL) {
+        sample_arm(vm);
+    }
+    int status = setjmp(vm->exit_jmp);
+    if(status == 0) {
+        // arm the countdown, a budget already spent ends the run here
+        limit_check(vm);
+        // compiled code checks no limits and records nothing, the engine does
+        if(code != NULL && vm->trace == NULL && vm->profile == NULL && vm->sampler == NULL && !is_limited(vm)) {
+            vm->cur_block = NULL;
+            code(vm);
+        }
+        switch(pick_variant(vm, engine)) {
+            case ENGINE_THREADED:
+                run_threaded(vm);
                 break;
-            case TYPE_I:
-                inst.type_info.I.rd = extract_rd(inst.line);
-                inst.type_info.I.func3 = extract_func3(inst.line);
-                inst.type_info.I.rs1 = extract_rs1(inst.line);
-                inst.type_info.I.imm = extract_bits(inst.line, 31, 20);
-                inst.type_info.I.imm_signed = sext(inst.type_info.I.imm, 12);
-
-                switch(inst.type_info.I.func3) {
-                    case ADDI_FUNC3:
-                        inst.name = "addi";
-                        break;
-                    case XORI_FUNC3:
-                        inst.name = "xori";
-                        break;
-                    case ORI_FUNC3:
-                        inst.name = "ori";
-                        break;
-                    case ANDI_FUNC3:
-                        inst.name = "andi";
-                        break;
-                    case SLTI_FUNC3:
-                        inst.name = "slti";
-                        break;
-                    case SLTIU_FUNC3:
-                        inst.name = "sltiu";
-                        break;
-                }
+            case ENGINE_CHECKED:
+                run_threaded_checked(vm);
                 break;
-            // type S
-            case TYPE_S:
-                inst.type_info.S.imm1 = extract_bits(inst.line, 11, 7);
-                inst.type_info.S.func3 = extract_func3(inst.line);
-                inst.type_info.S.rs1 = extract_rs1(inst.line);
-                inst.type_info.S.rs2 = extract_rs2(inst.line);
-                inst.type_info.S.imm2 = extract_bits(inst.line, 31, 25) << 5;   // offset by 5 bits (bit 25 mapped to bit 5)
-                inst.type_info.S.imm = inst.type_info.S.imm1 | inst.type_info.S.imm2;
-                inst.type_info.S.imm_signed = sext(inst.type_info.S.imm, 12);
-
-                switch(inst.type_info.S.func3) {
-                    case SB_FUNC3:
-                        inst.name = "sb";
-                        break;
-                    case SH_FUNC3:
-                        inst.name = "sh";
-                        break;
-                    case SW_FUNC3:
-                        inst.name = "sw";
-                        break;
-                }
+            case ENGINE_TRACED:
+                run_threaded_trace(vm);
                 break;
-            // type SB
-            case TYPE_SB:
-                inst.type_info.SB.func3 = extract_func3(inst.line);
-                inst.type_info.SB.imm1 = (extract_bits(inst.line, 7, 7) << 11) | (extract_bits(inst.line, 11, 8) << 1);    // bit 7 offset by 11 and bits 8-11 offset by 1
-                inst.type_info.SB.rs1 = extract_rs1(inst.line);
-                inst.type_info.SB.rs2 = extract_rs2(inst.line);
-                inst.type_info.SB.imm2 = (extract_bits(inst.line, 30, 25) << 5) | (extract_bits(inst.line, 31, 31) << 12);
-                inst.type_info.S.imm = inst.type_info.SB.imm1 | inst.type_info.SB.imm2;
-                inst.type_info.S.imm_signed = sext(inst.type_info.S.imm, 13);
-
-                switch(inst.type_info.SB.func3) {
-                    case BEQ_FUNC3:
-                        inst.name = "beq";
-                        break;
-                    case BNE_FUNC3:
-                        inst.name = "bne";
-                        break;
-                    case BLT_FUNC3:
-                        inst.name = "blt";
-                        break;
-                    case BLTU_FUNC3:
-                        inst.name = "bltu";
-                        break;
-                    case BGE_FUNC3:
-                        inst.name = "bge";
-                        break;
-                    case BGEU_FUNC3:
-                        inst.name = "bgeu";
-                        break;
-                }
+            case ENGINE_PROFILED:
+                run_threaded_profile(vm);
                 break;
-            // type U
-            case TYPE_U:
-                inst.type_info.U.rd = extract_rd(inst.line);
-                inst.type_info.U.imm = (extract_bits(inst.line, 31, 12) << 12);
-                inst.type_info.U.imm_signed = sext(inst.type_info.U.imm, 32);
-                inst.name = "lui";
+            case ENGINE_JIT:
+                run_jit(vm);
                 break;
-            // type UJ
-            case TYPE_UJ:
-                inst.type_info.UJ.rd = extract_rd(inst.line);
-                inst.type_info.UJ.imm = (extract_bits(inst.line, 19, 12) << 12) | (extract_bits(inst.line, 20, 20) << 11);     //extract bit 12:19 and bit 11
-                inst.type_info.UJ.imm = inst.type_info.UJ.imm | (extract_bits(inst.line, 30, 21) << 1) | (extract_bits(inst.line, 31, 31) << 20);
-                inst.type_info.UJ.imm_signed = sext(inst.type_info.UJ.imm, 21);
-                inst.name = "jal";
+            default:
+                run_blocks(vm, UINT64_MAX);
                 break;
-            // type invalid
-            case TYPE_INVALID:
-                printf("Instruction Not Implemented: 0x%08x\n", inst.line);
-                dump_reg(&vm);
-                exit(1);
-
         }
+        out_flush(vm->out);
+        status = VM_OK;
+    }
+    if(vm->sampler != NULL) {
+        sample_disarm(vm);
+    }
+    if(vm->hw != NULL) {
+        hw_run_end(vm->hw);
+    }
+    if(vm->trace != NULL) {
+        trace_end_run(vm);
+    }
+    vm->run_ns = elapsed_ns(&start);
+    return status;
+}
 
-        //VIRTUAL ROUTINE CHECK
-        int load_vr = 0;
-        // check halt
-        if (exe_store_vr(&inst, &vm) == 1){
-            // increment PC
-            vm.PC += 4;
-            continue;
-        }
-        // check load
-        else if(strcmp("lb", inst.name) == 0 || strcmp("lh", inst.name) == 0 || strcmp("lw", inst.name) == 0 ||strcmp("lbu", inst.name) == 0 || strcmp("lhu", inst.name) == 0) {
-            if(is_load_vr(inst.name, inst.type_info.I.rs1, inst.type_info.I.imm, &vm) != 0) {
-                load_vr = 1;
-            }
-        }
-        // check malloc
-        else if(exe_heap(&inst, &vm) == 1) {
-            vm.PC += 4;
-            continue;
-        }
+int vm_run(struct VM *vm, enum ENGINE engine) {
+    return run(vm, engine, NULL);
+}
 
+int vm_run_compiled(struct VM *vm, void (*code)(struct VM *vm)) {
+    return run(vm, ENGINE_BLOCKS, code);
+}
 
-        // arithmetic and logic operations
-        if(strcmp("add", inst.name) == 0) {
-            add(&vm, inst.type_info.R.rd, inst.type_info.R.rs1, inst.type_info.R.rs2);
-        }
-        if(strcmp("addi", inst.name) == 0) {
-            addi(&vm, inst.type_info.I.rd, inst.type_info.I.rs1, inst.type_info.I.imm_signed);
-        }
-        if(strcmp("sub", inst.name) == 0) {
-            sub(&vm, inst.type_info.R.rd, inst.type_info.R.rs1, inst.type_info.R.rs2);
-        }
-        if(strcmp("lui", inst.name) == 0) {
-            lui(&vm, inst.type_info.U.rd, inst.type_info.U.imm_signed);
-        }
-        if(strcmp("xor", inst.name) == 0) {
-            xor(&vm, inst.type_info.R.rd, inst.type_info.R.rs1, inst.type_info.R.rs2);
-        }
-        if(strcmp("xori", inst.name) == 0) {
-            xori(&vm, inst.type_info.I.rd, inst.type_info.I.rs1, inst.type_info.I.imm_signed);
-        }
-        if(strcmp("or", inst.name) == 0) {
-            or(&vm, inst.type_info.R.rd, inst.type_info.R.rs1, inst.type_info.R.rs2);
-        }
-        if(strcmp("ori", inst.name) == 0) {
-            ori(&vm, inst.type_info.I.rd, inst.type_info.I.rs1, inst.type_info.I.imm_signed);
-        }
-        if(strcmp("and", inst.name) ==  0) {
-            and(&vm, inst.type_info.R.rd, inst.type_info.R.rs1, inst.type_info.R.rs2);
-        }
-        if(strcmp("andi", inst.name) == 0) {
-            andi(&vm, inst.type_info.I.rd, inst.type_info.I.rs1, inst.type_info.I.imm_signed);
-        }
-        if(strcmp("sll", inst.name) == 0) {
-            vm.registers[inst.type_info.R.rd] = vm.registers[inst.type_info.R.rs1] << vm.registers[inst.type_info.R.rs2];
-        }
-        if(strcmp("srl", inst.name) == 0) {
-            vm.registers[inst.type_info.R.rd] = vm.registers[inst.type_info.R.rs1] >> vm.registers[inst.type_info.R.rs2];
-        }
-        if(strcmp("sra", inst.name) == 0) {
-            // get the shifted num
-            int shift_amount = vm.registers[inst.type_info.R.rs2];
-            uint32_t shifted = vm.registers[inst.type_info.R.rs1] >> vm.registers[shift_amount];
-            uint32_t out_of_frame = vm.registers[inst.type_info.R.rs1] << (32-shift_amount);
-            vm.registers[inst.type_info.R.rd] = shifted | out_of_frame;
-        }
-        
-        // Memory access operations
-        if(strcmp("lb", inst.name) == 0) {
-            //8 bit
-            if(load_vr == 1) {
-                if (is_load_vr(inst.name, inst.type_info.I.rs1, inst.type_info.I.imm, &vm) == VIR_R_CHAR) {
-                    vm.registers[inst.type_info.I.rd] = (int32_t) sext(extract_bits(r_char(), 7, 0), 8);
-                }
-                else {
-                    vm.registers[inst.type_info.I.rd] = (int32_t) sext(extract_bits(r_int(), 7, 0), 8);
-                }
-                load_vr = 0;
-            }
-            else {
-                // get first byte then get sign extended value
-                int32_t sign_ext = sext(get_rs_val(&vm, inst.type_info.I.rs1, inst.type_info.I.imm_signed), 8);
-                vm.registers[inst.type_info.I.rd] = (int32_t) sign_ext;
-            }
-        }
-        if(strcmp("lh", inst.name) == 0) {
-            // 16 bit
-            if(load_vr == 1) {
-                if (is_load_vr(inst.name, inst.type_info.I.rs1, inst.type_info.I.imm, &vm) == VIR_R_CHAR) {
-                    vm.registers[inst.type_info.I.rd] = (int32_t) sext(extract_bits(r_char(), 15, 0), 16);
-                }
-                else {
-                    vm.registers[inst.type_info.I.rd] = (int32_t) sext(extract_bits(r_int(), 15, 0), 16);
-                }
-                load_vr = 0;
-            }
-            else {
-                int32_t sign_ext = extract_bits(get_mem_bytes(&vm, inst.type_info.I.rs1, inst.type_info.I.imm_signed, 2), 15, 0);
-                sign_ext = sext(sign_ext, 16);
-                vm.registers[inst.type_info.I.rd] = (int32_t) sign_ext;
-            }
-        }
-        if(strcmp("lw", inst.name) == 0) {
-            // 32 bit
-            if(load_vr == 1) {
-                if (is_load_vr(inst.name, inst.type_info.I.rs1, inst.type_info.I.imm, &vm) == VIR_R_CHAR) {
-                    vm.registers[inst.type_info.I.rd] = (int32_t) r_char();
-                }
-                else {
-                    vm.registers[inst.type_info.I.rd] = (int32_t) r_int();
-                }
-                load_vr = 0;
-            }
-            else {
-                vm.registers[inst.type_info.I.rd] = (int32_t) get_mem_bytes(&vm, inst.type_info.I.rs1, inst.type_info.I.imm_signed, 4);
-            }        
-        }
-        if(strcmp("lbu", inst.name) == 0) {
-            // unsigned 8 bit
-            if(load_vr == 1) {
-                if (is_load_vr(inst.name, inst.type_info.I.rs1, inst.type_info.I.imm, &vm) == VIR_R_CHAR) {
-                    vm.registers[inst.type_info.I.rd] = extract_bits(r_char(), 7, 0);
-                }
-                else {
-                    vm.registers[inst.type_info.I.rd] = extract_bits(r_int(), 7, 0);
-                }
-                load_vr = 0;
-            }
-            else {
-                vm.registers[inst.type_info.I.rd] = get_rs_val(&vm, inst.type_info.I.rs1, inst.type_info.I.imm_signed);
-            }             
-        }
-        if(strcmp("lhu", inst.name) == 0) {
-            // unsigned 16 bit
-            if(load_vr == 1) {
-                if (is_load_vr(inst.name, inst.type_info.I.rs1, inst.type_info.I.imm, &vm) == VIR_R_CHAR) {
-                    vm.registers[inst.type_info.I.rd] = extract_bits(r_char(), 15, 0);
-                }
-                else {
-                    vm.registers[inst.type_info.I.rd] = extract_bits(r_int(), 15, 0);
-                }
-                load_vr = 0;
-            }
-            else {
-                vm.registers[inst.type_info.I.rd] = get_mem_bytes(&vm, inst.type_info.I.rs1, inst.type_info.I.imm_signed, 2);
-            }             
-        }
-        if(strcmp("sb", inst.name) == 0) {
-            // 8 bit to mem
-            vm.data_mem[vm.registers[inst.type_info.S.rs1] + inst.type_info.S.imm_signed - 0x0400] = (int32_t) vm.registers[inst.type_info.S.rs2]; 
-        }
-        if(strcmp("sh", inst.name) == 0) {
-            // 16 bit to mem
-            // vm.data_mem[vm.registers[inst.type_info.S.rs1] + inst.type_info.S.imm_signed - 0x0400] = vm.registers[inst.type_info.S.rs2]; 
-            store_mem_bytes(&vm, inst.type_info.S.rs1, inst.type_info.S.imm_signed, vm.registers[inst.type_info.S.rs2], 2);
-        }
-        if(strcmp("sw", inst.name) == 0) {
-            // 32 bit to mem
-            store_mem_bytes(&vm, inst.type_info.S.rs1, inst.type_info.S.imm_signed, vm.registers[inst.type_info.S.rs2], 4);
-        }
-        
-        // Program flow operations
-        if (strcmp("slt", inst.name) == 0) {
-            if((int32_t) vm.registers[inst.type_info.R.rs1] < (int32_t) vm.registers[inst.type_info.R.rs2]) {
-                vm.registers[inst.type_info.R.rd] = 1;
-            }
-            else {
-                vm.registers[inst.type_info.R.rd] = 0;
-            }
-        }
-        if (strcmp("slti", inst.name) == 0) {
-            // TODO implement signed
-            if((int32_t)vm.registers[inst.type_info.I.rs1] < (int32_t) inst.type_info.I.imm_signed) {
-                vm.registers[inst.type_info.I.rd] = 1;
-            }
-            else {
-                vm.registers[inst.type_info.R.rd] = 0;
-            }
-        }
-        if (strcmp("sltu", inst.name) == 0) {
-            if(vm.registers[inst.type_info.R.rs1] < vm.registers[inst.type_info.R.rs2]) {
-                vm.registers[inst.type_info.R.rd] = 1;
-            }
-            else {
-                vm.registers[inst.type_info.R.rd] = 0;
-            }
-        }
-        if (strcmp("sltiu", inst.name) == 0) {
-            if(vm.registers[inst.type_info.I.rs1] < inst.type_info.I.imm) {
-                vm.registers[inst.type_info.I.rd] = 1;
-            }
-            else {
-                vm.registers[inst.type_info.I.rd] = 0;
-            }
-        }
-        // these change PC values!!
-        if (strcmp("beq", inst.name) == 0) {
-            if((int32_t)vm.registers[inst.type_info.SB.rs1] == (int32_t) vm.registers[inst.type_info.SB.rs2]) {
-                vm.PC += (inst.type_info.SB.imm_signed);
-                continue;
-            }
-        }
-        if(strcmp("bne", inst.name) == 0) {
-            if((int32_t) vm.registers[inst.type_info.SB.rs1] != (int32_t) vm.registers[inst.type_info.SB.rs2]) {
-                vm.PC += (inst.type_info.SB.imm_signed);
-                continue;
-            }
-        }
-        if(strcmp("blt", inst.name) == 0) {
-            if((int32_t) vm.registers[inst.type_info.SB.rs1] < (int32_t) vm.registers[inst.type_info.SB.rs2]) {
-                vm.PC += (inst.type_info.SB.imm_signed);
-                continue;
-            }
-        }
-        if(strcmp("bltu", inst.name) == 0) {
-            // unsigned
-            if(vm.registers[inst.type_info.SB.rs1] < vm.registers[inst.type_info.SB.rs2]) {
-                vm.PC += (inst.type_info.SB.imm_signed);
-                continue;
-            }
-        }
-        if(strcmp("bge", inst.name) == 0) {
-            if((int32_t) vm.registers[inst.type_info.SB.rs1] >= (int32_t) vm.registers[inst.type_info.SB.rs2]) {
-                vm.PC += (inst.type_info.SB.imm_signed);
-                continue;
-            }
-        }
-        if(strcmp("bgeu", inst.name) == 0) {
-            // unsigned
-            if(vm.registers[inst.type_info.SB.rs1] >= vm.registers[inst.type_info.SB.rs2]) {
-                vm.PC += (inst.type_info.SB.imm_signed);
-                continue;
-            }
-        }
-        if(strcmp("jal", inst.name) == 0) {
-            vm.registers[inst.type_info.UJ.rd] = vm.PC + 4;
-            vm.PC += (inst.type_info.UJ.imm_signed);
+// instructions run since the last load or reset
+uint64_t vm_insn_count(struct VM *vm) {
+    return vm->insn_count + blocks_insn_count(vm);
+}
 
-            continue;
-        }
-        if(strcmp("jalr", inst.name) == 0) {
-            vm.registers[inst.type_info.I.rd] = vm.PC + 4;
-            vm.PC = vm.registers[inst.type_info.I.rs1];
-            continue;
-        }
+void vm_destroy(struct VM *vm) {
+    vm_trace_stop(vm);
+    out_close(vm->out);
+    in_close(vm->in);
+    jit_release(vm);
+    free(vm->snap);
+    free(vm->profile);
+    sample_release(vm);
+    hw_release(vm);
+    large_release(vm);
+    free(vm->out);
+    free(vm->in);
+    free(vm);
+}
 
-        
-        //increment PC
-        vm.PC += 4;
+static const char *engine_names[ENGINE_NUM] = {
+#define ENGINE_NAME(id, name) [ENGINE_##id] = name,
+    ENGINE_LIST(ENGINE_NAME)
+#undef ENGINE_NAME
+};
 
+int vm_engine_by_name(const char *name) {
+    for(int i = 0 ; i < ENGINE_NUM ; i++) {
+        if(strcmp(name, engine_names[i]) == 0) {
+            return i;
+        }
     }
+    return -1;
+}
 
-    
+const char *vm_engine_name(enum ENGINE engine) {
+    return engine < ENGINE_NUM ? engine_names[engine] : "unknown";
+}
 
-    return 0;
-}
\ No newline at end of file
+const char *vm_status_name(int status) {
+    switch(status) {
+        case VM_OK:
+            return "ok";
+        case VM_HALT:
+            return "halt";
+        case VM_NOT_IMPLEMENTED:
+            return "instruction not implemented";
+        case VM_ILLEGAL_OPERATION:
+            return "illegal operation";
+        case VM_INSN_LIMIT:
+            return "instruction limit exceeded";
+        case VM_TIMEOUT:
+            return "time limit exceeded";
+        case VM_BLOCKED:
+            return "waiting for input";
+        case VM_YIELD:
+            return "quantum expired";
+        default:
+            return "load error";
+    }
+}